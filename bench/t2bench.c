@@ -0,0 +1,1057 @@
+
+/**
+
+    T2 bench, para medir o desempenho das camadas do T2FS
+
+    Deve ser executado no diretório que contém o "t2fs_disk.dat".
+    Uso: ./t2bench [benchmark] [argumentos]
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "t2fs.h"
+#include "apidisk.h"
+#include "bitmap2.h"
+#include "t2disk.h"
+#include "t2fslib.h"
+#include "t2space.h"
+
+#define DEFAULT_SECTORS 4096
+#define DEFAULT_ROUNDS 8
+
+void benchDevice(int argc, char **argv);
+void benchBatch(int argc, char **argv);
+void benchCache(int argc, char **argv);
+void benchBlockMap(int argc, char **argv);
+void benchReadAhead(int argc, char **argv);
+void benchIngest(int argc, char **argv);
+void benchBitmap(int argc, char **argv);
+void benchFragment(int argc, char **argv);
+void benchExtents(int argc, char **argv);
+void benchAging(int argc, char **argv);
+void benchDelete(int argc, char **argv);
+void benchCleanup(int argc, char **argv);
+void benchPread(int argc, char **argv);
+void benchSeek(int argc, char **argv);
+void benchTruncate(int argc, char **argv);
+void benchVector(int argc, char **argv);
+void benchAsync(int argc, char **argv);
+
+char helpDevice[] = "[sectors] [rounds] -> sectors/second of fopen-per-call vs. pread vs. mmap vs. RAM device";
+
+char helpBatch[] = "[chunk] [batch] [depth] -> sequential and random batched reads, pread vs. io_uring";
+
+char helpCache[] = "[files] [rounds] -> metadata workload on a RAM disk, hits/misses per cache size";
+
+char helpBlockMap[] = "[kbytes] [chunk] [rounds] -> sequential read2 of a file reaching the double indirection";
+
+char helpReadAhead[] = "[kbytes] [rounds] -> sequential read2 of a big file per read size, with read-ahead";
+
+char helpIngest[] = "[kbytes] -> write2 of a big file per write size, and sectors read to do it";
+
+char helpBitmap[] = "[sectors per block] -> allocates every block of a 1 GB partition, then refills it when nearly full or full";
+
+char helpExtents[] = "[kbytes] [chunk] -> first sequential read2 of a big file after mounting, per inode format";
+
+char helpAging[] = "[rounds] [kbytes] -> creates and deletes random files for a number of rounds, then writes a big file and counts its runs of blocks";
+
+char helpDelete[] = "[kbytes] [rounds] -> delete2 of a big file, and freeing its blocks, per inode format";
+
+char helpCleanup[] = "[files] [kbytes] -> delete2 of many big files between 4 KB write2s to another one, and the longest write2";
+
+char helpPread[] = "[kbytes] [lookups] -> random 64 byte lookups in a big file, reopen and read forward vs. pread2";
+
+char helpTruncate[] = "[files] [kbytes] -> rotating a [kbytes] KB log among [files] files, delete2 and create2 vs. truncate2";
+
+char helpVector[] = "[records] [payload] -> records of a 16 byte header, a payload and an 8 byte trailer, three write2s vs. one writev2";
+
+char helpAsync[] = "[kbytes] [work] -> 4 KB chunks of a big file, each followed by [work] us of processing, read2 vs. submit2 with 32 in flight";
+
+char helpSeek[] = "[kbytes] [rounds] -> a 64 byte record written [kbytes] KB into a new file, zero-filling up to it vs. seek2 over a hole";
+
+char helpFragment[] = "[kbytes] [chunk] -> write2 of a big file over scattered free blocks, and the runs of blocks it is stored in";
+
+struct
+{
+    char name[20];
+    char *helpString;
+    void (*f)(int argc, char **argv);
+} benchList[] = {
+    {"device", helpDevice, benchDevice},
+    {"batch", helpBatch, benchBatch},
+    {"cache", helpCache, benchCache},
+    {"blockmap", helpBlockMap, benchBlockMap},
+    {"readahead", helpReadAhead, benchReadAhead},
+    {"ingest", helpIngest, benchIngest},
+    {"bitmap", helpBitmap, benchBitmap},
+    {"fragment", helpFragment, benchFragment},
+    {"extents", helpExtents, benchExtents},
+    {"aging", helpAging, benchAging},
+    {"delete", helpDelete, benchDelete},
+    {"cleanup", helpCleanup, benchCleanup},
+    {"pread", helpPread, benchPread},
+    {"seek", helpSeek, benchSeek},
+    {"truncate", helpTruncate, benchTruncate},
+    {"vector", helpVector, benchVector},
+    {"async", helpAsync, benchAsync},
+    {"fim", NULL, NULL}};
+
+// Returns the current time in seconds, using a monotonic clock
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Reads an integer argument, falling back to `fallback` if it isn't there
+static int intArg(int argc, char **argv, int index, int fallback)
+{
+    if (index >= argc)
+        return fallback;
+
+    return atoi(argv[index]);
+}
+
+static void report(char *name, long sectors, double seconds)
+{
+    printf("%-24s %10ld sectors %8.3f s %12.0f sectors/s\n", name, sectors, seconds, sectors / seconds);
+}
+
+/*
+    Reference implementation of the original `apidisk.o`, which opened,
+    seeked and closed the disk image on every single sector access
+*/
+static int legacyReadSector(unsigned int sector, unsigned char *buffer)
+{
+    FILE *disk = fopen("t2fs_disk.dat", "r+b");
+    if (disk == NULL)
+        return -1;
+
+    if (fseek(disk, (long)sector * SECTOR_SIZE, SEEK_SET) != 0 || fread(buffer, SECTOR_SIZE, 1, disk) != 1)
+    {
+        fclose(disk);
+        return -1;
+    }
+
+    fclose(disk);
+    return 0;
+}
+
+void benchDevice(int argc, char **argv)
+{
+    int sectors = intArg(argc, argv, 2, DEFAULT_SECTORS);
+    int rounds = intArg(argc, argv, 3, DEFAULT_ROUNDS);
+    unsigned char buffer[SECTOR_SIZE];
+    double start;
+
+    start = now();
+    for (int r = 0; r < rounds; r++)
+        for (int s = 0; s < sectors; s++)
+            if (legacyReadSector(s, buffer) != 0)
+            {
+                printf("Error reading sector %d (fopen)\n", s);
+                return;
+            }
+    report("fopen-per-call", (long)sectors * rounds, now() - start);
+
+    if (open_disk() != 0)
+        return;
+
+    start = now();
+    for (int r = 0; r < rounds; r++)
+        for (int s = 0; s < sectors; s++)
+            if (read_sector(s, buffer) != 0)
+            {
+                printf("Error reading sector %d (pread)\n", s);
+                return;
+            }
+    report("persistent pread", (long)sectors * rounds, now() - start);
+
+    if (set_disk_mode(DISK_MODE_MMAP) != 0)
+        return;
+
+    start = now();
+    for (int r = 0; r < rounds; r++)
+        for (int s = 0; s < sectors; s++)
+            if (read_sector(s, buffer) != 0)
+            {
+                printf("Error reading sector %d (mmap)\n", s);
+                return;
+            }
+    report("mmap", (long)sectors * rounds, now() - start);
+
+    if (set_disk_mode(DISK_MODE_RAM) != 0)
+        return;
+
+    start = now();
+    for (int r = 0; r < rounds; r++)
+        for (int s = 0; s < sectors; s++)
+            if (read_sector(s, buffer) != 0)
+            {
+                printf("Error reading sector %d (ram)\n", s);
+                return;
+            }
+    report("ram", (long)sectors * rounds, now() - start);
+
+    close_disk();
+}
+
+// Reads `requests` chunks of `chunk` sectors, `batch` requests at a time, either
+// walking the disk sequentially or jumping to random chunks
+static double batchedReads(int random, int requests, int chunk, int batch, int diskSectors, unsigned char *buffers)
+{
+    SECTOR_REQUEST list[batch];
+    double start = now();
+
+    srand(2019);
+    for (int done = 0; done < requests; done += batch)
+    {
+        int quantity = requests - done < batch ? requests - done : batch;
+        for (int i = 0; i < quantity; i++)
+        {
+            int index = random ? rand() % (diskSectors / chunk) : (done + i) % (diskSectors / chunk);
+            list[i] = (SECTOR_REQUEST){index * chunk, chunk, buffers + (size_t)i * chunk * SECTOR_SIZE};
+        }
+
+        if (read_sectors_batch(list, quantity) != 0)
+        {
+            printf("Error reading batch\n");
+            return -1;
+        }
+    }
+
+    return now() - start;
+}
+
+void benchBatch(int argc, char **argv)
+{
+    int chunk = intArg(argc, argv, 2, 16);
+    int batch = intArg(argc, argv, 3, 32);
+    int depth = intArg(argc, argv, 4, DISK_DEFAULT_QUEUE_DEPTH);
+    int diskSectors = 4096; // 1 MB disk image
+    int requests = DEFAULT_ROUNDS * 16 * diskSectors / chunk;
+    unsigned char *buffers = (unsigned char *)malloc((size_t)batch * chunk * SECTOR_SIZE);
+    int modes[] = {DISK_MODE_FILE, DISK_MODE_URING};
+    char *names[] = {"pread", "io_uring"};
+
+    if (chunk <= 0 || batch <= 0 || chunk > diskSectors || set_disk_queue_depth(depth) != 0)
+    {
+        printf("Invalid parameters\n");
+        return;
+    }
+
+    for (int m = 0; m < 2; m++)
+    {
+        char name[64];
+
+        close_disk();
+        if (set_disk_mode(modes[m]) != 0 || open_disk() != 0)
+            return;
+
+        sprintf(name, "%s sequential", names[m]);
+        report(name, (long)requests * chunk, batchedReads(0, requests, chunk, batch, diskSectors, buffers));
+
+        sprintf(name, "%s random", names[m]);
+        report(name, (long)requests * chunk, batchedReads(1, requests, chunk, batch, diskSectors, buffers));
+    }
+
+    close_disk();
+    free(buffers);
+}
+
+// Creates `files` small files, then lists the directory and reads every file `rounds` times
+static int metadataWorkload(int files, int rounds)
+{
+    char name[32], buffer[64];
+    DIRENT2 dentry;
+
+    for (int i = 0; i < files; i++)
+    {
+        sprintf(name, "file%d", i);
+        FILE2 handle = create2(name);
+        if (handle < 0 || write2(handle, name, strlen(name)) != (int)strlen(name))
+            return -1;
+        close2(handle);
+    }
+
+    for (int r = 0; r < rounds; r++)
+    {
+        opendir2();
+        while (readdir2(&dentry) == 0)
+            ;
+        closedir2();
+
+        for (int i = 0; i < files; i++)
+        {
+            sprintf(name, "file%d", i);
+            FILE2 handle = open2(name);
+            if (handle < 0 || read2(handle, buffer, sizeof(buffer)) < 0)
+                return -1;
+            close2(handle);
+        }
+    }
+
+    return 0;
+}
+
+void benchCache(int argc, char **argv)
+{
+    int files = intArg(argc, argv, 2, 64);
+    int rounds = intArg(argc, argv, 3, DEFAULT_ROUNDS);
+    int sizes[] = {8, 64, 512, 4096};
+    CACHESTATS2 stats[4];
+    double seconds[4];
+
+    // A fresh 4 MB disk in memory, so the image on disk is left untouched
+    if (set_ram_disk_size(16384) != 0 || set_disk_mode(DISK_MODE_RAM) != 0)
+        return;
+
+    for (int i = 0; i < 4; i++)
+    {
+        if (format2(0, 4) != 0 || cachesize2(sizes[i]) != 0 || mount(0) != 0)
+            return;
+
+        double start = now();
+        if (metadataWorkload(files, rounds) != 0)
+        {
+            printf("Error running the workload\n");
+            return;
+        }
+        seconds[i] = now() - start;
+
+        cachestats2(&stats[i]);
+        umount();
+    }
+
+    // Printed at the end so the library messages don't get in the middle
+    for (int i = 0; i < 4; i++)
+        printf("cache %-6d %10u hits %10u misses %8u evictions %8.3f s\n", sizes[i], stats[i].hits, stats[i].misses, stats[i].evictions, seconds[i]);
+}
+
+// Creates the file "big" with `kbytes` KB, written `chunk` bytes at a time, on
+// a fresh RAM disk with one sector per block, so that a file of a few hundred
+// KB already goes past the simple indirection. Returns its size, or -1.
+static long createBigFile(int kbytes, int chunk)
+{
+    // The biggest file with one sector per block has 2 + 64 + 64 * 64 blocks
+    if (kbytes > 1024)
+        kbytes = 1024;
+
+    if (set_ram_disk_size(kbytes * 4 + 4096) != 0 || set_disk_mode(DISK_MODE_RAM) != 0 || format2(0, 1) != 0 || mount(0) != 0)
+        return -1;
+
+    char *buffer = (char *)malloc(chunk);
+    memset(buffer, 'x', chunk);
+
+    FILE2 handle = create2("big");
+    long size = (long)kbytes * 1024;
+    for (long written = 0; written < size; written += chunk)
+        if (write2(handle, buffer, chunk) != chunk)
+        {
+            printf("Error writing the file\n");
+            free(buffer);
+            return -1;
+        }
+
+    close2(handle);
+    free(buffer);
+
+    return size;
+}
+
+// Reads the file "big" front to back `rounds` times, `chunk` bytes at a time,
+// returning how long it took
+static double readBigFile(int chunk, int rounds)
+{
+    char *buffer = (char *)malloc(chunk);
+
+    double start = now();
+    for (int r = 0; r < rounds; r++)
+    {
+        FILE2 handle = open2("big");
+        while (read2(handle, buffer, chunk) > 0)
+            ;
+        close2(handle);
+    }
+    double seconds = now() - start;
+
+    free(buffer);
+
+    return seconds;
+}
+
+void benchBlockMap(int argc, char **argv)
+{
+    int kbytes = intArg(argc, argv, 2, 1024);
+    int chunk = intArg(argc, argv, 3, SECTOR_SIZE);
+    int rounds = intArg(argc, argv, 4, DEFAULT_ROUNDS);
+    CACHESTATS2 before, after;
+
+    long size;
+    if (chunk <= 0 || kbytes <= 0 || (size = createBigFile(kbytes, chunk)) < 0)
+        return;
+
+    cachestats2(&before);
+    double seconds = readBigFile(chunk, rounds);
+    cachestats2(&after);
+    umount();
+
+    // Sectors of pointers, and of data, looked up in the cache to serve the reads
+    long sectors = size / SECTOR_SIZE * rounds;
+    report("sequential read2", sectors, seconds);
+    printf("%-24s %10.3f per data sector\n", "cache lookups", (double)(after.hits + after.misses - before.hits - before.misses) / sectors);
+}
+
+void benchReadAhead(int argc, char **argv)
+{
+    int kbytes = intArg(argc, argv, 2, 1024);
+    int rounds = intArg(argc, argv, 3, DEFAULT_ROUNDS);
+    int chunks[] = {100, SECTOR_SIZE, 4096, 65536};
+    CACHESTATS2 before, after;
+    char name[32];
+
+    long size;
+    if (kbytes <= 0 || (size = createBigFile(kbytes, 4096)) < 0)
+        return;
+
+    // Sectors read ahead show up as misses, and then as hits when read2 gets to them
+    for (int i = 0; i < 4; i++)
+    {
+        cachestats2(&before);
+        double seconds = readBigFile(chunks[i], rounds);
+        cachestats2(&after);
+
+        sprintf(name, "read2 of %d bytes", chunks[i]);
+        report(name, size / SECTOR_SIZE * rounds, seconds);
+        printf("%-24s %10u hits %10u misses\n", "", after.hits - before.hits, after.misses - before.misses);
+    }
+
+    umount();
+}
+
+void benchIngest(int argc, char **argv)
+{
+    int kbytes = intArg(argc, argv, 2, 1024);
+    int chunks[] = {100, SECTOR_SIZE, 4096, 65536};
+    CACHESTATS2 stats;
+    char name[32];
+
+    if (kbytes <= 0)
+        return;
+
+    // Any miss is a sector read from the device only to be written over
+    for (int i = 0; i < 4; i++)
+    {
+        double start = now();
+        long size = createBigFile(kbytes, chunks[i]);
+        double seconds = now() - start;
+        if (size < 0)
+            return;
+
+        cachestats2(&stats);
+        umount();
+
+        sprintf(name, "write2 of %d bytes", chunks[i]);
+        report(name, size / SECTOR_SIZE, seconds);
+        printf("%-24s %10u sectors read\n", "", stats.misses);
+    }
+}
+
+// Allocates data blocks until there are none left, returning how many it got
+static long allocateAll()
+{
+    long blocks = 0;
+    int block;
+    while ((block = searchBitmap2(BITMAP_DADOS, 0)) >= 0 && setBitmap2(BITMAP_DADOS, block, 1) == 0)
+        blocks++;
+
+    return blocks;
+}
+
+void benchBitmap(int argc, char **argv)
+{
+    int sectorsPerBlock = intArg(argc, argv, 2, 1);
+
+    // A fresh 1 GB disk in memory
+    if (set_ram_disk_size(4194304) != 0 || set_disk_mode(DISK_MODE_RAM) != 0 || format2(0, sectorsPerBlock) != 0 || mount(0) != 0)
+        return;
+
+    double start = now();
+    long blocks = allocateAll();
+    double fill = now() - start;
+
+    // Free one block in every hundred, spread all over the partition
+    int freed = 0;
+    for (long block = 0; block < blocks; block += 100, freed++)
+        setBitmap2(BITMAP_DADOS, block, 0);
+
+    start = now();
+    long refilled = allocateAll();
+    double refill = now() - start;
+
+    // Full partition where a random block is freed and allocated again, over and over
+    srand(1);
+    int churns = 100000;
+    start = now();
+    for (int i = 0; i < churns; i++)
+    {
+        setBitmap2(BITMAP_DADOS, rand() % blocks, 0);
+        setBitmap2(BITMAP_DADOS, searchBitmap2(BITMAP_DADOS, 0), 1);
+    }
+    double churn = now() - start;
+
+    start = now();
+    umount();
+    double writeBack = now() - start;
+
+    printf("%-24s %10ld blocks %8.3f s %12.0f blocks/s\n", "fill", blocks, fill, blocks / fill);
+    printf("%-24s %10ld blocks %8.3f s %12.0f blocks/s\n", "refill 1% free", refilled, refill, refilled / refill);
+    printf("%-24s %10d blocks %8.3f s %12.0f blocks/s\n", "free random, allocate", churns, churn, churns / churn);
+    printf("%-24s %10.3f s\n", "umount (write back)", writeBack);
+    if (refilled != freed)
+        printf("Freed %d blocks but allocated %ld again\n", freed, refilled);
+}
+
+// Counts the runs of contiguous blocks the file "big" is stored in
+static int countFileRuns()
+{
+    RECORD record;
+    if (getRecordByName("big", &record) != 0)
+        return -1;
+
+    I_NODE *inode = getInode(record.inodeNumber);
+    int runs = 0;
+    DWORD previous = 0, address;
+    for (DWORD block = 0; block < inode->blocksFileSize; block++)
+    {
+        if (getDataBlockSectorAddress(block, 0, inode, &address) != 0)
+            break;
+        if (block == 0 || address != previous + getSuperblock()->blockSize)
+            runs++;
+        previous = address;
+    }
+    releaseInode(inode);
+
+    return runs;
+}
+
+void benchFragment(int argc, char **argv)
+{
+    int kbytes = intArg(argc, argv, 2, 1024);
+    int chunk = intArg(argc, argv, 3, 65536);
+
+    // The biggest file with one sector per block has 2 + 64 + 64 * 64 blocks
+    if (kbytes <= 0 || chunk <= 0 || kbytes > 1024)
+        return;
+
+    if (set_ram_disk_size(kbytes * 16 + 4096) != 0 || set_disk_mode(DISK_MODE_RAM) != 0 || format2(0, 1) != 0 || mount(0) != 0)
+        return;
+
+    // Leaves holes of 1 to 32 free blocks between used ones, all over the partition
+    long blocks = allocateAll();
+    srand(1);
+    for (long block = 0; block < blocks; block += 40)
+        for (int hole = rand() % 32 + 1, i = 0; i < hole; i++)
+            setBitmap2(BITMAP_DADOS, block + i, 0);
+
+    char *buffer = (char *)malloc(chunk);
+    memset(buffer, 'x', chunk);
+
+    long size = (long)kbytes * 1024;
+    FILE2 handle = create2("big");
+    double start = now();
+    for (long written = 0; written < size; written += chunk)
+        if (write2(handle, buffer, chunk) != chunk)
+        {
+            printf("Error writing the file\n");
+            break;
+        }
+    double seconds = now() - start;
+    close2(handle);
+    free(buffer);
+
+    int runs = countFileRuns();
+    umount();
+
+    report("write2", size / SECTOR_SIZE, seconds);
+    printf("%-24s %10d runs %10.1f blocks per run\n", "file stored in", runs, (double)size / SECTOR_SIZE / runs);
+}
+
+void benchExtents(int argc, char **argv)
+{
+    int kbytes = intArg(argc, argv, 2, 1024);
+    int chunk = intArg(argc, argv, 3, 4096);
+    int formats[] = {INODE_FORMAT_INDIRECT, INODE_FORMAT_EXTENTS};
+    char *names[] = {"indirect", "extents"};
+    CACHESTATS2 stats;
+
+    // The disk must be in memory before the library reads its MBR
+    if (kbytes <= 0 || chunk <= 0 || set_ram_disk_size(kbytes * 4 + 4096) != 0 || set_disk_mode(DISK_MODE_RAM) != 0)
+        return;
+
+    // Mounting again leaves nothing of the file in memory, so every pointer
+    // (or extent) is read from the disk
+    for (int i = 0; i < 2; i++)
+    {
+        inodeformat2(formats[i]);
+        long size = createBigFile(kbytes, chunk);
+        if (size < 0 || umount() != 0 || mount(0) != 0)
+            return;
+
+        double seconds = readBigFile(chunk, 1);
+        cachestats2(&stats);
+        umount();
+
+        report(names[i], size / SECTOR_SIZE, seconds);
+        printf("%-24s %10u sectors read %10.3f per data sector\n", "", stats.misses, (double)stats.misses / (size / SECTOR_SIZE));
+    }
+    inodeformat2(INODE_FORMAT_INDIRECT);
+}
+
+void benchAging(int argc, char **argv)
+{
+    int rounds = intArg(argc, argv, 2, 2000);
+    int kbytes = intArg(argc, argv, 3, 512);
+    int files = 100;
+    int sizes[100] = {0};
+    char name[16];
+
+    if (rounds <= 0 || kbytes <= 0 || kbytes > 1024)
+        return;
+
+    if (set_ram_disk_size(kbytes * 16 + 4096) != 0 || set_disk_mode(DISK_MODE_RAM) != 0 || format2(0, 1) != 0 || mount(0) != 0)
+        return;
+
+    DWORD runs, blocks;
+    spaceGetStats(&runs, &blocks);
+    long capacity = (long)blocks * SECTOR_SIZE;
+
+    char *buffer = (char *)malloc(65536);
+    memset(buffer, 'x', 65536);
+
+    // Files of 1 to 64 KB come and go, keeping the partition about 60% full
+    srand(1);
+    long used = 0;
+    double start = now();
+    for (int r = 0; r < rounds; r++)
+    {
+        int i = rand() % files;
+        sprintf(name, "age%d", i);
+        if (sizes[i] > 0)
+        {
+            delete2(name);
+            used -= sizes[i];
+            sizes[i] = 0;
+            continue;
+        }
+
+        int size = (rand() % 64 + 1) * 1024;
+        if (used + size + kbytes * 1024 > capacity * 6 / 10)
+            continue;
+
+        // The directory never reuses its records, so it eventually gets full
+        FILE2 handle = create2(name);
+        if (handle < 0)
+            break;
+        for (int written = 0; written < size; written += 4096)
+            write2(handle, buffer, 4096);
+        close2(handle);
+        sizes[i] = size;
+        used += size;
+    }
+    reclaimOrphans();
+    double aging = now() - start;
+    spaceGetStats(&runs, &blocks);
+
+    FILE2 handle = create2("big");
+    for (long written = 0; written < (long)kbytes * 1024; written += 65536)
+        write2(handle, buffer, 65536);
+    close2(handle);
+    free(buffer);
+
+    int bigRuns = countFileRuns();
+    umount();
+
+    printf("%-24s %10d rounds %8.3f s\n", "aging", rounds, aging);
+    printf("%-24s %10u runs %10u blocks\n", "free space in", runs, blocks);
+    printf("%-24s %10d runs %10.1f blocks per run\n", "file stored in", bigRuns, (double)kbytes * 1024 / SECTOR_SIZE / bigRuns);
+}
+
+void benchDelete(int argc, char **argv)
+{
+    int kbytes = intArg(argc, argv, 2, 1024);
+    int rounds = intArg(argc, argv, 3, 20);
+    int formats[] = {INODE_FORMAT_INDIRECT, INODE_FORMAT_EXTENTS};
+    char *names[] = {"delete2 indirect", "delete2 extents"};
+
+    // The disk must be in memory before the library reads its MBR
+    if (kbytes <= 0 || rounds <= 0 || set_ram_disk_size(kbytes * 4 + 4096) != 0 || set_disk_mode(DISK_MODE_RAM) != 0)
+        return;
+
+    for (int i = 0; i < 2; i++)
+    {
+        inodeformat2(formats[i]);
+
+        double seconds = 0, reclaimed = 0;
+        long size = 0;
+        for (int r = 0; r < rounds; r++)
+        {
+            if ((size = createBigFile(kbytes, 65536)) < 0)
+                return;
+
+            // The blocks are freed in the background, after delete2 returns
+            double start = now();
+            delete2("big");
+            seconds += now() - start;
+            reclaimOrphans();
+            reclaimed += now() - start;
+            umount();
+        }
+
+        printf("%-24s %10ld blocks %8.6f s %8.6f s until freed\n", names[i], size / SECTOR_SIZE, seconds / rounds, reclaimed / rounds);
+    }
+    inodeformat2(INODE_FORMAT_INDIRECT);
+}
+
+void benchCleanup(int argc, char **argv)
+{
+    int files = intArg(argc, argv, 2, 32);
+    int kbytes = intArg(argc, argv, 3, 1024);
+    char name[16];
+
+    // Files with one sector per block reach the double indirection at 17 KB, and
+    // can't reach 1 MB, so the 4 KB written after each delete2 must fit in one
+    if (files <= 0 || files > 60 || kbytes <= 0 || kbytes > 1024)
+        return;
+
+    if (set_ram_disk_size(files * kbytes * 5 + 8192) != 0 || set_disk_mode(DISK_MODE_RAM) != 0 || format2(0, 1) != 0 || mount(0) != 0)
+        return;
+
+    char *buffer = (char *)malloc(65536);
+    memset(buffer, 'x', 65536);
+
+    for (int i = 0; i < files; i++)
+    {
+        sprintf(name, "old%d", i);
+        FILE2 handle = create2(name);
+        for (long written = 0; written < (long)kbytes * 1024; written += 65536)
+            write2(handle, buffer, 65536);
+        close2(handle);
+    }
+
+    // The foreground keeps writing while the old files are deleted
+    FILE2 log = create2("log");
+    double deleting = 0, longest = 0;
+    double start = now();
+    for (int i = 0; i < files; i++)
+    {
+        sprintf(name, "old%d", i);
+        double before = now();
+        delete2(name);
+        deleting += now() - before;
+
+        for (int j = 0; j < 4; j++)
+        {
+            before = now();
+            write2(log, buffer, 4096);
+            if (now() - before > longest)
+                longest = now() - before;
+        }
+    }
+    reclaimOrphans();
+    double seconds = now() - start;
+    close2(log);
+    umount();
+    free(buffer);
+
+    printf("%-24s %10d files %8.6f s each\n", "delete2", files, deleting / files);
+    printf("%-24s %10d writes %8.6f s longest\n", "write2 4 KB", files * 4, longest);
+    printf("%-24s %10ld blocks %8.3f s\n", "freed", (long)files * kbytes * 4, seconds);
+}
+
+void benchPread(int argc, char **argv)
+{
+    int kbytes = intArg(argc, argv, 2, 1024);
+    int lookups = intArg(argc, argv, 3, 2000);
+    long size;
+
+    if (kbytes <= 0 || lookups <= 0 || (size = createBigFile(kbytes, 65536)) < 0)
+        return;
+
+    char buffer[4096];
+    long *offsets = (long *)malloc(sizeof(long) * lookups);
+    srand(1);
+    for (int i = 0; i < lookups; i++)
+        offsets[i] = ((long)rand() * RAND_MAX + rand()) % (size - 64);
+
+    // Without a way to move the cursor, every lookup reads the file up to the record
+    double start = now();
+    for (int i = 0; i < lookups; i++)
+    {
+        FILE2 handle = open2("big");
+        for (long position = 0; position < offsets[i]; position += sizeof(buffer))
+            read2(handle, buffer, offsets[i] - position < (long)sizeof(buffer) ? offsets[i] - position : (long)sizeof(buffer));
+        read2(handle, buffer, 64);
+        close2(handle);
+    }
+    double reopen = now() - start;
+
+    FILE2 handle = open2("big");
+    start = now();
+    for (int i = 0; i < lookups; i++)
+        pread2(handle, buffer, 64, offsets[i]);
+    double positional = now() - start;
+    close2(handle);
+    umount();
+    free(offsets);
+
+    printf("%-24s %10d lookups %8.3f s %12.0f lookups/s\n", "reopen and read2", lookups, reopen, lookups / reopen);
+    printf("%-24s %10d lookups %8.3f s %12.0f lookups/s\n", "pread2", lookups, positional, lookups / positional);
+}
+
+void benchSeek(int argc, char **argv)
+{
+    int kbytes = intArg(argc, argv, 2, 1000);
+    int rounds = intArg(argc, argv, 3, 20);
+    char *names[] = {"write2 zeros", "seek2 past the end"};
+
+    // The biggest file with one sector per block has 2 + 64 + 64 * 64 blocks
+    if (kbytes <= 0 || kbytes > 1024 || rounds <= 0)
+        return;
+
+    if (set_ram_disk_size(kbytes * 4 + 4096) != 0 || set_disk_mode(DISK_MODE_RAM) != 0 || format2(0, 1) != 0 || mount(0) != 0)
+        return;
+
+    char *zeros = (char *)calloc(65536, 1);
+    char record[64];
+    memset(record, 'r', sizeof(record));
+    long offset = (long)kbytes * 1024 - sizeof(record);
+
+    for (int i = 0; i < 2; i++)
+    {
+        DWORD runs, freeBefore, freeAfter;
+        double seconds = 0;
+        for (int r = 0; r < rounds; r++)
+        {
+            spaceGetStats(&runs, &freeBefore);
+            double start = now();
+            FILE2 handle = create2("sparse");
+
+            // Without seek2 the only way to get there is to write every byte before it
+            if (i == 0)
+                for (long position = 0; position < offset; position += 65536)
+                    write2(handle, zeros, offset - position < 65536 ? offset - position : 65536);
+            else
+                seek2(handle, offset);
+            write2(handle, record, sizeof(record));
+            close2(handle);
+            seconds += now() - start;
+
+            spaceGetStats(&runs, &freeAfter);
+            delete2("sparse");
+            reclaimOrphans();
+        }
+
+        printf("%-24s %10u blocks %8.6f s\n", names[i], freeBefore - freeAfter, seconds / rounds);
+    }
+    umount();
+    free(zeros);
+}
+
+void benchTruncate(int argc, char **argv)
+{
+    int files = intArg(argc, argv, 2, 2000);
+    int kbytes = intArg(argc, argv, 3, 64);
+    int rounds = 50;
+    char name[16];
+    char *names[] = {"delete2 and create2", "truncate2"};
+
+    if (files <= 0 || kbytes <= 0 || kbytes > 1024)
+        return;
+
+    if (set_ram_disk_size(files * 4 + kbytes * 8 + 8192) != 0 || set_disk_mode(DISK_MODE_RAM) != 0 || format2(0, 1) != 0 || mount(0) != 0)
+        return;
+
+    char *buffer = (char *)malloc(kbytes * 1024);
+    memset(buffer, 'x', kbytes * 1024);
+
+    // The log is the last file of a big directory
+    for (int i = 0; i < files; i++)
+    {
+        sprintf(name, "f%d", i);
+        close2(create2(name));
+    }
+
+    for (int i = 0; i < 2; i++)
+    {
+        FILE2 log = create2("log");
+        write2(log, buffer, kbytes * 1024);
+
+        double start = now();
+        for (int r = 0; r < rounds; r++)
+        {
+            if (i == 0)
+            {
+                close2(log);
+                delete2("log");
+                log = create2("log");
+            }
+            else
+            {
+                seek2(log, 0);
+                truncate2(log);
+            }
+            write2(log, buffer, kbytes * 1024);
+        }
+        double seconds = now() - start;
+        close2(log);
+        delete2("log");
+        reclaimOrphans();
+
+        printf("%-24s %10d rounds %8.6f s each\n", names[i], rounds, seconds / rounds);
+    }
+    umount();
+    free(buffer);
+}
+
+void benchVector(int argc, char **argv)
+{
+    int records = intArg(argc, argv, 2, 2000);
+    int payload = intArg(argc, argv, 3, 300);
+    char header[16], trailer[8];
+    char *names[] = {"write2 of each part", "writev2 of the record"};
+    CACHESTATS2 stats;
+
+    // The biggest file with one sector per block has 2 + 64 + 64 * 64 blocks
+    if (records <= 0 || payload <= 0 || (long)records * (payload + 24) > 1024 * 1024)
+        return;
+
+    char *body = (char *)malloc(payload);
+    memset(body, 'p', payload);
+    memset(header, 'h', sizeof(header));
+    memset(trailer, 't', sizeof(trailer));
+    IOVEC2 vector[] = {{header, sizeof(header)}, {body, payload}, {trailer, sizeof(trailer)}};
+
+    for (int i = 0; i < 2; i++)
+    {
+        if (set_ram_disk_size((long)records * (payload + 24) / SECTOR_SIZE * 4 + 4096) != 0 || set_disk_mode(DISK_MODE_RAM) != 0 || format2(0, 1) != 0 || mount(0) != 0)
+            break;
+
+        // Every sector the cache is asked for, partial sectors included
+        cachestats2(&stats);
+        DWORD lookups = stats.hits + stats.misses;
+
+        double start = now();
+        FILE2 handle = create2("records");
+        for (int r = 0; r < records; r++)
+        {
+            if (i == 0)
+            {
+                write2(handle, header, sizeof(header));
+                write2(handle, body, payload);
+                write2(handle, trailer, sizeof(trailer));
+            }
+            else
+                writev2(handle, vector, 3);
+        }
+        close2(handle);
+        double seconds = now() - start;
+
+        cachestats2(&stats);
+        umount();
+
+        printf("%-24s %10d records %8.6f s %10u sectors looked up\n", names[i], records, seconds, stats.hits + stats.misses - lookups);
+    }
+    free(body);
+}
+
+// Keeps the processor busy for `microseconds`, standing for the work done on the data read
+static void spin(int microseconds)
+{
+    double end = now() + microseconds / 1e6;
+    while (now() < end)
+        ;
+}
+
+void benchAsync(int argc, char **argv)
+{
+    int kbytes = intArg(argc, argv, 2, 1024);
+    int work = intArg(argc, argv, 3, 20);
+    int depth = 32;
+    long size;
+
+    if (kbytes <= 0 || work < 0 || (size = createBigFile(kbytes, 65536)) < 0)
+        return;
+
+    int chunks = size / 4096;
+    char *buffers = (char *)malloc((long)depth * 4096);
+    AIOREQ2 requests[32];
+    AIOEVENT2 events[32];
+
+    // The file is read once before, so that both runs find it in the same cache
+    FILE2 handle = open2("big");
+    for (int i = 0; i < chunks; i++)
+        read2(handle, buffers, 4096);
+
+    seek2(handle, 0);
+    double start = now();
+    for (int i = 0; i < chunks; i++)
+    {
+        read2(handle, buffers, 4096);
+        spin(work);
+    }
+    report("read2, then work", size / SECTOR_SIZE, now() - start);
+
+    // Each finished chunk is worked on while the next ones are being read
+    start = now();
+    int submitted = 0, done = 0;
+    for (; submitted < depth && submitted < chunks; submitted++)
+        requests[submitted] = (AIOREQ2){AIO_READ, handle, (DWORD)submitted * 4096, buffers + submitted * 4096, 4096, buffers + submitted * 4096};
+    submit2(requests, submitted);
+    while (done < submitted)
+    {
+        int reaped = reap2(events, 1, depth);
+        for (int i = 0; i < reaped; i++, done++)
+        {
+            spin(work);
+            if (submitted < chunks)
+            {
+                // The buffer is used again for the next chunk to read
+                AIOREQ2 request = {AIO_READ, handle, (DWORD)submitted * 4096, events[i].data, 4096, events[i].data};
+                submitted += submit2(&request, 1) == 1;
+            }
+        }
+    }
+    report("submit2, work on reap2", size / SECTOR_SIZE, now() - start);
+
+    close2(handle);
+    umount();
+    free(buffers);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        printf("Usage: %s [benchmark] [args]\n", argv[0]);
+        for (int i = 0; benchList[i].f != NULL; i++)
+            printf("    %-10s %s\n", benchList[i].name, benchList[i].helpString);
+        return 1;
+    }
+
+    for (int i = 0; benchList[i].f != NULL; i++)
+        if (strcmp(argv[1], benchList[i].name) == 0)
+        {
+            benchList[i].f(argc, argv);
+            return 0;
+        }
+
+    printf("Unknown benchmark %s\n", argv[1]);
+    return 1;
+}
@@ -27,7 +27,7 @@ void cmdWrite(void);
 void cmdCreate(void);
 void cmdDelete(void);
 void cmdSeek(void);
-//void cmdTrunc(void);
+void cmdTrunc(void);
 
 void cmdHln(void);
 void cmdSln(void);
@@ -129,7 +129,9 @@ struct
     {"del", helpDelete, cmdDelete},
     {"seek", helpSeek, cmdSeek},
     {"sk", helpSeek, cmdSeek},
-    //	{ "truncate", helpTrunc, cmdTrunc }, { "trunc", helpTrunc, cmdTrunc }, { "tk", helpTrunc, cmdTrunc },
+    {"truncate", helpTrunc, cmdTrunc},
+    {"trunc", helpTrunc, cmdTrunc},
+    {"tk", helpTrunc, cmdTrunc},
 
     {"hln", helpHln, cmdHln},
     {"sln", helpSln, cmdSln},
@@ -256,46 +258,52 @@ void tst_list_dir(char *src)
     printf("Ok!\n\n");
 }
 
-// void tst_seek(char *src, int seek_pos) {
-// 	char buffer[256];
-//     FILE2 hSrc;
-// 	int err;
-//
-// 	printf ("Teste do seek2()\n");
-//
-//     hSrc = open2 (src);
-//     if (hSrc<0) {
-//         printf ("Erro: Open %s (handle=%d)\n", src, hSrc);
-//         return;
-//     }
-//
-//     err = seek2(hSrc, seek_pos);
-//     if (err<0) {
-//         printf ("Error: Seek %s (handle=%d), err=%d\n", src, hSrc, err);
-// 		close2(hSrc);
-//         return;
-//     }
-//
-//     err = read2(hSrc, buffer, 256);
-//     if (err<0) {
-//         printf ("Error: Read %s (handle=%d), err=%d\n", src, hSrc, err);
-// 		close2(hSrc);
-//         return;
-//     }
-//     if (err==0) {
-//         printf ("Error: Arquivo vazio %s (handle=%d)\n", src, hSrc);
-// 		close2(hSrc);
-//         return;
-//     }
-//
-//     dump(buffer, err);
-//
-// 	if (close2(hSrc)) {
-//         printf ("Erro: Close (handle=%d)\n", hSrc);
-//         return;
-// 	}
-// 	printf ("Ok!\n\n");
-// }
+void tst_seek(char *src, int seek_pos)
+{
+    char buffer[256];
+    FILE2 hSrc;
+    int err;
+
+    printf("Teste do seek2()\n");
+
+    hSrc = open2(src);
+    if (hSrc < 0)
+    {
+        printf("Erro: Open %s (handle=%d)\n", src, hSrc);
+        return;
+    }
+
+    err = seek2(hSrc, seek_pos);
+    if (err < 0)
+    {
+        printf("Error: Seek %s (handle=%d), err=%d\n", src, hSrc, err);
+        close2(hSrc);
+        return;
+    }
+
+    err = read2(hSrc, buffer, 256);
+    if (err < 0)
+    {
+        printf("Error: Read %s (handle=%d), err=%d\n", src, hSrc, err);
+        close2(hSrc);
+        return;
+    }
+    if (err == 0)
+    {
+        printf("Error: Arquivo vazio %s (handle=%d)\n", src, hSrc);
+        close2(hSrc);
+        return;
+    }
+
+    dump(buffer, err);
+
+    if (close2(hSrc))
+    {
+        printf("Erro: Close (handle=%d)\n", hSrc);
+        return;
+    }
+    printf("Ok!\n\n");
+}
 
 void tst_create(char *src)
 {
@@ -352,41 +360,46 @@ void tst_write(char *src, char *texto)
     printf("Ok!\n\n");
 }
 
-// void tst_truncate(char *src, int size) {
-//     FILE2 handle;
-// 	int err;
-//
-// 	printf ("Teste do truncate2()\n");
-//
-//     handle = open2(src);
-//     if (handle<0) {
-//         printf ("Erro: Open %s, handle=%d\n", src, handle);
-//         return;
-//     }
-//
-//     // posiciona CP na posicao selecionada
-//     err = seek2(handle, size);
-//     if (err<0) {
-//         printf ("Error: Seek %s, handle=%d, pos=%d, err=%d\n", src, handle, size, err);
-// 		close2(handle);
-//         return;
-//     }
-//
-//     // trunca
-//     err = truncate2(handle);
-//     if (err<0) {
-//         printf ("Error: Truncate %s, handle=%d, pos=%d, err=%d\n", src, handle, size, err);
-// 		close2(handle);
-//         return;
-//     }
-//
-// 	if (close2(handle)) {
-//         printf ("Erro: Close (handle=%d)\n", handle);
-//         return;
-// 	}
-//
-// 	printf ("Ok!\n\n");
-// }
+void tst_truncate(char *src, int size)
+{
+    FILE2 handle;
+    int err;
+
+    printf("Teste do truncate2()\n");
+
+    handle = open2(src);
+    if (handle < 0)
+    {
+        printf("Erro: Open %s, handle=%d\n", src, handle);
+        return;
+    }
+
+    // posiciona CP na posicao selecionada
+    err = seek2(handle, size);
+    if (err < 0)
+    {
+        printf("Error: Seek %s, handle=%d, pos=%d, err=%d\n", src, handle, size, err);
+        close2(handle);
+        return;
+    }
+
+    // trunca
+    err = truncate2(handle);
+    if (err < 0)
+    {
+        printf("Error: Truncate %s, handle=%d, pos=%d, err=%d\n", src, handle, size, err);
+        close2(handle);
+        return;
+    }
+
+    if (close2(handle))
+    {
+        printf("Erro: Close (handle=%d)\n", handle);
+        return;
+    }
+
+    printf("Ok!\n\n");
+}
 
 void tst_delete(char *src)
 {
@@ -436,7 +449,7 @@ void teste(int tstNumber)
         tst_list_dir(".");
         break;
     case 5:
-        //tst_seek("x.txt", 7);
+        tst_seek("x.txt", 7);
         break;
 
     case 6:
@@ -448,7 +461,7 @@ void teste(int tstNumber)
         tst_read("y.txt"); // Verificação
         break;
     case 8:
-        //tst_truncate("y.txt", 11);
+        tst_truncate("y.txt", 11);
         tst_read("y.txt"); // Verificação
         break;
     case 9:
@@ -1098,50 +1111,94 @@ void cmdLs(void)
 /**
 Chama a função truncate2() da biblioteca e coloca o string de retorno na tela
 */
-// void cmdTrunc(void) {
-//     FILE2 handle;
-//     int size;
-//
-//     // get first parameter => file handle
-//     char *token = strtok(NULL," \t");
-//     if (token==NULL) {
-//         printf ("Missing parameter\n");
-//         return;
-//     }
-//     if (sscanf(token, "%d", &handle)==0) {
-//         printf ("Invalid parameter\n");
-//         return;
-//     }
-//
-//     // get second parameter => number of bytes
-//     token = strtok(NULL," \t");
-//     if (token==NULL) {
-//         printf ("Missing parameter\n");
-//         return;
-//     }
-//     if (sscanf(token, "%d", &size)==0) {
-//         printf ("Invalid parameter\n");
-//         return;
-//     }
-//
-//     // posiciona CP na posicao selecionada
-//     int err = seek2(handle, size);
-//     if (err<0) {
-//         printf ("Error seek2: %d\n", err);
-//         return;
-//     }
-//
-//     // trunca
-//     err = truncate2(handle);
-//     if (err<0) {
-//         printf ("Error truncate2: %d\n", err);
-//         return;
-//     }
-//
-//     // show bytes read
-//     printf ("file-handle %d truncated to %d bytes\n", handle, size );
-// }
+void cmdTrunc(void)
+{
+    FILE2 handle;
+    int size;
+
+    // get first parameter => file handle
+    char *token = strtok(NULL, " \t");
+    if (token == NULL)
+    {
+        printf("Missing parameter\n");
+        return;
+    }
+    if (sscanf(token, "%d", &handle) == 0)
+    {
+        printf("Invalid parameter\n");
+        return;
+    }
+
+    // get second parameter => number of bytes
+    token = strtok(NULL, " \t");
+    if (token == NULL)
+    {
+        printf("Missing parameter\n");
+        return;
+    }
+    if (sscanf(token, "%d", &size) == 0)
+    {
+        printf("Invalid parameter\n");
+        return;
+    }
+
+    // posiciona CP na posicao selecionada
+    int err = seek2(handle, size);
+    if (err < 0)
+    {
+        printf("Error seek2: %d\n", err);
+        return;
+    }
+
+    // trunca
+    err = truncate2(handle);
+    if (err < 0)
+    {
+        printf("Error truncate2: %d\n", err);
+        return;
+    }
+
+    // show bytes read
+    printf("file-handle %d truncated to %d bytes\n", handle, size);
+}
 
 void cmdSeek(void)
 {
+    FILE2 handle;
+    int position;
+
+    // get first parameter => file handle
+    char *token = strtok(NULL, " \t");
+    if (token == NULL)
+    {
+        printf("Missing parameter\n");
+        return;
+    }
+    if (sscanf(token, "%d", &handle) == 0)
+    {
+        printf("Invalid parameter\n");
+        return;
+    }
+
+    // get second parameter => new position (-1 for the end of the file)
+    token = strtok(NULL, " \t");
+    if (token == NULL)
+    {
+        printf("Missing parameter\n");
+        return;
+    }
+    if (sscanf(token, "%d", &position) == 0)
+    {
+        printf("Invalid parameter\n");
+        return;
+    }
+
+    int err = seek2(handle, (DWORD)position);
+    if (err < 0)
+    {
+        printf("Error seek2: %d\n", err);
+        return;
+    }
+
+    printf("file-handle %d positioned at %d\n", handle, position);
 }
@@ -14,8 +14,51 @@
 #ifndef __apidisk_h__
 #define __apidisk_h__
 
+#include <sys/uio.h>
+
 #define SECTOR_SIZE 256
 
+#define DISK_MODE_FILE 0 // Setores lidos e escritos com pread/pwrite
+#define DISK_MODE_MMAP 1 // Setores copiados de/para um mapeamento (mmap) do disco
+#define DISK_MODE_URING 2 // Lotes de requisições submetidos de uma vez com io_uring
+#define DISK_MODE_RAM 3 // Disco mantido inteiramente na memória, nunca escrito no arquivo
+
+#define DISK_DEFAULT_QUEUE_DEPTH 64
+
+// Requisição de "count" setores consecutivos, a partir de "first", usada nas operações em lote
+typedef struct
+{
+    unsigned int first;
+    unsigned int count;
+    unsigned char *buffer;
+} SECTOR_REQUEST;
+
+/*
+    Dispositivo que armazena os setores do disco virtual
+    Todos os setores são endereçados a partir de ZERO e as requisições já
+    chegam validadas (dentro do disco e com setores inteiros).
+    "map" e "batch" são opcionais (NULL quando o dispositivo não os suporta).
+*/
+typedef struct
+{
+    char *name;
+    int (*open)(void);
+    int (*close)(void);
+    int (*read)(unsigned int first, const struct iovec *iov, int iovcnt);
+    int (*write)(unsigned int first, const struct iovec *iov, int iovcnt);
+    int (*flush)(void);
+    unsigned int (*size)(void);
+    int (*discard)(unsigned int first, unsigned int count);
+    unsigned char *(*map)(unsigned int sector);
+    int (*batch)(int write, const SECTOR_REQUEST *requests, int quantity);
+} DISK_DEVICE;
+
+// Dispositivos fornecidos pela biblioteca
+extern DISK_DEVICE fileDisk;  // pread/pwrite no arquivo de imagem
+extern DISK_DEVICE mmapDisk;  // mapeamento (mmap) do arquivo de imagem
+extern DISK_DEVICE uringDisk; // pread/pwrite, com lotes submetidos via io_uring
+extern DISK_DEVICE ramDisk;   // memória (ver "set_ram_disk_size")
+
 /*------------------------------------------------------------------------
 Função:	Realiza leitura de um setor lógico do disco
 
@@ -38,4 +81,197 @@ Retorna:"0", se a leitura foi realizada corretamente
 ------------------------------------------------------------------------*/
 int write_sector(unsigned int sector, unsigned char *buffer);
 
+/*------------------------------------------------------------------------
+Função:	Realiza a leitura de "count" setores lógicos consecutivos do disco
+	em uma única operação
+
+Entra:	first -> primeiro setor lógico a ser lido, iniciando em ZERO
+	count -> número de setores a serem lidos
+	buffer -> área de memória com pelo menos count * SECTOR_SIZE bytes
+
+Retorna:"0", se a leitura foi realizada corretamente
+	Valor diferente de zero, caso tenha ocorrido algum erro.
+------------------------------------------------------------------------*/
+int read_sectors(unsigned int first, unsigned int count, unsigned char *buffer);
+
+/*------------------------------------------------------------------------
+Função:	Realiza a escrita de "count" setores lógicos consecutivos do disco
+	em uma única operação
+
+Entra:	first -> primeiro setor lógico a ser escrito, iniciando em ZERO
+	count -> número de setores a serem escritos
+	buffer -> área de memória com os count * SECTOR_SIZE bytes a escrever
+
+Retorna:"0", se a escrita foi realizada corretamente
+	Valor diferente de zero, caso tenha ocorrido algum erro.
+------------------------------------------------------------------------*/
+int write_sectors(unsigned int first, unsigned int count, unsigned char *buffer);
+
+/*------------------------------------------------------------------------
+Função:	Lê setores consecutivos do disco, a partir de "first", espalhando-os
+	pelas áreas de memória do vetor "iov" (como preadv)
+	O tamanho de cada entrada do vetor deve ser múltiplo de SECTOR_SIZE.
+
+Entra:	first -> primeiro setor lógico a ser lido, iniciando em ZERO
+	iov -> vetor de áreas de memória a serem preenchidas, em ordem
+	iovcnt -> número de entradas em "iov"
+
+Retorna:"0", se a leitura foi realizada corretamente
+	Valor diferente de zero, caso tenha ocorrido algum erro.
+------------------------------------------------------------------------*/
+int readv_sectors(unsigned int first, const struct iovec *iov, int iovcnt);
+
+/*------------------------------------------------------------------------
+Função:	Escreve em setores consecutivos do disco, a partir de "first", os dados
+	das áreas de memória do vetor "iov" (como pwritev)
+	O tamanho de cada entrada do vetor deve ser múltiplo de SECTOR_SIZE.
+
+Entra:	first -> primeiro setor lógico a ser escrito, iniciando em ZERO
+	iov -> vetor de áreas de memória com os dados, em ordem
+	iovcnt -> número de entradas em "iov"
+
+Retorna:"0", se a escrita foi realizada corretamente
+	Valor diferente de zero, caso tenha ocorrido algum erro.
+------------------------------------------------------------------------*/
+int writev_sectors(unsigned int first, const struct iovec *iov, int iovcnt);
+
+/*------------------------------------------------------------------------
+Função:	Realiza um lote de leituras, retornando apenas quando todas terminarem
+	No modo DISK_MODE_URING, todas as requisições são submetidas de uma vez;
+	nos dispositivos sem suporte a lotes (ou se o io_uring não estiver
+	disponível), são executadas uma após a outra.
+
+Entra:	requests -> vetor de requisições, cada uma com seu próprio buffer
+	quantity -> número de requisições
+
+Retorna:"0", se todas as leituras foram realizadas corretamente
+	Valor diferente de zero, caso tenha ocorrido algum erro.
+------------------------------------------------------------------------*/
+int read_sectors_batch(const SECTOR_REQUEST *requests, int quantity);
+
+/*------------------------------------------------------------------------
+Função:	Realiza um lote de escritas, retornando apenas quando todas terminarem
+	(ver "read_sectors_batch")
+
+Entra:	requests -> vetor de requisições, cada uma com seu próprio buffer
+	quantity -> número de requisições
+
+Retorna:"0", se todas as escritas foram realizadas corretamente
+	Valor diferente de zero, caso tenha ocorrido algum erro.
+------------------------------------------------------------------------*/
+int write_sectors_batch(const SECTOR_REQUEST *requests, int quantity);
+
+/*------------------------------------------------------------------------
+Função:	Define a profundidade da fila do io_uring (DISK_MODE_URING), ou seja,
+	quantas requisições podem estar em andamento ao mesmo tempo
+	Tem efeito na próxima abertura do disco.
+
+Entra:	depth -> profundidade da fila (padrão: DISK_DEFAULT_QUEUE_DEPTH)
+
+Retorna:"0", se a profundidade foi alterada corretamente
+	Valor diferente de zero, caso tenha ocorrido algum erro.
+------------------------------------------------------------------------*/
+int set_disk_queue_depth(unsigned int depth);
+
+/*------------------------------------------------------------------------
+Função:	Abre o disco virtual, mantendo o descritor aberto até "close_disk"
+	As funções de leitura e escrita abrem o disco automaticamente, caso
+	ainda não tenha sido aberto.
+
+Retorna:"0", se o disco foi aberto corretamente
+	Valor diferente de zero, caso tenha ocorrido algum erro.
+------------------------------------------------------------------------*/
+int open_disk(void);
+
+/*------------------------------------------------------------------------
+Função:	Fecha o disco virtual aberto por "open_disk"
+
+Retorna:"0", se o disco foi fechado corretamente
+	Valor diferente de zero, caso tenha ocorrido algum erro.
+------------------------------------------------------------------------*/
+int close_disk(void);
+
+/*------------------------------------------------------------------------
+Função:	Seleciona como o disco virtual é acessado
+	Se o disco já estiver aberto, ele é fechado e reaberto com o novo modo.
+
+Entra:	mode -> DISK_MODE_FILE, DISK_MODE_MMAP, DISK_MODE_URING ou DISK_MODE_RAM
+
+Retorna:"0", se o modo foi selecionado corretamente
+	Valor diferente de zero, caso tenha ocorrido algum erro.
+------------------------------------------------------------------------*/
+int set_disk_mode(int mode);
+
+/*------------------------------------------------------------------------
+Função:	Seleciona o dispositivo que armazena o disco virtual, permitindo usar
+	um dispositivo definido fora da biblioteca
+	Se o disco já estiver aberto, ele é fechado e reaberto com o novo dispositivo.
+
+Entra:	device -> dispositivo a ser usado (ex.: &fileDisk, &ramDisk)
+
+Retorna:"0", se o dispositivo foi selecionado corretamente
+	Valor diferente de zero, caso tenha ocorrido algum erro.
+------------------------------------------------------------------------*/
+int set_disk_device(DISK_DEVICE *device);
+
+/*------------------------------------------------------------------------
+Função:	Informa o dispositivo em uso
+
+Retorna:Ponteiro para o dispositivo selecionado
+------------------------------------------------------------------------*/
+DISK_DEVICE *get_disk_device(void);
+
+/*------------------------------------------------------------------------
+Função:	Define o tamanho do disco em memória (DISK_MODE_RAM)
+	Com "sectors" maior que zero, o disco é criado vazio, com uma única
+	partição ocupando todos os setores após o MBR; com ZERO, o disco é
+	uma cópia do arquivo de imagem. Tem efeito na próxima abertura do disco.
+
+Entra:	sectors -> número de setores do disco
+
+Retorna:"0", se o tamanho foi alterado corretamente
+	Valor diferente de zero, caso tenha ocorrido algum erro.
+------------------------------------------------------------------------*/
+int set_ram_disk_size(unsigned int sectors);
+
+/*------------------------------------------------------------------------
+Função:	Informa o número de setores do disco virtual
+
+Retorna:Número de setores do disco
+	ZERO, caso o disco não possa ser aberto
+------------------------------------------------------------------------*/
+unsigned int disk_size(void);
+
+/*------------------------------------------------------------------------
+Função:	Avisa o dispositivo que "count" setores, a partir de "first", não
+	guardam mais dados. Após o descarte, os setores são lidos como ZERO.
+
+Entra:	first -> primeiro setor lógico a ser descartado, iniciando em ZERO
+	count -> número de setores a serem descartados
+
+Retorna:"0", se os setores foram descartados corretamente
+	Valor diferente de zero, caso tenha ocorrido algum erro.
+------------------------------------------------------------------------*/
+int discard_sectors(unsigned int first, unsigned int count);
+
+/*------------------------------------------------------------------------
+Função:	Garante que todas as escritas feitas no disco virtual chegaram ao
+	arquivo de imagem (msync no modo DISK_MODE_MMAP)
+
+Retorna:"0", se a sincronização foi realizada corretamente
+	Valor diferente de zero, caso tenha ocorrido algum erro.
+------------------------------------------------------------------------*/
+int sync_disk(void);
+
+/*------------------------------------------------------------------------
+Função:	Retorna um ponteiro direto para o setor dentro do mapeamento do disco,
+	permitindo ler os dados sem copiá-los
+
+Entra:	sector -> setor lógico desejado, iniciando em ZERO
+
+Retorna:Ponteiro para os SECTOR_SIZE bytes do setor
+	NULL, se o dispositivo não for mapeado em memória ou o setor não existir
+------------------------------------------------------------------------*/
+unsigned char *map_sector(unsigned int sector);
+
 #endif
@@ -22,6 +22,16 @@ Retorna: ==0, se sucesso
 ------------------------------------------------------------------------*/
 int closeBitmap2(void);
 
+/*------------------------------------------------------------------------
+Função:	Fecha os bitmaps e libera a memória que eles ocupam.
+		Os bitmaps ficam em memória desde openBitmap2 até essa chamada,
+		mesmo depois de closeBitmap2.
+Entra:	-
+Retorna: ==0, se sucesso
+		 !=0, se erro
+------------------------------------------------------------------------*/
+int releaseBitmap2(void);
+
 /*------------------------------------------------------------------------
 	Recupera o bit indicado do bitmap solicitado
 Entra:
@@ -51,6 +61,24 @@ Retorna
 ------------------------------------------------------------------------*/
 int setBitmap2(int handle, int bitNumber, int bitValue);
 
+/*------------------------------------------------------------------------
+	Seta count bits seguidos do bitmap solicitado, a partir de firstBit,
+	alterando palavras inteiras do bitmap de uma só vez
+Entra:
+	handle -> bitmap
+		==0 -> i-node
+		!=0 -> blocos de dados
+	firstBit -> primeiro bit a ser escrito
+	count -> quantidade de bits
+	bitValue -> valor a ser escrito nos bits
+		==0 -> coloca os bits em 0
+		!=0 -> coloca os bits em 1
+Retorna
+	Sucesso: ZERO (0)
+	Erro: número negativo
+------------------------------------------------------------------------*/
+int setRangeBitmap2(int handle, int firstBit, int count, int bitValue);
+
 /*------------------------------------------------------------------------
 	Procura no bitmap solicitado pelo valor indicado
 Entra:
@@ -61,9 +89,28 @@ Entra:
 Retorna
 	Sucesso
 		Achou o bit: �ndice associado ao bit (n�mero positivo)
-		N�o achou: ZERO
-	Erro: n�mero negativo
+		Não achou: -1
+	Erro: -1
+	A busca começa onde a busca anterior parou (next fit).
 ------------------------------------------------------------------------*/
 int searchBitmap2(int handle, int bitValue);
 
+/*------------------------------------------------------------------------
+	Procura no bitmap de blocos de dados uma sequência de bits livres (em ZERO),
+	com no máximo count bits, usando o índice de espaço livre (t2space.h):
+	a partir de goal, se estiver livre; senão, para poucos bits, a primeira
+	sequência depois de goal onde caibam; para muitos, a menor sequência onde
+	caibam (best fit); não havendo nenhuma, a maior sequência livre.
+Entra:
+	handle -> bitmap (só o de blocos de dados, !=0)
+	goal -> bit onde a sequência deveria começar
+	count -> tamanho desejado da sequência
+	length -> recebe o tamanho da sequência encontrada
+Retorna
+	Sucesso: índice do primeiro bit da sequência
+	Não achou, ou erro: -1
+	Os bits não são alterados.
+------------------------------------------------------------------------*/
+int searchRunBitmap2(int handle, int goal, int count, int *length);
+
 #endif
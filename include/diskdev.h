@@ -0,0 +1,20 @@
+/*
+    Helpers shared by the disk devices (diskfile.c, diskmmap.c, diskram.c).
+    Programs using the library only need `apidisk.h`.
+*/
+
+#ifndef __diskdev_h__
+#define __diskdev_h__
+
+#include "apidisk.h"
+
+// Name of the virtual disk image, relative to the current working directory
+#define DISK_NAME "t2fs_disk.dat"
+
+// Queue depth selected with `set_disk_queue_depth`
+unsigned int disk_queue_depth(void);
+
+// Number of sectors the RAM disk should be created with (0 means a copy of DISK_NAME)
+unsigned int ram_disk_size(void);
+
+#endif
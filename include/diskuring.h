@@ -0,0 +1,30 @@
+/*
+    io_uring backend used by `apidisk.c` to submit batches of sector requests.
+
+    It talks to the kernel through the raw syscalls, so no external library is needed.
+    When the kernel (or a sandbox) doesn't allow io_uring, `uring_open` fails and
+    the disk falls back to pread/pwrite.
+*/
+
+#ifndef __diskuring_h__
+#define __diskuring_h__
+
+#include "apidisk.h"
+
+// Creates a ring with `depth` entries for the file descriptor `fd`
+int uring_open(int fd, unsigned int depth);
+
+// Destroys the ring, if there is one
+void uring_close(void);
+
+// Returns whether there is a ring ready to be used
+int uring_available(void);
+
+// Submits every request in `requests` (reads if `write` is zero, writes otherwise)
+// and waits until all of them complete. Requests are sent in chunks of at most the
+// ring depth, each chunk with a single `io_uring_enter`. If the kernel doesn't
+// support the read and write operations, they are done with pread/pwrite instead.
+// On failure no request is left in flight.
+int uring_transfer(int write, const SECTOR_REQUEST *requests, int quantity);
+
+#endif
@@ -0,0 +1,37 @@
+/*
+    Asynchronous file I/O, behind `submit2`, `reap2` and `aiofd2`.
+
+    Submitted requests wait in a queue for a small pool of worker threads, which
+    run them as `pread2` and `pwrite2` calls. Those still take the library lock, so
+    the requests are served one at a time, but the thread that submitted them is free
+    to go on with its own work meanwhile. Finished requests wait in a second queue
+    until they are reaped, and an eventfd is kept readable while there are any.
+*/
+
+#ifndef __t2aio_h__
+#define __t2aio_h__
+
+#include "t2fs.h"
+
+#define AIO_WORKERS 4
+
+// Queues the `count` requests of `requests`, stopping at the first invalid one.
+// Returns how many were queued, or -1 if the first one couldn't be.
+int aioSubmit(AIOREQ2 *requests, int count);
+
+// Saves in `events` between `min` and `max` finished requests, in the order they
+// finished, waiting for them if needed. Never waits for more requests than were
+// submitted and not reaped yet. Returns how many were saved.
+int aioReap(AIOEVENT2 *events, int min, int max);
+
+// Returns the eventfd which is readable while there are finished requests to reap
+int aioGetEventFd();
+
+// Refuses new requests, then waits until every submitted request has finished
+// (they may not be reaped yet)
+void aioClose();
+
+// Accepts new requests, once a partition is mounted
+void aioOpen();
+
+#endif
@@ -0,0 +1,77 @@
+/*
+    Sector buffer cache used by `t2fslib.c` (and `t2fs.c`) to reach the disk.
+
+    It holds a fixed number of sectors of the mounted partition, indexed by a hash
+    on (partition, sector) and evicted in LRU order. It is created when a partition
+    is mounted and destroyed when it is unmounted; while there is no cache every
+    function goes straight to the device.
+*/
+
+#ifndef __t2cache_h__
+#define __t2cache_h__
+
+#include "t2fs.h"
+#include "apidisk.h"
+
+#define CACHE_DEFAULT_SECTORS 1024
+#define CACHE_DEFAULT_DIRTY_RATIO 50
+
+// Creates the cache of partition `partition` with room for `sectors` sectors
+int cacheOpen(int partition, DWORD sectors);
+
+// Destroys the cache, if there is one, writing back its dirty sectors first
+void cacheClose();
+
+// Writes every dirty sector back to the disk, in sector order, in a single batch
+int cacheFlush();
+
+// Selects CACHE_WRITE_THROUGH or CACHE_WRITE_BACK, flushing the cache once more
+// than `dirtyRatio` percent of it is dirty. Kept between mounts.
+int cacheSetMode(int mode, DWORD dirtyRatio);
+
+// Returns CACHE_WRITE_THROUGH or CACHE_WRITE_BACK
+int cacheGetMode();
+
+// Drops every sector cached for partition `partition`, so the next access reads it again
+void cacheInvalidate(int partition);
+
+// Returns a pointer to the cached copy of the sector `sector`, reading it on a miss.
+// The pointer is only valid until the next cache call. Returns NULL on failure
+// or if there is no cache.
+BYTE *cacheGetSector(DWORD sector);
+
+// Returns a pointer to the cached copy of the sector `sector`, like cacheGetSector,
+// but returns NULL on a miss instead of reading it
+BYTE *cachePeekSector(DWORD sector);
+
+// Reads the sector `sector` to `buffer`, through the cache
+int cacheReadSector(DWORD sector, BYTE *buffer);
+
+// Writes the sector `sector` from `buffer`, keeping the cached copy up to date
+int cacheWriteSector(DWORD sector, BYTE *buffer);
+
+// Reads `count` consecutive sectors through the cache, reading every run of
+// missing sectors with a single device call
+int cacheReadSectors(DWORD first, DWORD count, BYTE *buffer);
+
+// Writes `count` consecutive sectors, caching them. In write-back mode they are
+// only marked dirty, otherwise they are written with a single device call
+int cacheWriteSectors(DWORD first, DWORD count, BYTE *buffer);
+
+// Reads a batch of (usually big) requests without filling the cache. Sectors it
+// already holds are copied from it, the others are read from the device.
+int cacheReadBatch(const SECTOR_REQUEST *requests, int quantity);
+
+// Reads the sectors from `first` to `first + count - 1` the cache doesn't hold yet
+// into it, so that later reads hit. At most a quarter of the cache is used.
+int cachePrefetch(DWORD first, DWORD count);
+
+// Writes a batch of requests straight to the device, without filling the cache.
+// Sectors the cache already holds are refreshed (write-through) or just
+// dirtied in it (write-back)
+int cacheWriteBatch(const SECTOR_REQUEST *requests, int quantity);
+
+// Fills `stats` with the cache counters
+void cacheGetStats(CACHESTATS2 *stats);
+
+#endif
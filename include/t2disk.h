@@ -29,6 +29,7 @@ struct t2fs_superbloco
 	WORD blockSize;			   /** Número de setores que formam um bloco */
 	DWORD diskSize;			   /** Número total de blocos da partição */
 	DWORD Checksum;			   /** Soma dos 5 primeiros inteiros de 32 bits do superbloco */
+	DWORD firstOrphan;		   /** I-node do primeiro arquivo apagado com blocos ainda não liberados (0 = nenhum) */
 };
 
 /** Registro de diretório (entrada de diretório) - 19/2 */
@@ -44,6 +44,55 @@ typedef struct
 
 #pragma pack(pop)
 
+/** Contadores do cache de setores, lidos com cachestats2 */
+typedef struct
+{
+	DWORD capacity;	 /* Número de setores que o cache comporta               */
+	DWORD used;		 /* Número de setores atualmente no cache                */
+	DWORD hits;		 /* Acessos atendidos pelo cache                         */
+	DWORD misses;	 /* Acessos que precisaram ler o disco                   */
+	DWORD evictions; /* Setores descartados para dar lugar a outros (LRU)    */
+	DWORD dirty;	 /* Setores alterados que ainda não foram gravados       */
+	DWORD writebacks; /* Setores alterados gravados no disco pelo cache       */
+} CACHESTATS2;
+
+/** Um dos buffers de um vetor lido com readv2 ou escrito com writev2 */
+typedef struct
+{
+	char *base; /* Início do buffer                                     */
+	int size;	/* Número de bytes do buffer                            */
+} IOVEC2;
+
+/** Pedido de leitura ou escrita assíncrona, enviado com submit2 */
+typedef struct
+{
+	int opcode;	  /* AIO_READ ou AIO_WRITE                                */
+	FILE2 handle; /* Arquivo a ser lido ou escrito                        */
+	DWORD offset; /* Posição do primeiro byte, como em pread2 e pwrite2   */
+	char *buffer; /* Buffer de onde ler ou onde escrever os bytes         */
+	int size;	  /* Número de bytes a serem lidos ou escritos            */
+	void *data;	  /* Devolvido como está pelo reap2, para o chamador      */
+} AIOREQ2;
+
+/** Resultado de um pedido assíncrono terminado, recebido com reap2 */
+typedef struct
+{
+	void *data; /* O campo "data" do pedido                             */
+	int result; /* O que pread2 ou pwrite2 teriam retornado             */
+} AIOEVENT2;
+
+/** Operações dos pedidos assíncronos */
+#define AIO_READ 0	/* Lê como pread2                                        */
+#define AIO_WRITE 1 /* Escreve como pwrite2                                  */
+
+/** Modos de escrita do cache, escolhidos com cachemode2 */
+#define CACHE_WRITE_THROUGH 0 /* Toda escrita vai imediatamente para o disco          */
+#define CACHE_WRITE_BACK 1	  /* Escritas ficam no cache até umount, sync2 ou limite */
+
+/** Formatos de i-node dos arquivos criados, escolhidos com inodeformat2 */
+#define INODE_FORMAT_INDIRECT 0 /* Um ponteiro por bloco (diretos e indireções)        */
+#define INODE_FORMAT_EXTENTS 1	/* Sequências de blocos contíguos (extents)            */
+
 /*-----------------------------------------------------------------------------
 Fun��o: Usada para identificar os desenvolvedores do T2FS.
 	Essa fun��o copia um string de identifica��o para o ponteiro indicado por "name".
@@ -91,6 +140,68 @@ Sa�da:	Se a opera��o foi realizada com sucesso, a fun��o retorna "0" (
 -----------------------------------------------------------------------------*/
 int umount(void);
 
+/*-----------------------------------------------------------------------------
+Função:	Garante que todas as alterações feitas na partição montada foram
+		gravadas no disco virtual.
+
+Entra:	-
+
+Saída:	Se a operação foi realizada com sucesso, a função retorna "0" (zero).
+		Em caso de erro, será retornado um valor diferente de zero.
+-----------------------------------------------------------------------------*/
+int sync2(void);
+
+/*-----------------------------------------------------------------------------
+Função:	Define quantos setores o cache da partição pode guardar.
+		O novo tamanho é usado a partir da próxima montagem (mount).
+
+Entra:	sectors -> número de setores do cache (padrão: 1024)
+
+Saída:	Se a operação foi realizada com sucesso, a função retorna "0" (zero).
+		Em caso de erro, será retornado um valor diferente de zero.
+-----------------------------------------------------------------------------*/
+int cachesize2(int sectors);
+
+/*-----------------------------------------------------------------------------
+Função:	Informa os contadores do cache da partição montada,
+		permitindo dimensioná-lo para o conjunto de dados em uso.
+
+Entra:	stats -> estrutura onde a função coloca os contadores.
+
+Saída:	Se a operação foi realizada com sucesso, a função retorna "0" (zero).
+		Em caso de erro, será retornado um valor diferente de zero.
+-----------------------------------------------------------------------------*/
+int cachestats2(CACHESTATS2 *stats);
+
+/*-----------------------------------------------------------------------------
+Função:	Define como as escritas passam pelo cache.
+		No modo CACHE_WRITE_BACK (padrão), os setores escritos são apenas
+		marcados como alterados e gravados, em ordem de setor, no umount,
+		no sync2 ou quando a porcentagem de setores alterados passa de "dirty_ratio".
+
+Entra:	mode -> CACHE_WRITE_THROUGH ou CACHE_WRITE_BACK
+		dirty_ratio -> porcentagem do cache que pode estar alterada (0 a 100)
+
+Saída:	Se a operação foi realizada com sucesso, a função retorna "0" (zero).
+		Em caso de erro, será retornado um valor diferente de zero.
+-----------------------------------------------------------------------------*/
+int cachemode2(int mode, int dirty_ratio);
+
+/*-----------------------------------------------------------------------------
+Função:	Define o formato do i-node dos arquivos criados a partir de então.
+		No formato INODE_FORMAT_INDIRECT (padrão), cada bloco do arquivo tem
+		seu próprio ponteiro. No formato INODE_FORMAT_EXTENTS, o i-node guarda
+		sequências de blocos contíguos (bloco lógico inicial, bloco físico
+		inicial e tamanho), e as que não couberem nele vão para blocos de extents.
+		Arquivos já existentes mantêm o seu formato.
+
+Entra:	format -> INODE_FORMAT_INDIRECT ou INODE_FORMAT_EXTENTS
+
+Saída:	Se a operação foi realizada com sucesso, a função retorna "0" (zero).
+		Em caso de erro, será retornado um valor diferente de zero.
+-----------------------------------------------------------------------------*/
+int inodeformat2(int format);
+
 /*-----------------------------------------------------------------------------
 Fun��o: Criar um novo arquivo.
 	O nome desse novo arquivo � aquele informado pelo par�metro "filename".
@@ -109,6 +220,9 @@ FILE2 create2(char *filename);
 /*-----------------------------------------------------------------------------
 Fun��o:	Apagar um arquivo do disco.
 	O nome do arquivo a ser apagado � aquele informado pelo par�metro "filename".
+	Os blocos do arquivo são liberados em segundo plano, aos poucos, depois
+	que a função retorna (ou após a próxima montagem, se a partição for
+	desmontada antes).
 
 Entra:	filename -> nome do arquivo a ser apagado.
 
@@ -172,6 +286,136 @@ Sa�da:	Se a opera��o foi realizada com sucesso, a fun��o retorna o n
 -----------------------------------------------------------------------------*/
 int write2(FILE2 handle, char *buffer, int size);
 
+/*-----------------------------------------------------------------------------
+Função:	Remove do arquivo identificado por "handle" todos os bytes a partir da posição
+	atual do contador de posição (current pointer), inclusive, até o final do arquivo.
+	Os blocos que deixam de ser usados são liberados, junto com os blocos de índice vazios.
+
+Entra:	handle -> identificador do arquivo a ser truncado
+
+Saída:	Se a operação foi realizada com sucesso, a função retorna "0" (zero).
+	Em caso de erro, será retornado um valor diferente de zero.
+-----------------------------------------------------------------------------*/
+int truncate2(FILE2 handle);
+
+/*-----------------------------------------------------------------------------
+Função:	Altera o contador de posição (current pointer) do arquivo identificado por "handle".
+	Apenas o contador é alterado, sem nenhum acesso ao disco.
+	A posição pode passar do final do arquivo. Uma escrita feita nela não ocupa
+	blocos com o intervalo entre o final e a posição (um buraco), que é lido como zeros.
+
+Entra:	handle -> identificador do arquivo
+	offset -> nova posição do contador, a partir do início do arquivo.
+		Se for igual a -1, o contador é posicionado no final do arquivo.
+
+Saída:	Se a operação foi realizada com sucesso, a função retorna "0" (zero).
+	Em caso de erro, será retornado um valor diferente de zero.
+-----------------------------------------------------------------------------*/
+int seek2(FILE2 handle, DWORD offset);
+
+/*-----------------------------------------------------------------------------
+Função:	Realiza a leitura de "size" bytes do arquivo identificado por "handle",
+	a partir do byte "offset" do arquivo.
+	O contador de posição (current pointer) não é usado nem alterado, então
+	várias threads podem ler ao mesmo tempo do mesmo handle.
+
+Entra:	handle -> identificador do arquivo a ser lido
+	buffer -> buffer onde colocar os bytes lidos do arquivo
+	size -> número de bytes a serem lidos
+	offset -> posição do primeiro byte a ser lido
+
+Saída:	Se a operação foi realizada com sucesso, a função retorna o número de bytes lidos.
+	Se o valor retornado for menor do que "size", então a leitura atingiu o final do arquivo.
+	Em caso de erro, será retornado um valor negativo.
+-----------------------------------------------------------------------------*/
+int pread2(FILE2 handle, char *buffer, int size, DWORD offset);
+
+/*-----------------------------------------------------------------------------
+Função:	Realiza a escrita de "size" bytes no arquivo identificado por "handle",
+	a partir do byte "offset" do arquivo, que pode passar do final dele (como em seek2).
+	O contador de posição (current pointer) não é usado nem alterado, então
+	várias threads podem escrever ao mesmo tempo no mesmo handle.
+
+Entra:	handle -> identificador do arquivo a ser escrito
+	buffer -> buffer de onde pegar os bytes a serem escritos no arquivo
+	size -> número de bytes a serem escritos
+	offset -> posição do primeiro byte a ser escrito
+
+Saída:	Se a operação foi realizada com sucesso, a função retorna o número de bytes efetivamente escritos.
+	Em caso de erro, será retornado um valor negativo.
+-----------------------------------------------------------------------------*/
+int pwrite2(FILE2 handle, char *buffer, int size, DWORD offset);
+
+/*-----------------------------------------------------------------------------
+Função:	Realiza a leitura, a partir do contador de posição (current pointer) do
+	arquivo identificado por "handle", dos bytes que cabem nos "count" buffers
+	de "vector", preenchendo um buffer por vez, na ordem do vetor.
+	É o mesmo que um único read2 com o total de bytes dos buffers.
+
+Entra:	handle -> identificador do arquivo a ser lido
+	vector -> buffers onde colocar os bytes lidos do arquivo
+	count -> número de buffers em "vector"
+
+Saída:	Se a operação foi realizada com sucesso, a função retorna o número de bytes lidos.
+	Se o valor retornado for menor do que o total dos buffers, então o contador de posição atingiu o final do arquivo.
+	Em caso de erro, será retornado um valor negativo.
+-----------------------------------------------------------------------------*/
+int readv2(FILE2 handle, IOVEC2 *vector, int count);
+
+/*-----------------------------------------------------------------------------
+Função:	Realiza a escrita dos bytes dos "count" buffers de "vector", um após o
+	outro, na ordem do vetor, a partir do contador de posição (current pointer)
+	do arquivo identificado por "handle".
+	É o mesmo que um único write2 com os buffers juntos.
+
+Entra:	handle -> identificador do arquivo a ser escrito
+	vector -> buffers de onde pegar os bytes a serem escritos no arquivo
+	count -> número de buffers em "vector"
+
+Saída:	Se a operação foi realizada com sucesso, a função retorna o número de bytes efetivamente escritos.
+	Em caso de erro, será retornado um valor negativo.
+-----------------------------------------------------------------------------*/
+int writev2(FILE2 handle, IOVEC2 *vector, int count);
+
+/*-----------------------------------------------------------------------------
+Função:	Envia "count" pedidos de leitura ou escrita para serem feitos em segundo
+	plano, sem esperar por eles. Cada pedido é feito como um pread2 ou um pwrite2,
+	e pedidos diferentes podem terminar em qualquer ordem. Os arquivos e os buffers
+	dos pedidos devem continuar válidos até que eles sejam recebidos com reap2.
+
+Entra:	requests -> pedidos a serem feitos
+	count -> número de pedidos em "requests"
+
+Saída:	Retorna o número de pedidos enviados, que para no primeiro pedido inválido.
+	Nenhum pedido é aceito sem uma partição montada, nem durante o umount.
+	Se nenhum pedido pôde ser enviado, será retornado um valor negativo.
+-----------------------------------------------------------------------------*/
+int submit2(AIOREQ2 *requests, int count);
+
+/*-----------------------------------------------------------------------------
+Função:	Recebe os resultados dos pedidos enviados com submit2 que já terminaram,
+	na ordem em que terminaram, esperando até que pelo menos "min" deles terminem.
+	Nunca espera por mais pedidos do que foram enviados e ainda não recebidos.
+
+Entra:	events -> onde colocar os resultados dos pedidos
+	min -> número mínimo de resultados a esperar
+	max -> número máximo de resultados a colocar em "events"
+
+Saída:	Retorna o número de resultados colocados em "events".
+	Em caso de erro, será retornado um valor negativo.
+-----------------------------------------------------------------------------*/
+int reap2(AIOEVENT2 *events, int min, int max);
+
+/*-----------------------------------------------------------------------------
+Função:	Informa um eventfd que fica legível (para poll, select ou epoll) enquanto
+	houver pedidos terminados esperando para serem recebidos com reap2.
+	Ele não deve ser lido nem fechado pelo chamador.
+
+Saída:	Retorna o descritor do eventfd.
+	Em caso de erro, será retornado um valor negativo.
+-----------------------------------------------------------------------------*/
+int aiofd2(void);
+
 /*-----------------------------------------------------------------------------
 Fun��o:	Abre o diret�rio raiz da parti��o ativa.
 		Se a opera��o foi realizada com sucesso,
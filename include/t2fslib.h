@@ -18,11 +18,39 @@
 #define INODE_SIZE 32
 #define INODE_PER_SECTOR 8
 #define MAX_OPEN_FILES 10
+#define INODE_HASH_SIZE 64
+#define INODE_CACHE_LIMIT 256
+#define DIRENT_INITIAL_BUCKETS 64
+#define BLOCK_UNMAPPED 0xFFFFFFFF
+#define HOLE_SECTOR 0 // Address of the blocks of a file never written (holes), as sector 0 holds the MBR
+#define READAHEAD_MAX_BLOCKS 64
+#define INODE_EXTENTS 0x31545845 // `reservado` of the inodes mapped by extents ("EXT1")
+#define RECLAIM_STEP_BLOCKS 1024  // Blocks of an orphan freed at a time, holding the library lock
+
+// Holds the library lock from here to the end of the enclosing block, so the library
+// calls don't run at the same time as each other or as the orphan reclaimer
+#define LOCK_LIBRARY() int library_lock_held __attribute__((cleanup(unlockLibrary), unused)) = lockLibrary()
 
 typedef struct t2fs_superbloco SUPERBLOCK;
 typedef struct t2fs_record RECORD;
 typedef struct t2fs_inode I_NODE;
 
+// Run of `length` blocks of a file, from its block `logical` on, stored in the
+// data blocks from `physical` on.
+// In an inode mapped by extents, `dataPtr[0]` and `dataPtr[1]` hold the physical
+// block and the length of the first extent (which starts at the logical block 0),
+// `doubleIndPtr` holds how many extents there are and `singleIndPtr` the first
+// extent block. Every extent block starts with a pointer to the next one,
+// followed by as many of the remaining extents as fit in it.
+// The blocks between two extents are holes. So are the blocks of the first extent
+// when its physical block is INVALID_PTR, which happens when the file starts with one.
+typedef struct
+{
+    DWORD logical;
+    DWORD physical;
+    DWORD length;
+} EXTENT;
+
 // Open file structure to have a record, its inode and the position where
 // its pointer is currently located
 typedef struct
@@ -31,6 +59,9 @@ typedef struct
     I_NODE *inode;
     DWORD file_position;
     FILE2 handle;
+    DWORD readahead_position; // Where the next read starts if the file is read sequentially
+    DWORD readahead_window;   // Blocks read ahead of the position, 0 while reading randomly
+    DWORD readahead_block;    // First block which wasn't read ahead yet
 } OPEN_FILE;
 
 /*
@@ -42,6 +73,12 @@ typedef struct
 // Initialize the needed structures
 void initialize();
 
+// Takes the library lock, which may be taken again by the same thread (use LOCK_LIBRARY)
+int lockLibrary();
+
+// Gives back the library lock (called by LOCK_LIBRARY at the end of the block)
+void unlockLibrary(int *lock);
+
 /*
 
     FUNCTIONS USED ON FORMAT2
@@ -90,6 +127,9 @@ int closeFile(FILE2 handle);
 // Count how many opened files there are
 int countOpenedFiles();
 
+// Checks if `handle` identifies an open file
+BOOL isFileOpen(FILE2 handle);
+
 // Return next handler
 FILE2 getHandler();
 
@@ -110,23 +150,75 @@ int getPointers(DWORD blockNumber, DWORD *pointers);
 //Clear the inode pointers, freeing the data bitmap
 void clearPointers(I_NODE *inode);
 
+// Frees the blocks of `inode` from its block `blocks` on, along with the index (or
+// extent) blocks left with nothing to point to, leaving it with `blocks` blocks
+int truncateBlocks(I_NODE *inode, DWORD blocks);
+
+// Adds `inode`, which no record points to anymore, to the orphan list of the superblock.
+// The orphan keeps the next one in `bytesFileSize`, and its blocks are freed in the
+// background, a few at a time, before its inode is freed too. On failure the inode
+// and the superblock are left as they were.
+int addOrphan(I_NODE *inode);
+
+// Frees every orphan right away, instead of waiting for the reclaimer
+int reclaimOrphans();
+
 //return the handle of the file, given his name
 int getHandleByFilename(char *filename);
 
 /*
 
-    FUNCTIONS USED ON READ2
+    FUNCTIONS USED ON READ2 AND READV2
 
 */
 int readFile(FILE2 handle, char *buffer, int size);
 
+// Reads `size` bytes of the file `handle` from the byte `*position` on, moving
+// `*position` past them. The read-ahead state of the file is left alone.
+int readFileAt(FILE2 handle, char *buffer, int size, DWORD *position);
+
+// Reads into the `count` buffers of `vector`, in order, from the position of the
+// file `handle`, each buffer straight from the file, until the end of the file
+int readFileVector(FILE2 handle, IOVEC2 *vector, int count);
+
+/*
+
+    FUNCTIONS USED ON TRUNCATE2
+
+*/
+// Cuts the file `handle` at its position, freeing the blocks past it
+int truncateFile(FILE2 handle);
+
+/*
+
+    FUNCTIONS USED ON SEEK2
+
+*/
+// Moves the position of the file `handle` to the byte `offset`, or to its end if
+// `offset` is -1. Nothing is read or written.
+int seekFile(FILE2 handle, DWORD offset);
+
 /*
 
-    FUNCTIONS USED ON WRITE2
+    FUNCTIONS USED ON WRITE2 AND WRITEV2
 
 */
 FILE2 writeFile(FILE2 handle, char *buffer, int size);
 
+// Writes `size` bytes to the file `handle` from the byte `*position` on, moving
+// `*position` past them. The blocks skipped by a write past the end of the file
+// are left as holes.
+int writeFileAt(FILE2 handle, char *buffer, int size, DWORD *position);
+
+// Writes the `count` buffers of `vector`, in order, at the position of the file
+// `handle`, each buffer straight to the file
+int writeFileVector(FILE2 handle, IOVEC2 *vector, int count);
+
+// Allocates the longest run of free data blocks, of at most `count` blocks, found
+// as close as possible after the block `goal`. Returns its first block, saving
+// how many blocks it has in `length`, or -1 if there are no free blocks.
+int allocateBlocks(DWORD count, DWORD goal, DWORD *length);
+
 /*
 
     FUNCTIONS USED ON OPENDIR2
@@ -201,6 +293,52 @@ PARTITION *getPartition();
 // Returns the size of the block in bytes
 int getBlocksize();
 
+// Sets how many sectors the cache of the next mounted partition holds
+void setCacheSize(DWORD sectors);
+
+// Sets the format (INODE_FORMAT_INDIRECT or INODE_FORMAT_EXTENTS) of the inodes of new files
+void setInodeFormat(int format);
+
+// Returns the format of the inodes of new files
+int getInodeFormat();
+
+// Checks if `inode` is mapped by extents instead of block pointers
+BOOL isExtentInode(I_NODE *inode);
+
+// Maps the logical block `logical` of the file identified by the extent mapped
+// `inode`, which must be a hole, to the data block `physical`, growing the extents
+// around it when they are contiguous. The extents are saved along with the inode.
+int mapExtentBlock(I_NODE *inode, DWORD logical, DWORD physical);
+
+// Returns a pointer to the content of the disk sector `sector`. When the disk is
+// memory mapped it points straight into the mapping, unless the cache holds the
+// sector; otherwise it points into the cache of the mounted partition, or the
+// sector is read into `buffer`, which is returned. Returns NULL on failure.
+// The pointer is only good until the next call that goes through the cache (or
+// that may, as releasing an inode does), so it must be used before any of them.
+BYTE *readSectorInPlace(DWORD sector, BYTE *buffer);
+
+// Reads the `index`-th pointer stored in the index block `block_number`
+int readPointer(DWORD block_number, DWORD index, DWORD *pointer);
+
+// Translates the sector `sector_number` from the block `block_number` of the file
+// identified by `inode` to its absolute sector number on disk, saving it in `address`.
+// The blocks never written (holes) are translated to HOLE_SECTOR.
+int getDataBlockSectorAddress(int block_number, int sector_number, I_NODE *inode, DWORD *address);
+
+// Forgets the remembered translations of the blocks of `inode` from `first_block` on.
+// Must be called whenever their pointers change.
+void forgetBlockMap(I_NODE *inode, DWORD first_block);
+
+// Reads `count` consecutive sectors, starting at `first_sector`, from the block
+// `block_number` of the file identified by `inode`, with a single device call.
+// The sectors of a hole are read as zeros.
+int readDataBlockSectors(int block_number, int first_sector, int count, I_NODE *inode, BYTE *buffer);
+
+// Writes `count` consecutive sectors, starting at `first_sector`, to the block
+// `block_number` of the file identified by `inode`, with a single device call
+int writeDataBlockSectors(int block_number, int first_sector, int count, I_NODE *inode, BYTE *write_buffer);
+
 // Reads the sector `sector_number` from the block `block_number` from a file
 // identified by the inode `inode`.
 // The sector information is copied to the `buffer` pointer.
@@ -217,15 +355,57 @@ BYTE *getBuffer(size_t size);
 // Returns a newly allocated buffer, with their content zeroed, with size `size` (similar to calloc)
 BYTE *getZeroedBuffer(size_t size);
 
-// Returns the inode of number `inodeNumber` in the inode blocks
+// Returns the in-core copy of the inode of number `inodeNumber`, reading it
+// from the inode blocks if no one is using it. Every caller gets the same copy,
+// and must give it back with `releaseInode` when done.
 I_NODE *getInode(DWORD inodeNumber);
 
+// Gives back an inode returned by `getInode`. Once no one is using it,
+// it is written back if it was changed.
+void releaseInode(I_NODE *inode);
+
+// Marks an in-core inode as changed, to be written back later
+void markInodeDirty(I_NODE *inode);
+
+// Writes an in-core inode to its inode sector right away
+int writeInode(I_NODE *inode);
+
+// Writes back every changed in-core inode
+int syncInodes();
+
+// Writes back and forgets every in-core inode (used when unmounting)
+void dropInodes();
+
+// Forgets every in-core inode without saving it (used when formatting the mounted partition)
+void discardInodes();
+
+// Returns how many `getInode` references are not given back yet, over every in-core inode
+int countInodeReferences();
+
 // Gets a record by its number, filling the `record` structure
 int getRecordByNumber(int number, RECORD *record);
 
 // Gets a record by its name, filling the `record` structure
 int getRecordByName(char *filename, RECORD *record);
 
+// Gets a valid record by its name, filling the `record` structure and returning
+// its position in the directory (-1 if there is none). Names are looked up in a
+// hash table, built by scanning the directory on the first call.
+int getRecordIndexByName(char *filename, RECORD *record);
+
+// Tells the name lookup table that `record` was written at position `index`
+void addDirectoryEntry(int index, RECORD *record);
+
+// Tells the name lookup table that the record named `filename` is no longer valid
+void removeDirectoryEntry(char *filename);
+
+// Forgets the name lookup table, so it is built again on the next lookup
+void dropDirectoryEntries();
+
+// Writes `record` after the last record of the directory, giving the directory a
+// new block when it needs one, and saves the directory inode
+int appendRecord(I_NODE *dirInode, RECORD *record);
+
 // Quantity of direct blocks that an INODE can hold
 DWORD getInodeDirectQuantity();
 
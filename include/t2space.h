@@ -0,0 +1,45 @@
+/*
+    Free-space index of the data blocks, used by `bitmap2.c` to place allocations.
+
+    Every run of free data blocks of the mounted partition is kept in two balanced
+    (AVL) trees: one ordered by the first block of the run, to find the runs around
+    a block, and one ordered by length, to find the smallest run big enough for an
+    allocation (best fit). It is built from the data bitmap when it is loaded and
+    kept up to date by `setBitmap2`, so the bitmap stays the only thing on disk.
+*/
+
+#ifndef __t2space_h__
+#define __t2space_h__
+
+#include "t2fs.h"
+
+// Forgets every free run
+void spaceClear();
+
+// Records the blocks from `first` to `first + count - 1` as free, merging them
+// with the free runs right before and after them
+int spaceInsert(DWORD first, DWORD count);
+
+// Records the blocks from `first` to `first + count - 1`, which must be free, as
+// used, shrinking or splitting the run holding them
+int spaceRemove(DWORD first, DWORD count);
+
+// Finds the free run holding the block `block`, saving it in `first` and `length`.
+// Returns -1 if the block isn't free.
+int spaceFindRun(DWORD block, DWORD *first, DWORD *length);
+
+// Finds the first free run with at least `count` blocks starting at or after the
+// block `block` (near goal). Returns -1 if there is none.
+int spaceNextFit(DWORD block, DWORD count, DWORD *first, DWORD *length);
+
+// Finds the smallest free run with at least `count` blocks, the lowest one among
+// runs of the same length (best fit). Returns -1 if there is none.
+int spaceBestFit(DWORD count, DWORD *first, DWORD *length);
+
+// Finds the biggest free run. Returns -1 if there are no free blocks.
+int spaceLargest(DWORD *first, DWORD *length);
+
+// Tells how many free runs, and free blocks, there are
+void spaceGetStats(DWORD *runs, DWORD *blocks);
+
+#endif
@@ -0,0 +1,250 @@
+#include <stdio.h>
+#include <string.h>
+#include <sys/uio.h>
+
+#include "apidisk.h"
+#include "diskdev.h"
+
+// Device serving the sectors, and whether it is currently opened
+static DISK_DEVICE *device = &fileDisk;
+static int deviceOpened = 0;
+
+// Ring size used by `uringDisk`
+static unsigned int queueDepth = DISK_DEFAULT_QUEUE_DEPTH;
+
+// Size of the RAM disk, 0 to load it from the disk image
+static unsigned int ramDiskSectors = 0;
+
+int set_disk_device(DISK_DEVICE *newDevice)
+{
+    if (newDevice == NULL)
+    {
+        printf("ERROR: Invalid disk device.\n");
+        return -1;
+    }
+
+    // Reopen the disk with the new device if it is already in use
+    if (deviceOpened && newDevice != device)
+    {
+        if (close_disk() != 0)
+            return -1;
+
+        device = newDevice;
+        return open_disk();
+    }
+
+    device = newDevice;
+    return 0;
+}
+
+DISK_DEVICE *get_disk_device(void)
+{
+    return device;
+}
+
+int set_disk_mode(int mode)
+{
+    switch (mode)
+    {
+    case DISK_MODE_FILE:
+        return set_disk_device(&fileDisk);
+    case DISK_MODE_MMAP:
+        return set_disk_device(&mmapDisk);
+    case DISK_MODE_URING:
+        return set_disk_device(&uringDisk);
+    case DISK_MODE_RAM:
+        return set_disk_device(&ramDisk);
+    }
+
+    printf("ERROR: Unknown disk mode %d.\n", mode);
+    return -1;
+}
+
+int set_disk_queue_depth(unsigned int depth)
+{
+    if (depth == 0)
+    {
+        printf("ERROR: Queue depth must be positive.\n");
+        return -1;
+    }
+
+    queueDepth = depth;
+    return 0;
+}
+
+unsigned int disk_queue_depth(void)
+{
+    return queueDepth;
+}
+
+int set_ram_disk_size(unsigned int sectors)
+{
+    ramDiskSectors = sectors;
+    return 0;
+}
+
+unsigned int ram_disk_size(void)
+{
+    return ramDiskSectors;
+}
+
+int open_disk(void)
+{
+    // Already opened, nothing to do
+    if (deviceOpened)
+        return 0;
+
+    if (device->open() != 0)
+        return -1;
+
+    deviceOpened = 1;
+    return 0;
+}
+
+int close_disk(void)
+{
+    if (!deviceOpened)
+        return 0;
+
+    if (device->close() != 0)
+        return -1;
+
+    deviceOpened = 0;
+    return 0;
+}
+
+int sync_disk(void)
+{
+    if (!deviceOpened)
+        return 0;
+
+    return device->flush();
+}
+
+unsigned int disk_size(void)
+{
+    if (!deviceOpened && open_disk() != 0)
+        return 0;
+
+    return device->size();
+}
+
+// Checks the sectors from `first` to `first + count` exist in the device
+static int checkBounds(unsigned int first, size_t count)
+{
+    if ((size_t)first + count > device->size())
+    {
+        printf("ERROR: Sectors %u to %zu are out of the disk.\n", first, (size_t)first + count - 1);
+        return -1;
+    }
+
+    return 0;
+}
+
+int discard_sectors(unsigned int first, unsigned int count)
+{
+    if (!deviceOpened && open_disk() != 0)
+        return -1;
+
+    if (checkBounds(first, count) != 0)
+        return -1;
+
+    return device->discard(first, count);
+}
+
+unsigned char *map_sector(unsigned int sector)
+{
+    if (!deviceOpened || device->map == NULL || sector >= device->size())
+        return NULL;
+
+    return device->map(sector);
+}
+
+static int transfer(int write, unsigned int first, const struct iovec *iov, int iovcnt)
+{
+    size_t count = 0;
+
+    // The bitmap library may be called before `initialize`, so open it lazily
+    if (!deviceOpened && open_disk() != 0)
+        return -1;
+
+    for (int i = 0; i < iovcnt; i++)
+    {
+        if (iov[i].iov_len % SECTOR_SIZE != 0)
+        {
+            printf("ERROR: Vector entries must hold whole sectors.\n");
+            return -1;
+        }
+        count += iov[i].iov_len / SECTOR_SIZE;
+    }
+
+    if (checkBounds(first, count) != 0)
+        return -1;
+
+    return write ? device->write(first, iov, iovcnt) : device->read(first, iov, iovcnt);
+}
+
+int readv_sectors(unsigned int first, const struct iovec *iov, int iovcnt)
+{
+    return transfer(0, first, iov, iovcnt);
+}
+
+int writev_sectors(unsigned int first, const struct iovec *iov, int iovcnt)
+{
+    return transfer(1, first, iov, iovcnt);
+}
+
+int read_sectors(unsigned int first, unsigned int count, unsigned char *buffer)
+{
+    struct iovec iov = {buffer, (size_t)count * SECTOR_SIZE};
+    return readv_sectors(first, &iov, 1);
+}
+
+int write_sectors(unsigned int first, unsigned int count, unsigned char *buffer)
+{
+    struct iovec iov = {buffer, (size_t)count * SECTOR_SIZE};
+    return writev_sectors(first, &iov, 1);
+}
+
+// Serves a batch through the device when it knows how to, or one request at a time otherwise
+static int transferBatch(int write, const SECTOR_REQUEST *requests, int quantity)
+{
+    if (!deviceOpened && open_disk() != 0)
+        return -1;
+
+    for (int i = 0; i < quantity; i++)
+        if (checkBounds(requests[i].first, requests[i].count) != 0)
+            return -1;
+
+    if (device->batch != NULL)
+        return device->batch(write, requests, quantity);
+
+    for (int i = 0; i < quantity; i++)
+    {
+        struct iovec iov = {requests[i].buffer, (size_t)requests[i].count * SECTOR_SIZE};
+        if ((write ? device->write(requests[i].first, &iov, 1) : device->read(requests[i].first, &iov, 1)) != 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+int read_sectors_batch(const SECTOR_REQUEST *requests, int quantity)
+{
+    return transferBatch(0, requests, quantity);
+}
+
+int write_sectors_batch(const SECTOR_REQUEST *requests, int quantity)
+{
+    return transferBatch(1, requests, quantity);
+}
+
+int read_sector(unsigned int sector, unsigned char *buffer)
+{
+    return read_sectors(sector, 1, buffer);
+}
+
+int write_sector(unsigned int sector, unsigned char *buffer)
+{
+    return write_sectors(sector, 1, buffer);
+}
@@ -0,0 +1,525 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "t2fs.h"
+#include "t2disk.h"
+#include "apidisk.h"
+#include "bitmap2.h"
+#include "t2cache.h"
+#include "t2space.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAS_AVX2_KERNEL
+#endif
+
+#define BITS_PER_SECTOR (SECTOR_SIZE * 8)
+#define WORDS_PER_SECTOR (SECTOR_SIZE / sizeof(unsigned long long))
+#define ALL_ONES 0xFFFFFFFFFFFFFFFFULL
+#define BEST_FIT_MIN_BLOCKS 16
+
+// One bitmap of the partition, kept whole in memory. Bit `i` is bit `i % 8` of
+// byte `i / 8`, which on little endian machines is also bit `i % 64` of word `i / 64`.
+// Two summary levels above it lead a search straight to a word with a free bit.
+typedef struct
+{
+    DWORD firstSector;
+    DWORD sectors;
+    DWORD bits; // Bits which really stand for something, the rest of the last sector is never used
+    DWORD words;
+    unsigned long long *map;
+    unsigned long long *summary; // Bit `w` set: word `w` of `map` has a free bit
+    unsigned long long *top;     // Bit `s` set: word `s` of `summary` has a bit set
+    DWORD summaryWords, topWords;
+    BYTE *dirty;  // Sectors changed since they were last written
+    DWORD cursor; // Word where the last search for a free bit stopped (next fit)
+} BITMAP;
+
+static BITMAP bitmaps[2];
+static int openedSector = -1;
+
+// Returns the index of the first word in [from, to) which isn't equal to `skip`
+// (all zeros or all ones), or `to` if there is none
+static DWORD scanWordsScalar(const unsigned long long *map, DWORD from, DWORD to, unsigned long long skip)
+{
+    while (from < to && map[from] == skip)
+        from++;
+
+    return from;
+}
+
+#ifdef HAS_AVX2_KERNEL
+// Same as `scanWordsScalar`, checking four words at a time
+__attribute__((target("avx2"))) static DWORD scanWordsAVX2(const unsigned long long *map, DWORD from, DWORD to, unsigned long long skip)
+{
+    __m256i pattern = _mm256_set1_epi64x((long long)skip);
+
+    while (from + 4 <= to)
+    {
+        __m256i words = _mm256_loadu_si256((const __m256i *)(map + from));
+        if (!_mm256_testz_si256(_mm256_xor_si256(words, pattern), _mm256_set1_epi64x(-1)))
+            break;
+        from += 4;
+    }
+
+    return scanWordsScalar(map, from, to, skip);
+}
+#endif
+
+static DWORD (*scanWords)(const unsigned long long *, DWORD, DWORD, unsigned long long) = NULL;
+
+// Chooses the fastest kernel this processor can run
+static void chooseScanKernel()
+{
+    scanWords = scanWordsScalar;
+
+#ifdef HAS_AVX2_KERNEL
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        scanWords = scanWordsAVX2;
+#endif
+}
+
+// Returns the free bits of the word `word` of `bitmap` set, ignoring the bits past the last valid one
+static unsigned long long freeBits(BITMAP *bitmap, DWORD word)
+{
+    unsigned long long valid = ALL_ONES;
+    if (word >= bitmap->bits / 64)
+        valid = word == bitmap->bits / 64 ? (1ULL << (bitmap->bits % 64)) - 1 : 0;
+
+    return ~bitmap->map[word] & valid;
+}
+
+// Tells if the word `word` of `bitmap` has a free bit
+static int hasFreeBit(BITMAP *bitmap, DWORD word)
+{
+    return freeBits(bitmap, word) != 0;
+}
+
+// Brings both summary levels up to date with the word `word` of `bitmap`
+static void updateSummary(BITMAP *bitmap, DWORD word)
+{
+    DWORD summaryWord = word / 64;
+
+    if (hasFreeBit(bitmap, word))
+        bitmap->summary[summaryWord] |= 1ULL << (word % 64);
+    else
+        bitmap->summary[summaryWord] &= ~(1ULL << (word % 64));
+
+    if (bitmap->summary[summaryWord] != 0)
+        bitmap->top[summaryWord / 64] |= 1ULL << (summaryWord % 64);
+    else
+        bitmap->top[summaryWord / 64] &= ~(1ULL << (summaryWord % 64));
+}
+
+// Returns the first word from `from` on with a free bit, or -1 if there is none
+static long findFreeWord(BITMAP *bitmap, DWORD from)
+{
+    DWORD summaryWord = from / 64;
+    if (summaryWord >= bitmap->summaryWords)
+        return -1;
+
+    unsigned long long candidates = bitmap->summary[summaryWord] & (ALL_ONES << (from % 64));
+    if (candidates != 0)
+        return summaryWord * 64 + __builtin_ctzll(candidates);
+
+    // Otherwise, the next summary word with a bit set is found through the top level
+    summaryWord++;
+    if (summaryWord >= bitmap->summaryWords)
+        return -1;
+
+    DWORD topWord = summaryWord / 64;
+    candidates = bitmap->top[topWord] & (ALL_ONES << (summaryWord % 64));
+    while (candidates == 0)
+    {
+        if (++topWord >= bitmap->topWords)
+            return -1;
+        candidates = bitmap->top[topWord];
+    }
+
+    summaryWord = topWord * 64 + __builtin_ctzll(candidates);
+    return summaryWord * 64 + __builtin_ctzll(bitmap->summary[summaryWord]);
+}
+
+// Builds both summary levels from the bitmap itself
+static void buildSummary(BITMAP *bitmap)
+{
+    for (DWORD word = 0; word < (bitmap->bits + 63) / 64; word++)
+        updateSummary(bitmap, word);
+}
+
+// Records every run of free bits of the data bitmap in the free space index
+static int indexFreeRuns(BITMAP *bitmap)
+{
+    spaceClear();
+
+    DWORD bit = 0;
+    long word;
+    while (bit < bitmap->bits && (word = findFreeWord(bitmap, bit / 64)) >= 0)
+    {
+        unsigned long long candidates = freeBits(bitmap, word);
+        if ((DWORD)word == bit / 64)
+            candidates &= ALL_ONES << (bit % 64);
+        if (candidates == 0)
+        {
+            bit = (word + 1) * 64;
+            continue;
+        }
+
+        // The run goes on until the first used bit (bits past the last one count as used)
+        DWORD start = word * 64 + __builtin_ctzll(candidates);
+        DWORD end = start;
+        while (end < bitmap->bits)
+        {
+            unsigned long long used = ~freeBits(bitmap, end / 64) & (ALL_ONES << (end % 64));
+            if (used != 0)
+            {
+                end = end / 64 * 64 + __builtin_ctzll(used);
+                break;
+            }
+            end = (end / 64 + 1) * 64;
+        }
+        if (end > bitmap->bits)
+            end = bitmap->bits;
+
+        if (spaceInsert(start, end - start) != 0)
+            return -1;
+        bit = end;
+    }
+
+    return 0;
+}
+
+// Returns the bitmap of `handle`, or NULL if there is none
+static BITMAP *getBitmap(int handle)
+{
+    if (openedSector < 0)
+    {
+        printf("ERROR: The bitmaps aren't opened.\n");
+        return NULL;
+    }
+
+    return &bitmaps[handle == BITMAP_INODE ? BITMAP_INODE : BITMAP_DADOS];
+}
+
+// Reads `sectors` sectors starting at `firstSector` into `bitmap`
+static int loadBitmap(BITMAP *bitmap, DWORD firstSector, DWORD sectors, DWORD bits)
+{
+    if (bits > sectors * BITS_PER_SECTOR)
+        bits = sectors * BITS_PER_SECTOR;
+
+    bitmap->firstSector = firstSector;
+    bitmap->sectors = sectors;
+    bitmap->bits = bits;
+    bitmap->words = sectors * WORDS_PER_SECTOR;
+    bitmap->cursor = 0;
+    bitmap->summaryWords = (bitmap->words + 63) / 64;
+    bitmap->topWords = (bitmap->summaryWords + 63) / 64;
+
+    // One more of each, so that even an empty bitmap gets some memory
+    bitmap->map = (unsigned long long *)calloc(bitmap->words + 1, sizeof(unsigned long long));
+    bitmap->summary = (unsigned long long *)calloc(bitmap->summaryWords + 1, sizeof(unsigned long long));
+    bitmap->top = (unsigned long long *)calloc(bitmap->topWords + 1, sizeof(unsigned long long));
+    bitmap->dirty = (BYTE *)calloc(sectors + 1, sizeof(BYTE));
+    if (bitmap->map == NULL || bitmap->summary == NULL || bitmap->top == NULL || bitmap->dirty == NULL)
+    {
+        printf("ERROR: Couldn't allocate memory for a bitmap.\n");
+        return -1;
+    }
+
+    // The whole bitmap is read at once, straight from the disk unless the cache holds it
+    SECTOR_REQUEST request = {firstSector, sectors, (BYTE *)bitmap->map};
+    if (sectors > 0 && cacheReadBatch(&request, 1) != 0)
+    {
+        printf("ERROR: Couldn't read the bitmap on sectors %u to %u.\n", firstSector, firstSector + sectors - 1);
+        return -1;
+    }
+    buildSummary(bitmap);
+
+    return 0;
+}
+
+// Writes every changed sector of `bitmap` back, merging consecutive sectors, in a single batch
+static int writeBitmap(BITMAP *bitmap)
+{
+    SECTOR_REQUEST *requests = NULL;
+    int quantity = 0;
+
+    for (DWORD i = 0; i < bitmap->sectors; i++)
+    {
+        if (!bitmap->dirty[i])
+            continue;
+        bitmap->dirty[i] = 0;
+
+        if (quantity > 0 && requests[quantity - 1].first + requests[quantity - 1].count == bitmap->firstSector + i)
+        {
+            requests[quantity - 1].count++;
+            continue;
+        }
+
+        if (requests == NULL)
+            requests = (SECTOR_REQUEST *)malloc(sizeof(SECTOR_REQUEST) * (bitmap->sectors / 2 + 1));
+        requests[quantity++] = (SECTOR_REQUEST){bitmap->firstSector + i, 1, (BYTE *)bitmap->map + i * SECTOR_SIZE};
+    }
+
+    int result = quantity > 0 ? cacheWriteBatch(requests, quantity) : 0;
+    free(requests);
+
+    return result;
+}
+
+int openBitmap2(int superbloco_sector)
+{
+    // The bitmaps stay in memory until they are released, so opening them again is free
+    if (superbloco_sector == openedSector)
+        return 0;
+
+    if (openedSector >= 0 && releaseBitmap2() != 0)
+        return -1;
+
+    if (scanWords == NULL)
+        chooseScanKernel();
+
+    BYTE buffer[SECTOR_SIZE];
+    struct t2fs_superbloco sb;
+    if (read_sector(superbloco_sector, buffer) != 0)
+    {
+        printf("ERROR: Couldn't read the superblock on sector %d.\n", superbloco_sector);
+        return -1;
+    }
+    memcpy(&sb, buffer, sizeof(sb));
+
+    // Blocks are counted from the first data block, so the data bitmap only
+    // has a bit for each block after the inode area
+    DWORD blockBitmapSector = superbloco_sector + sb.superblockSize * sb.blockSize;
+    DWORD inodeBitmapSector = blockBitmapSector + sb.freeBlocksBitmapSize * sb.blockSize;
+    DWORD metadataBlocks = sb.superblockSize + sb.freeBlocksBitmapSize + sb.freeInodeBitmapSize + sb.inodeAreaSize;
+    DWORD dataBlocks = sb.diskSize > metadataBlocks ? sb.diskSize - metadataBlocks : 0;
+    DWORD inodes = sb.inodeAreaSize * sb.blockSize * SECTOR_SIZE / sizeof(struct t2fs_inode);
+
+    openedSector = superbloco_sector;
+    if (loadBitmap(&bitmaps[BITMAP_DADOS], blockBitmapSector, sb.freeBlocksBitmapSize * sb.blockSize, dataBlocks) != 0 ||
+        loadBitmap(&bitmaps[BITMAP_INODE], inodeBitmapSector, sb.freeInodeBitmapSize * sb.blockSize, inodes) != 0 ||
+        indexFreeRuns(&bitmaps[BITMAP_DADOS]) != 0)
+    {
+        releaseBitmap2();
+        return -1;
+    }
+
+    return 0;
+}
+
+int closeBitmap2(void)
+{
+    if (openedSector < 0)
+        return 0;
+
+    if (writeBitmap(&bitmaps[BITMAP_INODE]) != 0 || writeBitmap(&bitmaps[BITMAP_DADOS]) != 0)
+    {
+        printf("ERROR: Couldn't write the bitmaps back.\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+int releaseBitmap2(void)
+{
+    int result = closeBitmap2();
+
+    for (int i = 0; i < 2; i++)
+    {
+        free(bitmaps[i].map);
+        free(bitmaps[i].summary);
+        free(bitmaps[i].top);
+        free(bitmaps[i].dirty);
+        memset(&bitmaps[i], 0, sizeof(BITMAP));
+    }
+    spaceClear();
+    openedSector = -1;
+
+    return result;
+}
+
+int getBitmap2(int handle, int bitNumber)
+{
+    BITMAP *bitmap = getBitmap(handle);
+    if (bitmap == NULL || bitNumber < 0 || (DWORD)bitNumber >= bitmap->bits)
+        return -1;
+
+    return (bitmap->map[bitNumber / 64] >> (bitNumber % 64)) & 1;
+}
+
+int setBitmap2(int handle, int bitNumber, int bitValue)
+{
+    BITMAP *bitmap = getBitmap(handle);
+    if (bitmap == NULL || bitNumber < 0 || (DWORD)bitNumber >= bitmap->bits)
+        return -1;
+
+    // The free space index follows every change of the data bitmap
+    int oldValue = (bitmap->map[bitNumber / 64] >> (bitNumber % 64)) & 1;
+    if (bitmap == &bitmaps[BITMAP_DADOS] && oldValue != (bitValue != 0) &&
+        (bitValue ? spaceRemove(bitNumber, 1) : spaceInsert(bitNumber, 1)) != 0)
+        return -1;
+
+    if (bitValue)
+        bitmap->map[bitNumber / 64] |= 1ULL << (bitNumber % 64);
+    else
+        bitmap->map[bitNumber / 64] &= ~(1ULL << (bitNumber % 64));
+    bitmap->dirty[bitNumber / BITS_PER_SECTOR] = 1;
+    updateSummary(bitmap, bitNumber / 64);
+
+    return 0;
+}
+
+// Records the bits set in `changed`, from the word `word` of the data bitmap, in
+// the free space index, merging them into `run` while they are contiguous
+static int indexChangedBits(unsigned long long changed, DWORD word, int bitValue, DWORD run[2])
+{
+    while (changed != 0)
+    {
+        DWORD start = word * 64 + __builtin_ctzll(changed);
+        unsigned long long shifted = changed >> (start % 64);
+        DWORD length = ~shifted == 0 ? 64 : (DWORD)__builtin_ctzll(~shifted);
+        changed = start % 64 + length >= 64 ? 0 : changed & (ALL_ONES << (start % 64 + length));
+
+        if (run[1] > 0 && run[0] + run[1] == start)
+        {
+            run[1] += length;
+            continue;
+        }
+
+        if (run[1] > 0 && (bitValue ? spaceRemove(run[0], run[1]) : spaceInsert(run[0], run[1])) != 0)
+            return -1;
+        run[0] = start;
+        run[1] = length;
+    }
+
+    return 0;
+}
+
+int setRangeBitmap2(int handle, int firstBit, int count, int bitValue)
+{
+    BITMAP *bitmap = getBitmap(handle);
+    if (bitmap == NULL || firstBit < 0 || count < 0 || (DWORD)firstBit + count > bitmap->bits)
+        return -1;
+
+    DWORD run[2] = {0, 0}; // Bits changed so far and not in the free space index yet
+    DWORD bit = firstBit, end = firstBit + count;
+    while (bit < end)
+    {
+        DWORD word = bit / 64;
+        DWORD last = end - word * 64 < 64 ? end - word * 64 : 64;
+        unsigned long long mask = (last == 64 ? ALL_ONES : (1ULL << last) - 1) & (ALL_ONES << (bit % 64));
+
+        // Only the bits which really change go to the free space index
+        unsigned long long changed = mask & (bitValue ? ~bitmap->map[word] : bitmap->map[word]);
+        if (bitmap == &bitmaps[BITMAP_DADOS] && indexChangedBits(changed, word, bitValue, run) != 0)
+            return -1;
+
+        if (bitValue)
+            bitmap->map[word] |= mask;
+        else
+            bitmap->map[word] &= ~mask;
+        bitmap->dirty[word / WORDS_PER_SECTOR] = 1;
+        updateSummary(bitmap, word);
+
+        bit = (word + 1) * 64;
+    }
+
+    if (run[1] > 0 && (bitValue ? spaceRemove(run[0], run[1]) : spaceInsert(run[0], run[1])) != 0)
+        return -1;
+
+    return 0;
+}
+
+// Looks for a bit equal to `bitValue` in the words [from, to)
+static int searchWords(BITMAP *bitmap, DWORD from, DWORD to, int bitValue)
+{
+    unsigned long long skip = bitValue ? 0 : ALL_ONES;
+
+    while ((from = scanWords(bitmap->map, from, to, skip)) < to)
+    {
+        unsigned long long word = bitValue ? bitmap->map[from] : ~bitmap->map[from];
+        DWORD bit = from * 64 + __builtin_ctzll(word);
+
+        // Bits after the last valid one don't count
+        if (bit >= bitmap->bits)
+            return -1;
+
+        bitmap->cursor = from;
+        return bit;
+    }
+
+    return -1;
+}
+
+int searchBitmap2(int handle, int bitValue)
+{
+    BITMAP *bitmap = getBitmap(handle);
+    if (bitmap == NULL)
+        return -1;
+
+    // Start where the last search stopped, wrapping around to the beginning
+    DWORD words = (bitmap->bits + 63) / 64;
+    DWORD cursor = bitmap->cursor < words ? bitmap->cursor : 0;
+
+    // Set bits are only looked for to check if a bitmap is empty, so a scan will do
+    if (bitValue)
+    {
+        int bit = searchWords(bitmap, cursor, words, bitValue);
+        if (bit < 0 && cursor > 0)
+            bit = searchWords(bitmap, 0, cursor, bitValue);
+
+        return bit;
+    }
+
+    // Free bits are found through the summary levels
+    long word = findFreeWord(bitmap, cursor);
+    if (word < 0 && cursor > 0)
+        word = findFreeWord(bitmap, 0);
+    if (word < 0)
+        return -1;
+
+    bitmap->cursor = word;
+    return word * 64 + __builtin_ctzll(~bitmap->map[word]);
+}
+
+int searchRunBitmap2(int handle, int goal, int count, int *length)
+{
+    BITMAP *bitmap = getBitmap(handle);
+    if (bitmap == NULL || count <= 0)
+        return -1;
+
+    if (handle == BITMAP_INODE)
+    {
+        printf("ERROR: Runs are only looked for in the data bitmap.\n");
+        return -1;
+    }
+
+    if (goal < 0 || (DWORD)goal >= bitmap->bits)
+        goal = 0;
+
+    // The file goes on right where it stops if it can. Otherwise small allocations
+    // stay near it, and big ones take the smallest run where they fit whole, so
+    // that the big runs are kept for big files. With no run big enough, the
+    // biggest one is taken.
+    DWORD first, run;
+    if (spaceFindRun(goal, &first, &run) == 0)
+    {
+        run -= goal - first;
+        first = goal;
+    }
+    else if ((count >= BEST_FIT_MIN_BLOCKS || spaceNextFit(goal, count, &first, &run) != 0) &&
+             spaceBestFit(count, &first, &run) != 0 &&
+             spaceLargest(&first, &run) != 0)
+        return -1;
+
+    if (run > (DWORD)count)
+        run = count;
+    bitmap->cursor = (first + run) / 64;
+    *length = run;
+
+    return first;
+}
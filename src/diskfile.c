@@ -0,0 +1,168 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "diskdev.h"
+#include "diskuring.h"
+
+// File descriptor of the disk image, kept open for the whole library lifetime
+static int diskFd = -1;
+static unsigned int diskSectors = 0;
+
+static int fileOpen(void)
+{
+    struct stat st;
+
+    if ((diskFd = open(DISK_NAME, O_RDWR)) < 0)
+    {
+        printf("ERROR: Couldn't open disk image %s.\n", DISK_NAME);
+        return -1;
+    }
+
+    if (fstat(diskFd, &st) != 0)
+    {
+        printf("ERROR: Couldn't stat disk image %s.\n", DISK_NAME);
+        close(diskFd);
+        diskFd = -1;
+        return -1;
+    }
+    diskSectors = st.st_size / SECTOR_SIZE;
+
+    return 0;
+}
+
+static int fileClose(void)
+{
+    if (close(diskFd) != 0)
+    {
+        printf("ERROR: Couldn't close disk image %s.\n", DISK_NAME);
+        return -1;
+    }
+    diskFd = -1;
+
+    return 0;
+}
+
+// Keep calling `preadv`/`pwritev` until the whole vector is transferred,
+// as they may transfer less bytes than requested or be interrupted by a signal
+static int fileTransfer(int write, unsigned int first, const struct iovec *iov, int iovcnt)
+{
+    struct iovec pending[IOV_MAX];
+    off_t offset = (off_t)first * SECTOR_SIZE;
+
+    if (iovcnt > IOV_MAX)
+        return -1;
+    memcpy(pending, iov, iovcnt * sizeof(struct iovec));
+
+    struct iovec *current = pending;
+    while (iovcnt > 0)
+    {
+        ssize_t n = write ? pwritev(diskFd, current, iovcnt, offset) : preadv(diskFd, current, iovcnt, offset);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+
+        // Skip what was already transferred
+        offset += n;
+        while (iovcnt > 0 && (size_t)n >= current->iov_len)
+        {
+            n -= current->iov_len;
+            current++;
+            iovcnt--;
+        }
+        if (iovcnt > 0)
+        {
+            current->iov_base = (unsigned char *)current->iov_base + n;
+            current->iov_len -= n;
+        }
+    }
+
+    return 0;
+}
+
+static int fileRead(unsigned int first, const struct iovec *iov, int iovcnt)
+{
+    return fileTransfer(0, first, iov, iovcnt);
+}
+
+static int fileWrite(unsigned int first, const struct iovec *iov, int iovcnt)
+{
+    return fileTransfer(1, first, iov, iovcnt);
+}
+
+static int fileFlush(void)
+{
+    return fdatasync(diskFd);
+}
+
+static unsigned int fileSize(void)
+{
+    return diskSectors;
+}
+
+static int fileDiscard(unsigned int first, unsigned int count)
+{
+    off_t offset = (off_t)first * SECTOR_SIZE;
+    off_t length = (off_t)count * SECTOR_SIZE;
+
+    // Punch a hole when the host filesystem supports it, zero the sectors otherwise
+    if (fallocate(diskFd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, length) == 0)
+        return 0;
+
+    unsigned char zeroes[SECTOR_SIZE] = {0};
+    struct iovec iov = {zeroes, SECTOR_SIZE};
+    for (unsigned int sector = first; sector < first + count; sector++)
+        if (fileTransfer(1, sector, &iov, 1) != 0)
+            return -1;
+
+    return 0;
+}
+
+/*
+    io_uring flavour of the file device: same descriptor and single
+    requests, but batches go through the ring when it is available
+*/
+static int uringOpen(void)
+{
+    if (fileOpen() != 0)
+        return -1;
+
+    if (uring_open(diskFd, disk_queue_depth()) != 0)
+        printf("INFO: io_uring is not available, falling back to pread/pwrite.\n");
+
+    return 0;
+}
+
+static int uringClose(void)
+{
+    uring_close();
+
+    return fileClose();
+}
+
+static int uringBatch(int write, const SECTOR_REQUEST *requests, int quantity)
+{
+    if (uring_available())
+        return uring_transfer(write, requests, quantity);
+
+    for (int i = 0; i < quantity; i++)
+    {
+        struct iovec iov = {requests[i].buffer, (size_t)requests[i].count * SECTOR_SIZE};
+        if (fileTransfer(write, requests[i].first, &iov, 1) != 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+DISK_DEVICE fileDisk = {"file", fileOpen, fileClose, fileRead, fileWrite, fileFlush, fileSize, fileDiscard, NULL, NULL};
+
+DISK_DEVICE uringDisk = {"io_uring", uringOpen, uringClose, fileRead, fileWrite, fileFlush, fileSize, fileDiscard, NULL, uringBatch};
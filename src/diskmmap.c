@@ -0,0 +1,109 @@
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "diskdev.h"
+
+// The whole disk image mapped in memory, shared with the file
+static int diskFd = -1;
+static unsigned char *diskMap = NULL;
+static size_t diskMapSize = 0;
+
+static int mmapOpen(void)
+{
+    struct stat st;
+    void *map;
+
+    if ((diskFd = open(DISK_NAME, O_RDWR)) < 0)
+    {
+        printf("ERROR: Couldn't open disk image %s.\n", DISK_NAME);
+        return -1;
+    }
+
+    if (fstat(diskFd, &st) != 0 || (map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, diskFd, 0)) == MAP_FAILED)
+    {
+        printf("ERROR: Couldn't map disk image %s.\n", DISK_NAME);
+        close(diskFd);
+        diskFd = -1;
+        return -1;
+    }
+
+    diskMap = (unsigned char *)map;
+    diskMapSize = st.st_size;
+
+    return 0;
+}
+
+static int mmapClose(void)
+{
+    msync(diskMap, diskMapSize, MS_SYNC);
+    munmap(diskMap, diskMapSize);
+    diskMap = NULL;
+    diskMapSize = 0;
+
+    if (close(diskFd) != 0)
+    {
+        printf("ERROR: Couldn't close disk image %s.\n", DISK_NAME);
+        return -1;
+    }
+    diskFd = -1;
+
+    return 0;
+}
+
+// Copies the sectors starting at `first` between the mapping and the vector
+static int mmapTransfer(int write, unsigned int first, const struct iovec *iov, int iovcnt)
+{
+    size_t offset = (size_t)first * SECTOR_SIZE;
+    for (int i = 0; i < iovcnt; i++)
+    {
+        if (write)
+            memcpy(diskMap + offset, iov[i].iov_base, iov[i].iov_len);
+        else
+            memcpy(iov[i].iov_base, diskMap + offset, iov[i].iov_len);
+
+        offset += iov[i].iov_len;
+    }
+
+    return 0;
+}
+
+static int mmapRead(unsigned int first, const struct iovec *iov, int iovcnt)
+{
+    return mmapTransfer(0, first, iov, iovcnt);
+}
+
+static int mmapWrite(unsigned int first, const struct iovec *iov, int iovcnt)
+{
+    return mmapTransfer(1, first, iov, iovcnt);
+}
+
+static int mmapFlush(void)
+{
+    return msync(diskMap, diskMapSize, MS_SYNC);
+}
+
+static unsigned int mmapSize(void)
+{
+    return diskMapSize / SECTOR_SIZE;
+}
+
+static int mmapDiscard(unsigned int first, unsigned int count)
+{
+    memset(diskMap + (size_t)first * SECTOR_SIZE, 0, (size_t)count * SECTOR_SIZE);
+
+    return 0;
+}
+
+static unsigned char *mmapMap(unsigned int sector)
+{
+    return diskMap + (size_t)sector * SECTOR_SIZE;
+}
+
+DISK_DEVICE mmapDisk = {"mmap", mmapOpen, mmapClose, mmapRead, mmapWrite, mmapFlush, mmapSize, mmapDiscard, mmapMap, NULL};
@@ -0,0 +1,136 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+
+#include "t2fs.h"
+#include "diskdev.h"
+
+// Disk contents, living only in memory
+static unsigned char *ramData = NULL;
+static unsigned int ramSectors = 0;
+
+// Creates an empty disk with an MBR describing a single partition which
+// spans every sector after the MBR, so it can be formatted right away
+static int ramCreate(unsigned int sectors)
+{
+    if (sectors < 2)
+    {
+        printf("ERROR: A RAM disk needs at least 2 sectors.\n");
+        return -1;
+    }
+
+    if ((ramData = (unsigned char *)calloc(sectors, SECTOR_SIZE)) == NULL)
+    {
+        printf("ERROR: Couldn't allocate %u sectors for the RAM disk.\n", sectors);
+        return -1;
+    }
+    ramSectors = sectors;
+
+    MBR *mbr = (MBR *)ramData;
+    mbr->version = 0x7E32;
+    mbr->sectorSize = SECTOR_SIZE;
+    mbr->partitionsTableByteInit = 8;
+    mbr->partitionQuantity = 1;
+    mbr->partitions[0].firstSector = 1;
+    mbr->partitions[0].lastSector = sectors - 1;
+    strcpy(mbr->partitions[0].name, "RamPart");
+
+    return 0;
+}
+
+// Copies the disk image to memory. Changes are never written back to it.
+static int ramLoad(void)
+{
+    FILE *image = fopen(DISK_NAME, "rb");
+    if (image == NULL)
+    {
+        printf("ERROR: Couldn't open disk image %s.\n", DISK_NAME);
+        return -1;
+    }
+
+    fseek(image, 0, SEEK_END);
+    long size = ftell(image);
+    fseek(image, 0, SEEK_SET);
+
+    ramSectors = size / SECTOR_SIZE;
+    if ((ramData = (unsigned char *)malloc((size_t)ramSectors * SECTOR_SIZE)) == NULL || fread(ramData, SECTOR_SIZE, ramSectors, image) != ramSectors)
+    {
+        printf("ERROR: Couldn't load disk image %s to memory.\n", DISK_NAME);
+        free(ramData);
+        ramData = NULL;
+        fclose(image);
+        return -1;
+    }
+
+    fclose(image);
+    return 0;
+}
+
+static int ramOpen(void)
+{
+    if (ram_disk_size() > 0)
+        return ramCreate(ram_disk_size());
+
+    return ramLoad();
+}
+
+static int ramClose(void)
+{
+    free(ramData);
+    ramData = NULL;
+    ramSectors = 0;
+
+    return 0;
+}
+
+static int ramTransfer(int write, unsigned int first, const struct iovec *iov, int iovcnt)
+{
+    size_t offset = (size_t)first * SECTOR_SIZE;
+    for (int i = 0; i < iovcnt; i++)
+    {
+        if (write)
+            memcpy(ramData + offset, iov[i].iov_base, iov[i].iov_len);
+        else
+            memcpy(iov[i].iov_base, ramData + offset, iov[i].iov_len);
+
+        offset += iov[i].iov_len;
+    }
+
+    return 0;
+}
+
+static int ramRead(unsigned int first, const struct iovec *iov, int iovcnt)
+{
+    return ramTransfer(0, first, iov, iovcnt);
+}
+
+static int ramWrite(unsigned int first, const struct iovec *iov, int iovcnt)
+{
+    return ramTransfer(1, first, iov, iovcnt);
+}
+
+// Nothing to flush, the memory is the disk
+static int ramFlush(void)
+{
+    return 0;
+}
+
+static unsigned int ramSize(void)
+{
+    return ramSectors;
+}
+
+static int ramDiscard(unsigned int first, unsigned int count)
+{
+    memset(ramData + (size_t)first * SECTOR_SIZE, 0, (size_t)count * SECTOR_SIZE);
+
+    return 0;
+}
+
+static unsigned char *ramMap(unsigned int sector)
+{
+    return ramData + (size_t)sector * SECTOR_SIZE;
+}
+
+DISK_DEVICE ramDisk = {"ram", ramOpen, ramClose, ramRead, ramWrite, ramFlush, ramSize, ramDiscard, ramMap, NULL};
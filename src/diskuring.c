@@ -0,0 +1,299 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "diskuring.h"
+
+#if defined(__linux__) && defined(__NR_io_uring_setup)
+
+#include <linux/io_uring.h>
+
+// Memory mapped submission and completion rings shared with the kernel
+static struct
+{
+    int fd;
+    int diskFd;
+    unsigned int entries;
+
+    unsigned int *sqHead, *sqTail, *sqMask, *sqArray;
+    struct io_uring_sqe *sqes;
+    unsigned int *cqHead, *cqTail, *cqMask;
+    struct io_uring_cqe *cqes;
+
+    void *sqRing, *cqRing;
+    size_t sqRingSize, cqRingSize, sqesSize;
+
+    int unsupported; // The kernel refused IORING_OP_READ/WRITE, so pread/pwrite are used
+} ring = {.fd = -1};
+
+static int ringSetup(unsigned int entries, struct io_uring_params *params)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int ringEnter(unsigned int toSubmit, unsigned int minComplete)
+{
+    return (int)syscall(__NR_io_uring_enter, ring.fd, toSubmit, minComplete, IORING_ENTER_GETEVENTS, NULL, 0);
+}
+
+int uring_open(int fd, unsigned int depth)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    if (ring.fd >= 0)
+        uring_close();
+
+    if ((ring.fd = ringSetup(depth, &params)) < 0)
+    {
+        ring.fd = -1;
+        return -1;
+    }
+
+    ring.diskFd = fd;
+    ring.unsupported = 0;
+    ring.entries = params.sq_entries;
+    ring.sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    ring.cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring.sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    // Newer kernels map both rings with a single mmap
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (ring.cqRingSize > ring.sqRingSize)
+            ring.sqRingSize = ring.cqRingSize;
+        ring.cqRingSize = ring.sqRingSize;
+    }
+
+    ring.sqRing = mmap(NULL, ring.sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQ_RING);
+    if (ring.sqRing == MAP_FAILED)
+    {
+        close(ring.fd);
+        ring.fd = -1;
+        return -1;
+    }
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+        ring.cqRing = ring.sqRing;
+    else if ((ring.cqRing = mmap(NULL, ring.cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_CQ_RING)) == MAP_FAILED)
+    {
+        munmap(ring.sqRing, ring.sqRingSize);
+        close(ring.fd);
+        ring.fd = -1;
+        return -1;
+    }
+
+    ring.sqes = mmap(NULL, ring.sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.fd, IORING_OFF_SQES);
+    if (ring.sqes == MAP_FAILED)
+    {
+        if (ring.cqRing != ring.sqRing)
+            munmap(ring.cqRing, ring.cqRingSize);
+        munmap(ring.sqRing, ring.sqRingSize);
+        close(ring.fd);
+        ring.fd = -1;
+        return -1;
+    }
+
+    unsigned char *sq = (unsigned char *)ring.sqRing;
+    ring.sqHead = (unsigned int *)(sq + params.sq_off.head);
+    ring.sqTail = (unsigned int *)(sq + params.sq_off.tail);
+    ring.sqMask = (unsigned int *)(sq + params.sq_off.ring_mask);
+    ring.sqArray = (unsigned int *)(sq + params.sq_off.array);
+
+    unsigned char *cq = (unsigned char *)ring.cqRing;
+    ring.cqHead = (unsigned int *)(cq + params.cq_off.head);
+    ring.cqTail = (unsigned int *)(cq + params.cq_off.tail);
+    ring.cqMask = (unsigned int *)(cq + params.cq_off.ring_mask);
+    ring.cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+    return 0;
+}
+
+void uring_close(void)
+{
+    if (ring.fd < 0)
+        return;
+
+    munmap(ring.sqes, ring.sqesSize);
+    if (ring.cqRing != ring.sqRing)
+        munmap(ring.cqRing, ring.cqRingSize);
+    munmap(ring.sqRing, ring.sqRingSize);
+    close(ring.fd);
+
+    ring.fd = -1;
+}
+
+int uring_available(void)
+{
+    return ring.fd >= 0;
+}
+
+// Finishes a request the kernel only partially transferred, with plain pread/pwrite
+static int finishShortTransfer(int write, const SECTOR_REQUEST *request, size_t done)
+{
+    size_t size = (size_t)request->count * SECTOR_SIZE;
+    off_t offset = (off_t)request->first * SECTOR_SIZE;
+
+    while (done < size)
+    {
+        ssize_t n = write ? pwrite(ring.diskFd, request->buffer + done, size - done, offset + done)
+                          : pread(ring.diskFd, request->buffer + done, size - done, offset + done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+
+        done += n;
+    }
+
+    return 0;
+}
+
+// Takes every completion waiting in the ring. A request the kernel couldn't run
+// because it doesn't know the operation (older kernels) is done with pread/pwrite,
+// and so are the ones it only partially transferred.
+static int reapCompletions(int write, const SECTOR_REQUEST *requests, int *completed)
+{
+    int failed = 0;
+
+    unsigned int head = *ring.cqHead;
+    while (head != __atomic_load_n(ring.cqTail, __ATOMIC_ACQUIRE))
+    {
+        struct io_uring_cqe *cqe = &ring.cqes[head & *ring.cqMask];
+        const SECTOR_REQUEST *request = &requests[cqe->user_data];
+
+        if (cqe->res == -EINVAL || cqe->res == -EOPNOTSUPP)
+        {
+            ring.unsupported = 1;
+            if (finishShortTransfer(write, request, 0) != 0)
+                failed = 1;
+        }
+        else if (cqe->res < 0)
+            failed = 1;
+        else if ((size_t)cqe->res < (size_t)request->count * SECTOR_SIZE && finishShortTransfer(write, request, cqe->res) != 0)
+            failed = 1;
+
+        head++;
+        (*completed)++;
+    }
+    __atomic_store_n(ring.cqHead, head, __ATOMIC_RELEASE);
+
+    return failed;
+}
+
+// Submits `quantity` requests (at most the ring size) and waits for all of them
+static int transferChunk(int write, const SECTOR_REQUEST *requests, int quantity)
+{
+    int failed = 0;
+
+    // Fill the submission queue
+    unsigned int tail = *ring.sqTail;
+    for (int i = 0; i < quantity; i++)
+    {
+        unsigned int index = tail & *ring.sqMask;
+        struct io_uring_sqe *sqe = &ring.sqes[index];
+
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = write ? IORING_OP_WRITE : IORING_OP_READ;
+        sqe->fd = ring.diskFd;
+        sqe->off = (unsigned long long)requests[i].first * SECTOR_SIZE;
+        sqe->addr = (unsigned long long)(uintptr_t)requests[i].buffer;
+        sqe->len = requests[i].count * SECTOR_SIZE;
+        sqe->user_data = i;
+
+        ring.sqArray[index] = index;
+        tail++;
+    }
+    __atomic_store_n(ring.sqTail, tail, __ATOMIC_RELEASE);
+
+    // Submit everything at once and wait for the completions
+    int submitted = 0, completed = 0;
+    while (completed < quantity)
+    {
+        int ret = ringEnter(quantity - submitted, 1);
+        if (ret < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            // The requests the kernel didn't take are taken back, so that a later
+            // chunk doesn't submit them, and the ones it took must complete before
+            // their buffers can be given back to the caller
+            __atomic_store_n(ring.sqTail, __atomic_load_n(ring.sqHead, __ATOMIC_ACQUIRE), __ATOMIC_RELEASE);
+            submitted = quantity - (int)(tail - *ring.sqTail);
+            while (completed < submitted)
+            {
+                reapCompletions(write, requests, &completed);
+                if (completed < submitted && ringEnter(0, 1) < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+                    break;
+            }
+            return -1;
+        }
+        submitted += ret;
+
+        if (reapCompletions(write, requests, &completed) != 0)
+            failed = 1;
+    }
+
+    return failed ? -1 : 0;
+}
+
+int uring_transfer(int write, const SECTOR_REQUEST *requests, int quantity)
+{
+    if (ring.fd < 0)
+        return -1;
+
+    if (ring.unsupported)
+    {
+        for (int i = 0; i < quantity; i++)
+            if (finishShortTransfer(write, &requests[i], 0) != 0)
+                return -1;
+        return 0;
+    }
+
+    for (int done = 0; done < quantity; done += ring.entries)
+    {
+        int chunk = quantity - done < (int)ring.entries ? quantity - done : (int)ring.entries;
+        if (transferChunk(write, requests + done, chunk) != 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+#else
+
+// Not available on this platform, the disk always falls back to pread/pwrite
+int uring_open(int fd, unsigned int depth)
+{
+    (void)fd;
+    (void)depth;
+    return -1;
+}
+
+void uring_close(void)
+{
+}
+
+int uring_available(void)
+{
+    return 0;
+}
+
+int uring_transfer(int write, const SECTOR_REQUEST *requests, int quantity)
+{
+    (void)write;
+    (void)requests;
+    (void)quantity;
+    return -1;
+}
+
+#endif
@@ -0,0 +1,255 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include "t2fs.h"
+#include "t2aio.h"
+
+// A request, from the moment it is submitted until it is reaped
+typedef struct aio_task
+{
+    AIOREQ2 request;
+    int result;
+    struct aio_task *next;
+} AIO_TASK;
+
+// Requests in the order they arrived
+typedef struct
+{
+    AIO_TASK *head, *tail;
+} AIO_QUEUE;
+
+static struct
+{
+    pthread_mutex_t lock;
+    pthread_cond_t submitted; // A request was queued
+    pthread_cond_t finished;  // A request finished
+    AIO_QUEUE pending, done;
+    int running; // Requests taken from `pending` and not in `done` yet
+    int workers;
+    int eventFd;
+    int closed; // New requests are refused, while no partition is mounted
+} aio = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER, {NULL, NULL}, {NULL, NULL}, 0, 0, -1, 1};
+
+static void push(AIO_QUEUE *queue, AIO_TASK *task)
+{
+    task->next = NULL;
+    if (queue->tail != NULL)
+        queue->tail->next = task;
+    else
+        queue->head = task;
+    queue->tail = task;
+}
+
+static AIO_TASK *pop(AIO_QUEUE *queue)
+{
+    AIO_TASK *task = queue->head;
+    if (task == NULL)
+        return NULL;
+
+    queue->head = task->next;
+    if (queue->head == NULL)
+        queue->tail = NULL;
+
+    return task;
+}
+
+// Must be called holding `aio.lock`
+static int openEventFd()
+{
+    if (aio.eventFd < 0)
+    {
+        aio.eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (aio.eventFd < 0)
+            printf("ERROR: Couldn't create the eventfd of the finished requests.\n");
+
+        // Requests may have finished before anyone asked for it
+        uint64_t one = 1;
+        if (aio.eventFd >= 0 && aio.done.head != NULL && write(aio.eventFd, &one, sizeof(one)) != sizeof(one))
+            printf("ERROR: Couldn't signal the eventfd of the finished requests.\n");
+    }
+
+    return aio.eventFd;
+}
+
+// Runs a request taken from `pending`, then moves it to `done`. Must be called
+// without holding `aio.lock`, as pread2 and pwrite2 wait for the library lock.
+static void runTask(AIO_TASK *task)
+{
+    AIOREQ2 *request = &task->request;
+    if (request->opcode == AIO_READ)
+        task->result = pread2(request->handle, request->buffer, request->size, request->offset);
+    else
+        task->result = pwrite2(request->handle, request->buffer, request->size, request->offset);
+
+    pthread_mutex_lock(&aio.lock);
+    aio.running--;
+    push(&aio.done, task);
+
+    // The eventfd counter only has to be non-zero while `done` isn't empty
+    uint64_t one = 1;
+    if (aio.eventFd >= 0 && write(aio.eventFd, &one, sizeof(one)) != sizeof(one))
+        printf("ERROR: Couldn't signal the eventfd of the finished requests.\n");
+
+    pthread_cond_broadcast(&aio.finished);
+    pthread_mutex_unlock(&aio.lock);
+}
+
+static void *runWorker(void *arg)
+{
+    (void)arg;
+
+    pthread_mutex_lock(&aio.lock);
+    while (1)
+    {
+        AIO_TASK *task = pop(&aio.pending);
+        if (task == NULL)
+        {
+            pthread_cond_wait(&aio.submitted, &aio.lock);
+            continue;
+        }
+        aio.running++;
+
+        pthread_mutex_unlock(&aio.lock);
+        runTask(task);
+        pthread_mutex_lock(&aio.lock);
+    }
+
+    return NULL;
+}
+
+// Must be called holding `aio.lock`. The workers live as long as the program.
+static void startWorkers()
+{
+    pthread_attr_t attributes;
+    pthread_attr_init(&attributes);
+    pthread_attr_setdetachstate(&attributes, PTHREAD_CREATE_DETACHED);
+
+    for (; aio.workers < AIO_WORKERS; aio.workers++)
+    {
+        pthread_t worker;
+        if (pthread_create(&worker, &attributes, runWorker, NULL) != 0)
+            break;
+    }
+    pthread_attr_destroy(&attributes);
+
+    if (aio.workers == 0)
+        printf("ERROR: Couldn't start the I/O workers, requests will run as they are submitted.\n");
+}
+
+int aioSubmit(AIOREQ2 *requests, int count)
+{
+    pthread_mutex_lock(&aio.lock);
+    if (aio.workers == 0)
+        startWorkers();
+    openEventFd();
+    pthread_mutex_unlock(&aio.lock);
+
+    int submitted = 0;
+    for (; submitted < count; submitted++)
+    {
+        AIOREQ2 *request = &requests[submitted];
+        if ((request->opcode != AIO_READ && request->opcode != AIO_WRITE) || request->size < 0 || (request->buffer == NULL && request->size > 0))
+        {
+            printf("ERROR: Invalid request %d.\n", submitted);
+            break;
+        }
+
+        AIO_TASK *task = (AIO_TASK *)malloc(sizeof(AIO_TASK));
+        if (task == NULL)
+        {
+            printf("ERROR: Couldn't allocate memory for request %d.\n", submitted);
+            break;
+        }
+        memcpy(&task->request, request, sizeof(AIOREQ2));
+
+        // Checked holding the same lock as the push, so aioClose waits for every
+        // request it didn't refuse
+        pthread_mutex_lock(&aio.lock);
+        if (aio.closed)
+        {
+            pthread_mutex_unlock(&aio.lock);
+            free(task);
+            printf("ERROR: Couldn't submit request %d, no partition is mounted.\n", submitted);
+            break;
+        }
+        else if (aio.workers > 0)
+        {
+            push(&aio.pending, task);
+            pthread_cond_signal(&aio.submitted);
+            pthread_mutex_unlock(&aio.lock);
+        }
+        else
+        {
+            // Without workers the request is served right away, but still reaped later
+            aio.running++;
+            pthread_mutex_unlock(&aio.lock);
+            runTask(task);
+        }
+    }
+
+    return submitted > 0 || count == 0 ? submitted : -1;
+}
+
+int aioReap(AIOEVENT2 *events, int min, int max)
+{
+    int reaped = 0;
+
+    pthread_mutex_lock(&aio.lock);
+    while (reaped < max)
+    {
+        AIO_TASK *task = pop(&aio.done);
+        if (task == NULL)
+        {
+            // Nothing else is going to finish when nothing is pending or running
+            if (reaped >= min || (aio.pending.head == NULL && aio.running == 0))
+                break;
+
+            pthread_cond_wait(&aio.finished, &aio.lock);
+            continue;
+        }
+
+        events[reaped].data = task->request.data;
+        events[reaped].result = task->result;
+        reaped++;
+        free(task);
+    }
+
+    // Writes to the eventfd are made holding the lock too, so it can't miss one
+    uint64_t counter;
+    if (aio.done.head == NULL && aio.eventFd >= 0)
+        while (read(aio.eventFd, &counter, sizeof(counter)) == sizeof(counter))
+            ;
+    pthread_mutex_unlock(&aio.lock);
+
+    return reaped;
+}
+
+int aioGetEventFd()
+{
+    pthread_mutex_lock(&aio.lock);
+    int eventFd = openEventFd();
+    pthread_mutex_unlock(&aio.lock);
+
+    return eventFd;
+}
+
+void aioClose()
+{
+    pthread_mutex_lock(&aio.lock);
+    aio.closed = 1;
+    while (aio.pending.head != NULL || aio.running > 0)
+        pthread_cond_wait(&aio.finished, &aio.lock);
+    pthread_mutex_unlock(&aio.lock);
+}
+
+void aioOpen()
+{
+    pthread_mutex_lock(&aio.lock);
+    aio.closed = 0;
+    pthread_mutex_unlock(&aio.lock);
+}
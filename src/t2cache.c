@@ -0,0 +1,583 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "t2fs.h"
+#include "apidisk.h"
+#include "t2cache.h"
+
+#define NO_ENTRY -1
+#define BOOL unsigned short int
+#define TRUE 1
+#define FALSE 0
+
+// A cached sector, linked both in its hash bucket and in the LRU list
+typedef struct
+{
+    int partition;
+    DWORD sector;
+    int hashNext;
+    int prev, next; // `next` also links the free entries
+    BOOL dirty;     // Changed in memory but not written to the disk yet
+    BYTE data[SECTOR_SIZE];
+} CACHE_ENTRY;
+
+static struct
+{
+    int partition;
+    DWORD capacity;
+    CACHE_ENTRY *entries;
+    int *buckets;
+    DWORD bucketMask;
+    int lruHead, lruTail; // Most and least recently used entries
+    int freeHead;
+    CACHESTATS2 stats;
+
+    // Write policy, kept between mounts
+    int mode;
+    DWORD dirtyRatio;
+} cache = {.entries = NULL, .mode = CACHE_WRITE_BACK, .dirtyRatio = CACHE_DEFAULT_DIRTY_RATIO};
+
+static DWORD hashSector(int partition, DWORD sector)
+{
+    return ((sector * 2654435761u) ^ (DWORD)partition) & cache.bucketMask;
+}
+
+int cacheOpen(int partition, DWORD sectors)
+{
+    cacheClose();
+
+    if (sectors == 0)
+    {
+        printf("ERROR: The cache must hold at least one sector.\n");
+        return -1;
+    }
+
+    // Keep about one entry per bucket
+    DWORD buckets = 1;
+    while (buckets < sectors)
+        buckets <<= 1;
+
+    cache.entries = (CACHE_ENTRY *)malloc(sizeof(CACHE_ENTRY) * sectors);
+    cache.buckets = (int *)malloc(sizeof(int) * buckets);
+    if (cache.entries == NULL || cache.buckets == NULL)
+    {
+        printf("ERROR: Couldn't allocate a cache of %u sectors.\n", sectors);
+        free(cache.entries);
+        free(cache.buckets);
+        cache.entries = NULL;
+        return -1;
+    }
+
+    cache.partition = partition;
+    cache.capacity = sectors;
+    cache.bucketMask = buckets - 1;
+    for (DWORD i = 0; i < buckets; i++)
+        cache.buckets[i] = NO_ENTRY;
+
+    // Every entry starts in the free list
+    for (DWORD i = 0; i < sectors; i++)
+        cache.entries[i].next = i + 1 < sectors ? (int)i + 1 : NO_ENTRY;
+    cache.freeHead = 0;
+    cache.lruHead = cache.lruTail = NO_ENTRY;
+
+    memset(&cache.stats, 0, sizeof(cache.stats));
+    cache.stats.capacity = sectors;
+
+    return 0;
+}
+
+void cacheClose()
+{
+    if (cache.entries == NULL)
+        return;
+
+    cacheFlush();
+
+    free(cache.entries);
+    free(cache.buckets);
+    cache.entries = NULL;
+    cache.buckets = NULL;
+}
+
+static int lookup(int partition, DWORD sector)
+{
+    int index = cache.buckets[hashSector(partition, sector)];
+    while (index != NO_ENTRY && (cache.entries[index].sector != sector || cache.entries[index].partition != partition))
+        index = cache.entries[index].hashNext;
+
+    return index;
+}
+
+static void lruUnlink(int index)
+{
+    CACHE_ENTRY *entry = &cache.entries[index];
+
+    if (entry->prev != NO_ENTRY)
+        cache.entries[entry->prev].next = entry->next;
+    else
+        cache.lruHead = entry->next;
+
+    if (entry->next != NO_ENTRY)
+        cache.entries[entry->next].prev = entry->prev;
+    else
+        cache.lruTail = entry->prev;
+}
+
+static void lruPushFront(int index)
+{
+    CACHE_ENTRY *entry = &cache.entries[index];
+
+    entry->prev = NO_ENTRY;
+    entry->next = cache.lruHead;
+    if (cache.lruHead != NO_ENTRY)
+        cache.entries[cache.lruHead].prev = index;
+    else
+        cache.lruTail = index;
+    cache.lruHead = index;
+}
+
+// Marks the entry as the most recently used one
+static void touch(int index)
+{
+    if (cache.lruHead == index)
+        return;
+
+    lruUnlink(index);
+    lruPushFront(index);
+}
+
+static void hashUnlink(int index)
+{
+    int *link = &cache.buckets[hashSector(cache.entries[index].partition, cache.entries[index].sector)];
+    while (*link != index)
+        link = &cache.entries[*link].hashNext;
+
+    *link = cache.entries[index].hashNext;
+}
+
+// Takes the entry out of the cache, giving it back to the free list.
+// Its changes, if there are any, are lost.
+static void release(int index)
+{
+    if (cache.entries[index].dirty)
+    {
+        cache.entries[index].dirty = FALSE;
+        cache.stats.dirty--;
+    }
+
+    hashUnlink(index);
+    lruUnlink(index);
+
+    cache.entries[index].next = cache.freeHead;
+    cache.freeHead = index;
+    cache.stats.used--;
+}
+
+// Returns an entry for `sector`, already in its bucket and in the front of the LRU
+// list, taking a free one or evicting the least recently used one. Its data is undefined.
+static int insert(DWORD sector)
+{
+    if (cache.freeHead == NO_ENTRY)
+    {
+        // A dirty victim must reach the disk before its entry is reused
+        CACHE_ENTRY *victim = &cache.entries[cache.lruTail];
+        if (victim->dirty)
+        {
+            if (write_sector(victim->sector, victim->data) != 0)
+                printf("ERROR: Couldn't write back cached sector %u.\n", victim->sector);
+            cache.stats.writebacks++;
+        }
+
+        release(cache.lruTail);
+        cache.stats.evictions++;
+    }
+
+    int index = cache.freeHead;
+    CACHE_ENTRY *entry = &cache.entries[index];
+    cache.freeHead = entry->next;
+
+    entry->partition = cache.partition;
+    entry->sector = sector;
+    entry->dirty = FALSE;
+
+    DWORD bucket = hashSector(cache.partition, sector);
+    entry->hashNext = cache.buckets[bucket];
+    cache.buckets[bucket] = index;
+
+    lruPushFront(index);
+    cache.stats.used++;
+
+    return index;
+}
+
+void cacheInvalidate(int partition)
+{
+    if (cache.entries == NULL)
+        return;
+
+    int index = cache.lruHead;
+    while (index != NO_ENTRY)
+    {
+        int next = cache.entries[index].next;
+        if (cache.entries[index].partition == partition)
+            release(index);
+
+        index = next;
+    }
+}
+
+BYTE *cacheGetSector(DWORD sector)
+{
+    if (cache.entries == NULL)
+        return NULL;
+
+    int index = lookup(cache.partition, sector);
+    if (index != NO_ENTRY)
+    {
+        cache.stats.hits++;
+        touch(index);
+        return cache.entries[index].data;
+    }
+
+    cache.stats.misses++;
+    index = insert(sector);
+    if (read_sector(sector, cache.entries[index].data) != 0)
+    {
+        release(index);
+        return NULL;
+    }
+
+    return cache.entries[index].data;
+}
+
+BYTE *cachePeekSector(DWORD sector)
+{
+    if (cache.entries == NULL)
+        return NULL;
+
+    int index = lookup(cache.partition, sector);
+    if (index == NO_ENTRY)
+        return NULL;
+
+    cache.stats.hits++;
+    touch(index);
+    return cache.entries[index].data;
+}
+
+int cacheReadSector(DWORD sector, BYTE *buffer)
+{
+    return cacheReadSectors(sector, 1, buffer);
+}
+
+int cacheWriteSector(DWORD sector, BYTE *buffer)
+{
+    return cacheWriteSectors(sector, 1, buffer);
+}
+
+int cacheReadSectors(DWORD first, DWORD count, BYTE *buffer)
+{
+    if (cache.entries == NULL)
+        return read_sectors(first, count, buffer);
+
+    DWORD i = 0;
+    while (i < count)
+    {
+        int index = lookup(cache.partition, first + i);
+        if (index != NO_ENTRY)
+        {
+            cache.stats.hits++;
+            touch(index);
+            memcpy(buffer + i * SECTOR_SIZE, cache.entries[index].data, SECTOR_SIZE);
+            i++;
+            continue;
+        }
+
+        // Read the whole run of missing sectors at once
+        DWORD run = 1;
+        while (i + run < count && lookup(cache.partition, first + i + run) == NO_ENTRY)
+            run++;
+
+        if (read_sectors(first + i, run, buffer + i * SECTOR_SIZE) != 0)
+            return -1;
+
+        cache.stats.misses += run;
+        for (DWORD j = i; j < i + run; j++)
+            memcpy(cache.entries[insert(first + j)].data, buffer + j * SECTOR_SIZE, SECTOR_SIZE);
+
+        i += run;
+    }
+
+    return 0;
+}
+
+// Marks the entry as changed, to be written back later
+static void markDirty(int index)
+{
+    if (!cache.entries[index].dirty)
+    {
+        cache.entries[index].dirty = TRUE;
+        cache.stats.dirty++;
+    }
+}
+
+// Writes every dirty sector back once too many of them pile up
+static int checkDirtyRatio()
+{
+    if ((unsigned long)cache.stats.dirty * 100 > (unsigned long)cache.capacity * cache.dirtyRatio)
+        return cacheFlush();
+
+    return 0;
+}
+
+int cacheWriteSectors(DWORD first, DWORD count, BYTE *buffer)
+{
+    if (cache.entries == NULL || cache.mode == CACHE_WRITE_THROUGH)
+    {
+        if (write_sectors(first, count, buffer) != 0)
+            return -1;
+
+        if (cache.entries == NULL)
+            return 0;
+    }
+
+    for (DWORD i = 0; i < count; i++)
+    {
+        int index = lookup(cache.partition, first + i);
+        if (index == NO_ENTRY)
+            index = insert(first + i);
+        else
+            touch(index);
+
+        memcpy(cache.entries[index].data, buffer + i * SECTOR_SIZE, SECTOR_SIZE);
+        if (cache.mode == CACHE_WRITE_BACK)
+            markDirty(index);
+    }
+
+    return cache.mode == CACHE_WRITE_BACK ? checkDirtyRatio() : 0;
+}
+
+int cacheReadBatch(const SECTOR_REQUEST *requests, int quantity)
+{
+    if (cache.entries == NULL || cache.stats.used == 0)
+        return read_sectors_batch(requests, quantity);
+
+    // Sectors the cache holds (for instance read ahead) are copied from it,
+    // and only the runs of sectors it doesn't hold are read from the disk
+    int capacity = quantity, runs = 0;
+    SECTOR_REQUEST *uncached = (SECTOR_REQUEST *)malloc(sizeof(SECTOR_REQUEST) * capacity);
+
+    for (int r = 0; r < quantity; r++)
+        for (DWORD i = 0; i < requests[r].count; i++)
+        {
+            DWORD sector = requests[r].first + i;
+            BYTE *data = requests[r].buffer + i * SECTOR_SIZE;
+
+            int index = lookup(cache.partition, sector);
+            if (index != NO_ENTRY)
+            {
+                cache.stats.hits++;
+                touch(index);
+                memcpy(data, cache.entries[index].data, SECTOR_SIZE);
+            }
+            else if (runs > 0 && uncached[runs - 1].first + uncached[runs - 1].count == sector && uncached[runs - 1].buffer + uncached[runs - 1].count * SECTOR_SIZE == data)
+                uncached[runs - 1].count++;
+            else
+            {
+                if (runs == capacity)
+                {
+                    capacity *= 2;
+                    uncached = (SECTOR_REQUEST *)realloc(uncached, sizeof(SECTOR_REQUEST) * capacity);
+                }
+                uncached[runs++] = (SECTOR_REQUEST){sector, 1, data};
+            }
+        }
+
+    int result = runs > 0 ? read_sectors_batch(uncached, runs) : 0;
+    free(uncached);
+
+    return result;
+}
+
+int cachePrefetch(DWORD first, DWORD count)
+{
+    if (cache.entries == NULL)
+        return 0;
+
+    // Reading ahead must not push everything else out of the cache
+    if (count > cache.capacity / 4)
+        count = cache.capacity / 4;
+
+    BYTE *buffer = NULL;
+    DWORD i = 0;
+    while (i < count)
+    {
+        if (lookup(cache.partition, first + i) != NO_ENTRY)
+        {
+            i++;
+            continue;
+        }
+
+        DWORD run = 1;
+        while (i + run < count && lookup(cache.partition, first + i + run) == NO_ENTRY)
+            run++;
+
+        if (buffer == NULL)
+            buffer = (BYTE *)malloc(SECTOR_SIZE * count);
+        if (read_sectors(first + i, run, buffer) != 0)
+        {
+            free(buffer);
+            return -1;
+        }
+
+        cache.stats.misses += run;
+        for (DWORD j = 0; j < run; j++)
+            memcpy(cache.entries[insert(first + i + j)].data, buffer + j * SECTOR_SIZE, SECTOR_SIZE);
+
+        i += run;
+    }
+
+    free(buffer);
+
+    return 0;
+}
+
+int cacheWriteBatch(const SECTOR_REQUEST *requests, int quantity)
+{
+    if (cache.entries == NULL || cache.stats.used == 0)
+        return write_sectors_batch(requests, quantity);
+
+    if (cache.mode == CACHE_WRITE_THROUGH)
+    {
+        if (write_sectors_batch(requests, quantity) != 0)
+            return -1;
+
+        for (int r = 0; r < quantity; r++)
+            for (DWORD i = 0; i < requests[r].count; i++)
+            {
+                int index = lookup(cache.partition, requests[r].first + i);
+                if (index != NO_ENTRY)
+                    memcpy(cache.entries[index].data, requests[r].buffer + i * SECTOR_SIZE, SECTOR_SIZE);
+            }
+
+        return 0;
+    }
+
+    // Write-back: sectors the cache holds are only dirtied there, and the
+    // runs of sectors it doesn't hold go to the disk
+    int capacity = quantity, runs = 0;
+    SECTOR_REQUEST *uncached = (SECTOR_REQUEST *)malloc(sizeof(SECTOR_REQUEST) * capacity);
+
+    for (int r = 0; r < quantity; r++)
+        for (DWORD i = 0; i < requests[r].count; i++)
+        {
+            DWORD sector = requests[r].first + i;
+            BYTE *data = requests[r].buffer + i * SECTOR_SIZE;
+
+            int index = lookup(cache.partition, sector);
+            if (index != NO_ENTRY)
+            {
+                touch(index);
+                memcpy(cache.entries[index].data, data, SECTOR_SIZE);
+                markDirty(index);
+            }
+            else if (runs > 0 && uncached[runs - 1].first + uncached[runs - 1].count == sector && uncached[runs - 1].buffer + uncached[runs - 1].count * SECTOR_SIZE == data)
+                uncached[runs - 1].count++;
+            else
+            {
+                if (runs == capacity)
+                {
+                    capacity *= 2;
+                    uncached = (SECTOR_REQUEST *)realloc(uncached, sizeof(SECTOR_REQUEST) * capacity);
+                }
+                uncached[runs++] = (SECTOR_REQUEST){sector, 1, data};
+            }
+        }
+
+    int result = runs > 0 ? write_sectors_batch(uncached, runs) : 0;
+    free(uncached);
+
+    if (result != 0)
+        return -1;
+
+    return checkDirtyRatio();
+}
+
+static int compareBySector(const void *a, const void *b)
+{
+    DWORD first = cache.entries[*(const int *)a].sector;
+    DWORD second = cache.entries[*(const int *)b].sector;
+
+    return first < second ? -1 : first > second;
+}
+
+int cacheFlush()
+{
+    if (cache.entries == NULL || cache.stats.dirty == 0)
+        return 0;
+
+    // Gather the dirty entries in sector order
+    int *dirty = (int *)malloc(sizeof(int) * cache.stats.dirty);
+    int quantity = 0;
+    for (int index = cache.lruHead; index != NO_ENTRY; index = cache.entries[index].next)
+        if (cache.entries[index].dirty)
+            dirty[quantity++] = index;
+    qsort(dirty, quantity, sizeof(int), compareBySector);
+
+    // Entries aren't contiguous in memory, so each one is its own request,
+    // but they are submitted all together, in order
+    SECTOR_REQUEST *requests = (SECTOR_REQUEST *)malloc(sizeof(SECTOR_REQUEST) * quantity);
+    for (int i = 0; i < quantity; i++)
+        requests[i] = (SECTOR_REQUEST){cache.entries[dirty[i]].sector, 1, cache.entries[dirty[i]].data};
+
+    int result = write_sectors_batch(requests, quantity);
+    if (result == 0)
+    {
+        for (int i = 0; i < quantity; i++)
+            cache.entries[dirty[i]].dirty = FALSE;
+
+        cache.stats.dirty = 0;
+        cache.stats.writebacks += quantity;
+    }
+    else
+        printf("ERROR: Couldn't write back the cache.\n");
+
+    free(requests);
+    free(dirty);
+
+    return result;
+}
+
+int cacheSetMode(int mode, DWORD dirtyRatio)
+{
+    if ((mode != CACHE_WRITE_THROUGH && mode != CACHE_WRITE_BACK) || dirtyRatio > 100)
+    {
+        printf("ERROR: Invalid cache mode.\n");
+        return -1;
+    }
+
+    cache.mode = mode;
+    cache.dirtyRatio = dirtyRatio;
+
+    // Nothing may stay dirty in write-through mode
+    if (mode == CACHE_WRITE_THROUGH)
+        return cacheFlush();
+
+    return checkDirtyRatio();
+}
+
+int cacheGetMode()
+{
+    return cache.mode;
+}
+
+void cacheGetStats(CACHESTATS2 *stats)
+{
+    if (cache.entries == NULL)
+    {
+        memset(stats, 0, sizeof(*stats));
+        return;
+    }
+
+    *stats = cache.stats;
+}
@@ -8,12 +8,15 @@
 #include "apidisk.h"
 #include "bitmap2.h"
 #include "t2fslib.h"
+#include "t2cache.h"
+#include "t2aio.h"
 
 /*-----------------------------------------------------------------------------
 Função:	Informa a identificação dos desenvolvedores do T2FS.
 -----------------------------------------------------------------------------*/
 int identify2(char *name, int size)
 {
+	LOCK_LIBRARY();
 	initialize();
 
 	BYTE identification[] = "Ana Carolina Pagnoncelli - 00287714\nAugusto Zanella Bardini  - 00278083\nRafael Baldasso Audibert - 00287695";
@@ -33,6 +36,7 @@ Função:	Formata logicamente uma partição do disco virtual t2fs_disk.dat para
 -----------------------------------------------------------------------------*/
 int format2(int partition, int sectors_per_block)
 {
+	LOCK_LIBRARY();
 	initialize();
 
 	// Partition doesn't exist
@@ -62,6 +66,7 @@ Função:	Monta a partição indicada por "partition" no diretório raiz
 -----------------------------------------------------------------------------*/
 int mount(int partition)
 {
+	LOCK_LIBRARY();
 	initialize();
 
 	if (getSuperblock() != NULL)
@@ -76,6 +81,7 @@ int mount(int partition)
 		printf("ERROR: Error while mounting partition.\n");
 		return -1;
 	};
+	aioOpen();
 
 	printf("Mounted partition %d successfuly.\n", partition);
 
@@ -87,12 +93,19 @@ Função:	Desmonta a partição atualmente montada, liberando o ponto de montage
 -----------------------------------------------------------------------------*/
 int umount(void)
 {
+	// New requests are refused, and the ones already submitted are served by this
+	// partition, before the library lock is taken, as they need it to finish
+	aioClose();
+
+	LOCK_LIBRARY();
 	initialize();
 
 	// Free dynamically allocated superblock memory and point it to null
 	if (unmountPartition() != 0)
 	{
 		printf("ERROR: Couldn't unmount partition.\n");
+		if (isPartitionMounted())
+			aioOpen();
 		return -1;
 	}
 
@@ -101,6 +114,101 @@ int umount(void)
 	return 0;
 }
 
+/*-----------------------------------------------------------------------------
+Função:	Grava no disco virtual todas as alterações pendentes.
+-----------------------------------------------------------------------------*/
+int sync2(void)
+{
+	LOCK_LIBRARY();
+	initialize();
+
+	if (!isPartitionMounted())
+		return -1;
+
+	if (syncInodes() != 0 || closeBitmap2() != 0 || cacheFlush() != 0 || sync_disk() != 0)
+	{
+		printf("ERROR: Couldn't sync disk.\n");
+		return -1;
+	}
+
+	return 0;
+}
+
+/*-----------------------------------------------------------------------------
+Função:	Define o tamanho do cache usado nas próximas montagens.
+-----------------------------------------------------------------------------*/
+int cachesize2(int sectors)
+{
+	LOCK_LIBRARY();
+	initialize();
+
+	if (sectors <= 0)
+	{
+		printf("ERROR: The cache must hold at least one sector.\n");
+		return -1;
+	}
+
+	setCacheSize(sectors);
+
+	return 0;
+}
+
+/*-----------------------------------------------------------------------------
+Função:	Define como as escritas passam pelo cache.
+-----------------------------------------------------------------------------*/
+int cachemode2(int mode, int dirty_ratio)
+{
+	LOCK_LIBRARY();
+	initialize();
+
+	if (dirty_ratio < 0)
+	{
+		printf("ERROR: Invalid dirty ratio %d.\n", dirty_ratio);
+		return -1;
+	}
+
+	// Inodes and bitmaps changed in core must not wait for close2 or sync2 anymore
+	if (mode == CACHE_WRITE_THROUGH && isPartitionMounted() && (syncInodes() != 0 || closeBitmap2() != 0))
+		return -1;
+
+	return cacheSetMode(mode, dirty_ratio);
+}
+
+/*-----------------------------------------------------------------------------
+Função:	Define o formato do i-node dos arquivos criados.
+-----------------------------------------------------------------------------*/
+int inodeformat2(int format)
+{
+	LOCK_LIBRARY();
+	initialize();
+
+	if (format != INODE_FORMAT_INDIRECT && format != INODE_FORMAT_EXTENTS)
+	{
+		printf("ERROR: Invalid inode format %d.\n", format);
+		return -1;
+	}
+
+	setInodeFormat(format);
+
+	return 0;
+}
+
+/*-----------------------------------------------------------------------------
+Função:	Informa os contadores do cache da partição montada.
+-----------------------------------------------------------------------------*/
+int cachestats2(CACHESTATS2 *stats)
+{
+	LOCK_LIBRARY();
+	initialize();
+
+	if (!isPartitionMounted())
+		return -1;
+
+	cacheGetStats(stats);
+
+	return 0;
+}
+
 /*-----------------------------------------------------------------------------
 Função:	Função usada para criar um novo arquivo no disco e abrí-lo,
 		sendo, nesse último aspecto, equivalente a função open2.
@@ -111,6 +219,7 @@ Função:	Função usada para criar um novo arquivo no disco e abrí-lo,
 
 FILE2 create2(char *filename)
 {
+	LOCK_LIBRARY();
 
 	initialize();
 
@@ -126,28 +235,25 @@ FILE2 create2(char *filename)
 	// Configure bitmap
 	openBitmap2(getPartition()->firstSector);
 
-	I_NODE *dirInode = getInode(0);
 	RECORD record;
 
 	// Remove old file with same name
-	int filesQuantity = dirInode->bytesFileSize / RECORD_SIZE;
-	for (int i = 0; i < filesQuantity; i++)
+	if (getRecordByName(filename, &record) == 0 && delete2(filename) != 0)
 	{
-		getRecordByNumber(i, &record);
-		if ((strcmp(record.name, filename) == 0) && (record.TypeVal != TYPEVAL_INVALIDO))
-		{
-			if (delete2(filename) != 0)
-			{
-				printf("ERROR: There was an error while trying to override a file with the same name.\n");
-				return -1;
-			};
-			break;
-		}
+		printf("ERROR: There was an error while trying to override a file with the same name.\n");
+		return -1;
 	}
 
 	// Fetch and set bitmaps info
 	int inodeNumber = searchBitmap2(BITMAP_INODE, 0);
 	int blockNum = searchBitmap2(BITMAP_DADOS, 0);
+
+	// The inodes and blocks of the deleted files may still be waiting to be freed
+	if ((inodeNumber == -1 || blockNum == -1) && getSuperblock()->firstOrphan != 0 && reclaimOrphans() == 0)
+	{
+		inodeNumber = searchBitmap2(BITMAP_INODE, 0);
+		blockNum = searchBitmap2(BITMAP_DADOS, 0);
+	}
 	if (inodeNumber == -1)
 	{
 		printf("ERROR: ERROR: There is no space left to create a new inode.\n");
@@ -161,248 +267,46 @@ FILE2 create2(char *filename)
 	setBitmap2(BITMAP_INODE, inodeNumber, 1);
 	setBitmap2(BITMAP_DADOS, blockNum, 1);
 
-	// Copy information to the new record
-	strcpy(record.name, filename);
-	record.TypeVal = TYPEVAL_REGULAR;
-	record.inodeNumber = inodeNumber;
-
-	// Compute where we will save the new record
-	DWORD newRecordBlock = dirInode->bytesFileSize / getBlocksize();
-	DWORD newRecordSector = dirInode->bytesFileSize % getBlocksize() / SECTOR_SIZE;
-	DWORD newRecordSectorOffset = dirInode->bytesFileSize % SECTOR_SIZE;
-
-	// Save it
-	BYTE *record_buffer = getBuffer(sizeof(BYTE) * SECTOR_SIZE);
-	if (readDataBlockSector(newRecordBlock, newRecordSector, dirInode, (BYTE *)record_buffer) != 0)
-	{
-		printf("ERROR: Failed reading record\n");
-		return -1;
-	}
-	memcpy(record_buffer + newRecordSectorOffset, &record, sizeof(RECORD));
-	if (writeDataBlockSector(newRecordBlock, newRecordSector, dirInode, (BYTE *)record_buffer) != 0)
-	{
-		printf("ERROR: Failed writing record\n");
-		return -1;
-	}
-
-	// Compute where we will save the inode
-	int inodeSector = inodeNumber / (SECTOR_SIZE / sizeof(I_NODE));
-	int inodeSectorOffset = (inodeNumber % (SECTOR_SIZE / sizeof(I_NODE))) * sizeof(I_NODE);
-
-	// Create and save inode
-	I_NODE inode = {(DWORD)1, (DWORD)0, {blockNum, (DWORD)0}, (DWORD)0, (DWORD)0, (DWORD)1, (DWORD)0};
-	BYTE *buffer_inode = getBuffer(sizeof(BYTE) * SECTOR_SIZE);
-	if (read_sector(getInodesFirstSector(getPartition(), getSuperblock()) + inodeSector, buffer_inode) != 0)
-	{
-		printf("ERROR: Failed reading record\n");
-		return -1;
-	}
-	memcpy(buffer_inode + inodeSectorOffset, &inode, sizeof(I_NODE));
-	if (write_sector(getInodesFirstSector(getPartition(), getSuperblock()) + inodeSector, buffer_inode) != 0)
+	// Create and save inode, through the inode cache so no stale copy survives.
+	// Every way out, from here on, goes through the end of the function, which
+	// releases the inodes it took.
+	int result = 0;
+	I_NODE *newInode = getInode(inodeNumber);
+	if (getInodeFormat() == INODE_FORMAT_EXTENTS)
+		*newInode = (I_NODE){(DWORD)1, (DWORD)0, {blockNum, (DWORD)1}, INVALID_PTR, (DWORD)1, (DWORD)1, INODE_EXTENTS};
+	else
+		*newInode = (I_NODE){(DWORD)1, (DWORD)0, {blockNum, (DWORD)0}, (DWORD)0, (DWORD)0, (DWORD)1, (DWORD)0};
+	if (writeInode(newInode) != 0)
 	{
-		printf("ERROR: Failed writing record\n");
-		return -1;
+		printf("ERROR: Failed writing inode\n");
+		result = -1;
 	}
+	releaseInode(newInode);
 
-	// We need to update the direntry inode
-	dirInode->bytesFileSize += sizeof(RECORD);
-
-	// Need to create a new block for the directory
-	if (dirInode->bytesFileSize % getBlocksize() == 0)
+	// Then its record, at the end of the directory
+	if (result == 0)
 	{
-		dirInode->blocksFileSize++;
+		strcpy(record.name, filename);
+		record.TypeVal = TYPEVAL_REGULAR;
+		record.inodeNumber = inodeNumber;
 
-		int newBlock = searchBitmap2(BITMAP_DADOS, 0);
-		if (newBlock == -1)
-		{
-			printf("ERROR: There is no space left to create a new directory entry.\n");
-			return -1;
-		}
-		setBitmap2(BITMAP_DADOS, newBlock, 1);
-
-		DWORD direct_quantity = getInodeDirectQuantity();
-		DWORD simple_indirect_quantity = getInodeSimpleIndirectQuantity();
-		// DWORD double_indirect_quantity = getInodeDoubleIndirectQuantity();
-
-		if (dirInode->blocksFileSize == direct_quantity)
-		{
-			// Second block
-			dirInode->dataPtr[1] = newBlock;
-		}
-		else if (dirInode->blocksFileSize == direct_quantity + 1)
-		{
-			// Allocate block for the simple indirection block
-
-			// Find bitmap entry
-			int newSimpleIndirectionBlock = searchBitmap2(BITMAP_DADOS, 0);
-			if (newSimpleIndirectionBlock == -1)
-			{
-				printf("ERROR: There is no space left to create a new directory entry.\n");
-				return -1;
-			}
-			if (setBitmap2(BITMAP_DADOS, newSimpleIndirectionBlock, 1) != 0)
-			{
-				printf("ERROR: There is no space left to create a new directory entry.\n");
-				return -1;
-			}
-			dirInode->singleIndPtr = newSimpleIndirectionBlock;
-
-			BYTE *simple_ind_buffer = getZeroedBuffer(sizeof(BYTE) * SECTOR_SIZE);
-			memcpy(simple_ind_buffer, &newBlock, sizeof(newBlock));
-			if (write_sector(getDataBlocksFirstSector(getPartition(), getSuperblock()) + dirInode->singleIndPtr * getSuperblock()->blockSize, simple_ind_buffer) != 0)
-			{
-				printf("ERROR: There was an error while trying to allocate space for a new directory entry.\n");
-				return -1;
-			}
-		}
-		else if (dirInode->blocksFileSize <= direct_quantity + simple_indirect_quantity)
-		{
-			// Middle single indirection block
-
-			BYTE *simple_ind_buffer = getZeroedBuffer(sizeof(BYTE) * SECTOR_SIZE);
-			if (read_sector(getDataBlocksFirstSector(getPartition(), getSuperblock()) + dirInode->singleIndPtr * getSuperblock()->blockSize, simple_ind_buffer) != 0)
-			{
-				printf("ERROR: There was an error while trying to allocate space for a new directory entry.\n");
-				return -1;
-			}
-			memcpy(simple_ind_buffer + (dirInode->blocksFileSize - direct_quantity - 1) * sizeof(newBlock), &newBlock, sizeof(newBlock));
-			if (write_sector(getDataBlocksFirstSector(getPartition(), getSuperblock()) + dirInode->singleIndPtr * getSuperblock()->blockSize, simple_ind_buffer) != 0)
-			{
-				printf("ERROR: There was an error while trying to allocate space for a new directory entry.\n");
-				return -1;
-			}
-		}
-		else if (dirInode->blocksFileSize == direct_quantity + simple_indirect_quantity + 1)
-		{
-			// Allocate bitmap for doubleIndirectionBlock
-			int newDoubleIndirectionBlock = searchBitmap2(BITMAP_DADOS, 0);
-			if (newDoubleIndirectionBlock == -1)
-			{
-				printf("ERROR: There is no space left to create a new directory entry.\n");
-				return -1;
-			}
-			if (setBitmap2(BITMAP_DADOS, newDoubleIndirectionBlock, 1) != 0)
-			{
-				printf("ERROR: There is no space left to create a new directory entry.\n");
-				return -1;
-			}
-			dirInode->doubleIndPtr = newDoubleIndirectionBlock;
-
-			// Allocate bitmap for simpleIndirectionBlock
-			int newSimpleIndirectionBlock = searchBitmap2(BITMAP_DADOS, 0);
-			if (newSimpleIndirectionBlock == -1)
-			{
-				printf("ERROR: There is no space left to create a new directory entry.\n");
-				return -1;
-			}
-			if (setBitmap2(BITMAP_DADOS, newSimpleIndirectionBlock, 1) != 0)
-			{
-				printf("ERROR: There is no space left to create a new directory entry.\n");
-				return -1;
-			}
-
-			BYTE *double_ind_buffer = getZeroedBuffer(sizeof(BYTE) * SECTOR_SIZE);
-			memcpy(double_ind_buffer, &newSimpleIndirectionBlock, sizeof(newSimpleIndirectionBlock));
-			if (write_sector(getDataBlocksFirstSector(getPartition(), getSuperblock()) + dirInode->doubleIndPtr * getSuperblock()->blockSize, double_ind_buffer) != 0)
-			{
-				printf("ERROR: There was an error while trying to allocate space for a new directory entry.\n");
-				return -1;
-			}
-
-			BYTE *simple_ind_buffer = getZeroedBuffer(sizeof(BYTE) * SECTOR_SIZE);
-			memcpy(simple_ind_buffer, &newBlock, sizeof(newBlock));
-			if (write_sector(getDataBlocksFirstSector(getPartition(), getSuperblock()) + newSimpleIndirectionBlock * getSuperblock()->blockSize, simple_ind_buffer) != 0)
-			{
-				printf("ERROR: There was an error while trying to allocate space for a new directory entry.\n");
-				return -1;
-			}
-		}
-		else if ((dirInode->blocksFileSize - 3) % simple_indirect_quantity == 0)
-		{
-			// Allocate bitmap for simpleIndirectionBlock
-			int newSimpleIndirectionBlock = searchBitmap2(BITMAP_DADOS, 0);
-			if (newSimpleIndirectionBlock == -1)
-			{
-				printf("ERROR: There is no space left to create a new directory entry.\n");
-				return -1;
-			}
-			if (setBitmap2(BITMAP_DADOS, newSimpleIndirectionBlock, 1) != 0)
-			{
-				printf("ERROR: There is no space left to create a new directory entry.\n");
-				return -1;
-			}
-
-			BYTE *double_ind_buffer = getZeroedBuffer(sizeof(BYTE) * SECTOR_SIZE);
-			if (read_sector(getDataBlocksFirstSector(getPartition(), getSuperblock()) + dirInode->doubleIndPtr * getSuperblock()->blockSize, double_ind_buffer) != 0)
-			{
-				printf("ERROR: There was an error while trying to allocate space for a new directory entry.\n");
-				return -1;
-			}
-			memcpy(double_ind_buffer + (dirInode->blocksFileSize - direct_quantity - simple_indirect_quantity - 1) / simple_indirect_quantity * sizeof(newSimpleIndirectionBlock), &newSimpleIndirectionBlock, sizeof(newSimpleIndirectionBlock));
-			if (write_sector(getDataBlocksFirstSector(getPartition(), getSuperblock()) + dirInode->doubleIndPtr * getSuperblock()->blockSize, double_ind_buffer) != 0)
-			{
-				printf("ERROR: There was an error while trying to allocate space for a new directory entry.\n");
-				return -1;
-			}
-
-			BYTE *simple_ind_buffer = getZeroedBuffer(sizeof(BYTE) * SECTOR_SIZE);
-			memcpy(simple_ind_buffer, &newBlock, sizeof(newBlock));
-			if (write_sector(getDataBlocksFirstSector(getPartition(), getSuperblock()) + newSimpleIndirectionBlock * getSuperblock()->blockSize, simple_ind_buffer) != 0)
-			{
-				printf("ERROR: There was an error while trying to allocate space for a new directory entry.\n");
-				return -1;
-			}
-		}
-		else
-		{
-			// Discover where is the simpleIndBlock
-			BYTE *double_ind_buffer = getZeroedBuffer(sizeof(BYTE) * SECTOR_SIZE);
-			if (read_sector(getDataBlocksFirstSector(getPartition(), getSuperblock()) + dirInode->doubleIndPtr * getSuperblock()->blockSize, double_ind_buffer))
-			{
-				printf("ERROR: There was an error while trying to allocate space for a new directory entry.\n");
-				return -1;
-			}
-			DWORD simple_ind_ptr = *((DWORD *)(double_ind_buffer + (dirInode->blocksFileSize - direct_quantity - simple_indirect_quantity - 1) / simple_indirect_quantity * sizeof(DWORD)));
-
-			BYTE *simple_ind_buffer = getZeroedBuffer(sizeof(BYTE) * SECTOR_SIZE);
-			if (read_sector(getDataBlocksFirstSector(getPartition(), getSuperblock()) + simple_ind_ptr, simple_ind_buffer) != 0)
-			{
-				printf("ERROR: There was an error while trying to allocate space for a new directory entry.\n");
-				return -1;
-			}
-			memcpy(simple_ind_buffer + (dirInode->blocksFileSize - direct_quantity - simple_indirect_quantity - 1) % simple_indirect_quantity * sizeof(newBlock), &newBlock, sizeof(newBlock));
-			if (write_sector(getDataBlocksFirstSector(getPartition(), getSuperblock()) + simple_ind_ptr, simple_ind_buffer) != 0)
-			{
-				printf("ERROR: There was an error while trying to allocate space for a new directory entry.\n");
-				return -1;
-			}
-		}
+		I_NODE *dirInode = getInode(0);
+		result = appendRecord(dirInode, &record);
+		releaseInode(dirInode);
 	}
 
-	// Update dir inode
-	BYTE *dir_inode_buffer = getBuffer(sizeof(BYTE) * SECTOR_SIZE);
-	if (read_sector(getInodesFirstSector(getPartition(), getSuperblock()), dir_inode_buffer) != 0)
-	{
-		printf("ERROR: There was an error while trying to create a new directory entry.\n");
-		return -1;
-	}
-	memcpy(dir_inode_buffer, dirInode, sizeof(I_NODE));
-	if (write_sector(getInodesFirstSector(getPartition(), getSuperblock()), dir_inode_buffer) != 0)
+	// Without a record nothing points to the inode and its block
+	if (result != 0)
 	{
-		printf("ERROR: There was an error while trying to create a new directory entry.\n");
-		return -1;
+		setBitmap2(BITMAP_INODE, inodeNumber, 0);
+		setBitmap2(BITMAP_DADOS, blockNum, 0);
 	}
 
-	// Free dynamically allocated memory
-	free(record_buffer);
-	free(buffer_inode);
-	free(dirInode);
-
 	// Remember to close the opened bitmap
 	closeBitmap2();
 
 	// Return a handler to this file
-	return open2(filename);
+	return result == 0 ? open2(filename) : -1;
 }
 
 /*-----------------------------------------------------------------------------
@@ -410,6 +314,7 @@ Função:	Função usada para remover (apagar) um arquivo do disco.
 -----------------------------------------------------------------------------*/
 int delete2(char *filename)
 {
+	LOCK_LIBRARY();
 	initialize();
 
 	if (!isPartitionMounted())
@@ -419,38 +324,29 @@ int delete2(char *filename)
 	openBitmap2(getPartition()->firstSector);
 
 	// Initialize used structures
-	RECORD *record = NULL;
-	I_NODE *dirInode = getInode(0);
-	RECORD *recordAux = (RECORD *)malloc(sizeof(RECORD));
-	DWORD bytesFileSizeUntilRecord = 0;
+	RECORD *record = (RECORD *)malloc(sizeof(RECORD));
 
 	// Search for the record
-	int filesQuantity = dirInode->bytesFileSize / RECORD_SIZE;
-	for (int i = 0; i < filesQuantity; i++)
-	{
-		getRecordByNumber(i, recordAux);
-		if ((strcmp(recordAux->name, filename) == 0) && (recordAux->TypeVal != TYPEVAL_INVALIDO))
-		{
-			record = recordAux;
-			break;
-		}
-
-		bytesFileSizeUntilRecord = RECORD_SIZE + bytesFileSizeUntilRecord;
-	}
+	int recordIndex = getRecordIndexByName(filename, record);
 
 	//Test if the record was found
-	if (record == NULL)
+	if (recordIndex < 0)
 	{
 		printf("ERROR: There is no file with name %s.\n", filename);
+		free(record);
 		return -1;
 	}
 
+	I_NODE *dirInode = getInode(0);
+	DWORD bytesFileSizeUntilRecord = recordIndex * RECORD_SIZE;
+
 	//If there was any handler for this file, close it
 	int handle;
 	while ((handle = getHandleByFilename(filename)) >= 0)
 		closeFile(handle);
 
 	//update the record to invalid
+	BYTE typeVal = record->TypeVal;
 	record->TypeVal = TYPEVAL_INVALIDO;
 
 	// Compute where is the record
@@ -458,59 +354,77 @@ int delete2(char *filename)
 	DWORD recordSector = bytesFileSizeUntilRecord % getBlocksize() / SECTOR_SIZE;
 	DWORD recordSectorOffset = bytesFileSizeUntilRecord % SECTOR_SIZE;
 
-	// Save it
+	// Save it. Every way out, from here on, goes through the end of the function,
+	// which releases both inodes and frees both buffers.
+	int result = 0;
+	I_NODE *inode = NULL;
 	BYTE *record_buffer = getBuffer(sizeof(BYTE) * SECTOR_SIZE);
 	if (readDataBlockSector(recordBlock, recordSector, dirInode, (BYTE *)record_buffer) != 0)
 	{
 		printf("ERROR: Failed reading record\n");
-		return -1;
+		result = -1;
 	}
 
-	memcpy((BYTE *)record_buffer + recordSectorOffset, (BYTE *)record, sizeof(RECORD));
-	if (writeDataBlockSector(recordBlock, recordSector, dirInode, (BYTE *)record_buffer) != 0)
+	if (result == 0)
 	{
-		printf("ERROR: Failed writing record\n");
-		return -1;
+		memcpy((BYTE *)record_buffer + recordSectorOffset, (BYTE *)record, sizeof(RECORD));
+		if (writeDataBlockSector(recordBlock, recordSector, dirInode, (BYTE *)record_buffer) != 0)
+		{
+			printf("ERROR: Failed writing record\n");
+			result = -1;
+		}
 	}
-	//get the inode of the record
-	I_NODE *inode = getInode(record->inodeNumber);
 
-	//updates RefCounter and test if exists any hardlink.
-	inode->RefCounter = inode->RefCounter - 1;
-	if (inode->RefCounter > 0)
+	if (result == 0)
 	{
-		// Compute where the inode is
-		DWORD inodeSector = record->inodeNumber / (SECTOR_SIZE / sizeof(I_NODE));
-		DWORD inodeSectorOffset = (record->inodeNumber % (SECTOR_SIZE / sizeof(I_NODE))) * sizeof(I_NODE);
+		removeDirectoryEntry(filename);
+
+		//get the inode of the record
+		inode = getInode(record->inodeNumber);
+		if (inode == NULL)
+			result = -1;
+	}
 
-		// Update and save inode
-		BYTE *buffer_inode = getBuffer(sizeof(BYTE) * SECTOR_SIZE);
-		if (read_sector(getInodesFirstSector(getPartition(), getSuperblock()) + inodeSector, buffer_inode) != 0)
+	if (result == 0)
+	{
+		//updates RefCounter and test if exists any hardlink.
+		inode->RefCounter = inode->RefCounter - 1;
+		if (inode->RefCounter > 0)
 		{
-			printf("ERROR: Failed reading record\n");
-			return -1;
+			// Update and save inode
+			if (writeInode(inode) != 0)
+			{
+				printf("ERROR: Failed writing inode\n");
+				result = -1;
+			}
 		}
-		memcpy(buffer_inode + inodeSectorOffset, inode, sizeof(I_NODE));
-		if (write_sector(getInodesFirstSector(getPartition(), getSuperblock()) + inodeSector, buffer_inode) != 0)
+		// If there is no link to the file anymore, it becomes an orphan: its blocks,
+		// and then its inode, are freed in the background
+		else if (addOrphan(inode) != 0)
 		{
-			printf("ERROR: Failed writing record\n");
-			return -1;
-		}
+			printf("ERROR: Failed adding the inode to the orphan list\n");
+			result = -1;
 
-		printf("The file was successfuly removed.\n");
-		return 0;
+			// Otherwise nothing would ever free it, so the file gets its name back
+			inode->RefCounter = inode->RefCounter + 1;
+			markInodeDirty(inode);
+			record->TypeVal = typeVal;
+			memcpy((BYTE *)record_buffer + recordSectorOffset, (BYTE *)record, sizeof(RECORD));
+			if (writeDataBlockSector(recordBlock, recordSector, dirInode, (BYTE *)record_buffer) == 0)
+				addDirectoryEntry(recordIndex, record);
+			else
+				printf("ERROR: Failed restoring the record of %s\n", filename);
+		}
 	}
 
-	//If there is no link to the file anymore, clear the pointers
-	clearPointers(inode);
-
-	//Clear the inode bitmap
-	setBitmap2(BITMAP_INODE, record->inodeNumber, 0);
-
 	// Free dynamically allocated memory
 	free(record_buffer);
-	free(dirInode);
-	free(recordAux);
+	releaseInode(inode);
+	releaseInode(dirInode);
+	free(record);
+
+	if (result != 0)
+		return -1;
 
 	// Remember to close the opened bitmap
 	closeBitmap2();
@@ -524,6 +438,7 @@ Função:	Função que abre um arquivo existente no disco.
 -----------------------------------------------------------------------------*/
 FILE2 open2(char *filename)
 {
+	LOCK_LIBRARY();
 	initialize();
 
 	if (!isPartitionMounted())
@@ -555,6 +470,7 @@ FILE2 open2(char *filename)
 			printf("ERROR: Error while trying to open a link to another file.\n");
 			return -1;
 		};
+		releaseInode(link_inode);
 
 		// Close this file
 		close2(handler);
@@ -577,6 +493,7 @@ Função:	Função usada para fechar um arquivo.
 -----------------------------------------------------------------------------*/
 int close2(FILE2 handle)
 {
+	LOCK_LIBRARY();
 	if (!isPartitionMounted())
 		return -1;
 
@@ -589,9 +506,11 @@ Função:	Função usada para realizar a leitura de uma certa quantidade
 -----------------------------------------------------------------------------*/
 int read2(FILE2 handle, char *buffer, int size)
 {
+	LOCK_LIBRARY();
 	initialize();
 
-	if (!isPartitionMounted())
+	// Handles are closed by umount, and forgotten when the partition is formatted
+	if (!isPartitionMounted() || !isFileOpen(handle))
 		return -1;
 
 	int bytesRead = readFile(handle, buffer, size);
@@ -604,15 +523,147 @@ Função:	Função usada para realizar a escrita de uma certa quantidade
 -----------------------------------------------------------------------------*/
 int write2(FILE2 handle, char *buffer, int size)
 {
+	LOCK_LIBRARY();
 	initialize();
 
-	if (!isPartitionMounted())
+	if (!isPartitionMounted() || !isFileOpen(handle))
 		return -1;
 
 	int bytesWritten = writeFile(handle, buffer, size);
 	return bytesWritten;
 }
 
+/*-----------------------------------------------------------------------------
+Função:	Função usada para truncar um arquivo na posição do seu contador.
+-----------------------------------------------------------------------------*/
+int truncate2(FILE2 handle)
+{
+	LOCK_LIBRARY();
+	initialize();
+
+	if (!isPartitionMounted() || !isFileOpen(handle))
+		return -1;
+
+	return truncateFile(handle);
+}
+
+/*-----------------------------------------------------------------------------
+Função:	Função usada para mover o contador de posição de um arquivo.
+-----------------------------------------------------------------------------*/
+int seek2(FILE2 handle, DWORD offset)
+{
+	LOCK_LIBRARY();
+	initialize();
+
+	if (!isPartitionMounted() || !isFileOpen(handle))
+		return -1;
+
+	return seekFile(handle, offset);
+}
+
+/*-----------------------------------------------------------------------------
+Função:	Lê "size" bytes do arquivo a partir do byte "offset", sem usar nem
+		alterar o contador de posição.
+-----------------------------------------------------------------------------*/
+int pread2(FILE2 handle, char *buffer, int size, DWORD offset)
+{
+	LOCK_LIBRARY();
+
+	initialize();
+
+	if (!isPartitionMounted() || !isFileOpen(handle) || size < 0)
+		return -1;
+
+	// Each call has its own position, so no other call can move it
+	DWORD position = offset;
+	return readFileAt(handle, buffer, size, &position);
+}
+
+/*-----------------------------------------------------------------------------
+Função:	Escreve "size" bytes no arquivo a partir do byte "offset", sem usar
+		nem alterar o contador de posição.
+-----------------------------------------------------------------------------*/
+int pwrite2(FILE2 handle, char *buffer, int size, DWORD offset)
+{
+	LOCK_LIBRARY();
+
+	initialize();
+
+	if (!isPartitionMounted() || !isFileOpen(handle) || size < 0)
+		return -1;
+
+	DWORD position = offset;
+	return writeFileAt(handle, buffer, size, &position);
+}
+
+/*-----------------------------------------------------------------------------
+Função:	Lê do arquivo, a partir do contador de posição, os bytes de vários
+		buffers de uma só vez.
+-----------------------------------------------------------------------------*/
+int readv2(FILE2 handle, IOVEC2 *vector, int count)
+{
+	LOCK_LIBRARY();
+	initialize();
+
+	if (!isPartitionMounted() || !isFileOpen(handle) || vector == NULL || count < 0)
+		return -1;
+
+	return readFileVector(handle, vector, count);
+}
+
+/*-----------------------------------------------------------------------------
+Função:	Escreve no arquivo, a partir do contador de posição, os bytes de vários
+		buffers de uma só vez.
+-----------------------------------------------------------------------------*/
+int writev2(FILE2 handle, IOVEC2 *vector, int count)
+{
+	LOCK_LIBRARY();
+	initialize();
+
+	if (!isPartitionMounted() || !isFileOpen(handle) || vector == NULL || count < 0)
+		return -1;
+
+	return writeFileVector(handle, vector, count);
+}
+
+/*-----------------------------------------------------------------------------
+Função:	Envia pedidos de leitura e escrita para as threads de I/O.
+-----------------------------------------------------------------------------*/
+int submit2(AIOREQ2 *requests, int count)
+{
+	// The library lock isn't taken, so that submitting never waits for the requests
+	// being served. The queues have a lock of their own, which umount also uses to
+	// refuse new requests. Each request checks its file when it runs.
+	if (requests == NULL || count < 0)
+		return -1;
+
+	return aioSubmit(requests, count);
+}
+
+/*-----------------------------------------------------------------------------
+Função:	Recebe os resultados dos pedidos terminados.
+-----------------------------------------------------------------------------*/
+int reap2(AIOEVENT2 *events, int min, int max)
+{
+	// The library lock isn't taken, as the requests need it to finish. The queues
+	// are guarded by their own lock.
+	if (events == NULL || min < 0 || max < 0)
+		return -1;
+
+	return aioReap(events, min, max);
+}
+
+/*-----------------------------------------------------------------------------
+Função:	Informa o eventfd dos pedidos terminados.
+-----------------------------------------------------------------------------*/
+int aiofd2(void)
+{
+	LOCK_LIBRARY();
+	initialize();
+
+	return aioGetEventFd();
+}
+
 /*-----------------------------------------------------------------------------
 Função:	Função que abre um diretório existente no disco.
 -----------------------------------------------------------------------------*/
@@ -621,6 +672,7 @@ Função:	Função que abre um diretório existente no disco.
 
 int opendir2(void)
 {
+	LOCK_LIBRARY();
 	initialize();
 
 	if (!isPartitionMounted())
@@ -636,12 +688,16 @@ Função:	Função usada para ler as entradas de um diretório.
 -----------------------------------------------------------------------------*/
 int readdir2(DIRENT2 *dentry)
 {
+	LOCK_LIBRARY();
 	initialize();
 	if (!isPartitionMounted() || !isRootOpened())
 		return -1;
 
 	// Check if we already finished reading the entries
-	if (finishedEntries(getInode(0)))
+	I_NODE *dirInode = getInode(0);
+	BOOL finished = finishedEntries(dirInode);
+	releaseInode(dirInode);
+	if (finished)
 		return -1;
 
 	// Try to read the record
@@ -662,7 +718,9 @@ int readdir2(DIRENT2 *dentry)
 	// Copy the record information to the `DIRENT2` structure
 	memcpy(dentry->name, record.name, sizeof(BYTE) * 51);
 	dentry->fileType = record.TypeVal;
-	dentry->fileSize = getInode(record.inodeNumber)->bytesFileSize;
+	I_NODE *inode = getInode(record.inodeNumber);
+	dentry->fileSize = inode->bytesFileSize;
+	releaseInode(inode);
 
 	return 0;
 }
@@ -672,6 +730,7 @@ Função:	Função usada para fechar um diretório.
 -----------------------------------------------------------------------------*/
 int closedir2(void)
 {
+	LOCK_LIBRARY();
 	initialize();
 
 	if (!isPartitionMounted())
@@ -687,6 +746,7 @@ Função:	Função usada para criar um caminho alternativo (softlink)
 -----------------------------------------------------------------------------*/
 int sln2(char *linkname, char *filename)
 {
+	LOCK_LIBRARY();
 	initialize();
 
 	if (!isPartitionMounted())
@@ -701,24 +761,25 @@ int sln2(char *linkname, char *filename)
 	// Configure bitmap
 	openBitmap2(getPartition()->firstSector);
 
-	I_NODE *dirInode = getInode(0);
 	RECORD record;
 
-	// Remove old file with same name
-	int filesQuantity = dirInode->bytesFileSize / RECORD_SIZE;
-	for (int i = 0; i < filesQuantity; i++)
+	// Cancel operation if link has same name as other file
+	if (getRecordByName(linkname, &record) == 0)
 	{
-		getRecordByNumber(i, &record);
-		if (strcmp(record.name, linkname) == 0)
-		{
-			printf("ERROR: There is a file with the same name of the link.\n");
-			return -1;
-		}
+		printf("ERROR: There is a file with the same name of the link.\n");
+		return -1;
 	}
 
 	// Fetch and set bitmaps info
 	int inodeNumber = searchBitmap2(BITMAP_INODE, 0);
 	int blockNum = searchBitmap2(BITMAP_DADOS, 0);
+
+	// The inodes and blocks of the deleted files may still be waiting to be freed
+	if ((inodeNumber == -1 || blockNum == -1) && getSuperblock()->firstOrphan != 0 && reclaimOrphans() == 0)
+	{
+		inodeNumber = searchBitmap2(BITMAP_INODE, 0);
+		blockNum = searchBitmap2(BITMAP_DADOS, 0);
+	}
 	if (inodeNumber == -1)
 	{
 		printf("ERROR: There is no space left to create a new inode.\n");
@@ -732,265 +793,49 @@ int sln2(char *linkname, char *filename)
 	setBitmap2(BITMAP_INODE, inodeNumber, 1);
 	setBitmap2(BITMAP_DADOS, blockNum, 1);
 
-	// Copy information to the new record
-	strcpy(record.name, linkname);
-	record.TypeVal = TYPEVAL_LINK;
-	record.inodeNumber = inodeNumber;
-
-	// Compute where we will save the new record
-	DWORD newRecordBlock = dirInode->bytesFileSize / getBlocksize();
-	DWORD newRecordSector = dirInode->bytesFileSize % getBlocksize() / SECTOR_SIZE;
-	DWORD newRecordSectorOffset = dirInode->bytesFileSize % SECTOR_SIZE;
+	// Create and save inode, through the inode cache so no stale copy survives.
+	// Every way out, from here on, goes through the end of the function, which
+	// releases the inodes it took and frees the buffer.
+	int result = 0;
+	I_NODE *newInode = getInode(inodeNumber);
+	*newInode = (I_NODE){(DWORD)1, (DWORD)strlen(filename) + 1, {blockNum, (DWORD)0}, (DWORD)0, (DWORD)0, (DWORD)1, (DWORD)0};
 
-	// Save it
-	BYTE *record_buffer = getZeroedBuffer(sizeof(BYTE) * SECTOR_SIZE);
-
-	if (readDataBlockSector(newRecordBlock, newRecordSector, dirInode, (BYTE *)record_buffer) != 0)
-	{
-		printf("ERROR: Failed reading record\n");
-		return -1;
-	}
-	memcpy(record_buffer + newRecordSectorOffset, &record, sizeof(RECORD));
-	if (writeDataBlockSector(newRecordBlock, newRecordSector, dirInode, (BYTE *)record_buffer) != 0)
-	{
-		printf("ERROR: Failed writing record\n");
-		return -1;
-	}
-
-	// Compute where we will save the inode
-	int inodeSector = inodeNumber / (SECTOR_SIZE / sizeof(I_NODE));
-	int inodeSectorOffset = (inodeNumber % (SECTOR_SIZE / sizeof(I_NODE))) * sizeof(I_NODE);
+	//Copia o nome do arquivo para o buffer de escrita
+	BYTE *data_buffer = getZeroedBuffer(sizeof(BYTE) * SECTOR_SIZE);
+	memcpy(data_buffer, (BYTE *)filename, strlen(filename));
 
-	// Create and save inode
-	I_NODE inode = {(DWORD)1, (DWORD)strlen(filename) + 1, {blockNum, (DWORD)0}, (DWORD)0, (DWORD)0, (DWORD)1, (DWORD)0};
-	BYTE *buffer_inode = getBuffer(sizeof(BYTE) * SECTOR_SIZE);
-	if (read_sector(getInodesFirstSector(getPartition(), getSuperblock()) + inodeSector, buffer_inode) != 0)
-	{
-		printf("ERROR: Failed reading record\n");
-		return -1;
-	}
-	memcpy(buffer_inode + inodeSectorOffset, &inode, sizeof(I_NODE));
-	if (write_sector(getInodesFirstSector(getPartition(), getSuperblock()) + inodeSector, buffer_inode) != 0)
+	//Writes in the first block/sector of the file.
+	if (writeInode(newInode) != 0 || writeDataBlockSector(0, 0, newInode, (BYTE *)data_buffer) != 0)
 	{
-		printf("ERROR: Failed writing record\n");
-		return -1;
+		printf("ERROR: Failed writing the link\n");
+		result = -1;
 	}
+	free(data_buffer);
+	releaseInode(newInode);
 
-	// We need to update the direntry inode
-	dirInode->bytesFileSize += sizeof(RECORD);
-
-	// Need to create a new block for the directory
-	if (dirInode->bytesFileSize % getBlocksize() == 0)
+	// Then its record, at the end of the directory
+	if (result == 0)
 	{
-		// Increase blocksFileSize
-		dirInode->blocksFileSize++;
-
-		int newBlock = searchBitmap2(BITMAP_DADOS, 0);
-		if (newBlock == -1)
-		{
-			printf("ERROR: There is no space left to create a new directory entry.\n");
-			return -1;
-		}
-		setBitmap2(BITMAP_DADOS, newBlock, 1);
-
-		DWORD direct_quantity = getInodeDirectQuantity();
-		DWORD simple_indirect_quantity = getInodeSimpleIndirectQuantity();
-		// DWORD double_indirect_quantity = getInodeDoubleIndirectQuantity();
-
-		if (dirInode->blocksFileSize == direct_quantity)
-		{
-			// Second block
-			dirInode->dataPtr[1] = newBlock;
-		}
-		else if (dirInode->blocksFileSize == direct_quantity + 1)
-		{
-			// Allocate block for the simple indirection block
-
-			// Find bitmap entry
-			int newSimpleIndirectionBlock = searchBitmap2(BITMAP_DADOS, 0);
-			if (newSimpleIndirectionBlock == -1)
-			{
-				printf("ERROR: There is no space left to create a new directory entry.\n");
-				return -1;
-			}
-			if (setBitmap2(BITMAP_DADOS, newSimpleIndirectionBlock, 1) != 0)
-			{
-				printf("ERROR: There is no space left to create a new directory entry.\n");
-				return -1;
-			}
-			dirInode->singleIndPtr = newSimpleIndirectionBlock;
-
-			BYTE *simple_ind_buffer = getZeroedBuffer(sizeof(BYTE) * SECTOR_SIZE);
-
-			memcpy(simple_ind_buffer, &newBlock, sizeof(newBlock));
-			if (write_sector(getDataBlocksFirstSector(getPartition(), getSuperblock()) + dirInode->singleIndPtr * getSuperblock()->blockSize, simple_ind_buffer) != 0)
-			{
-				printf("ERROR: There was an error while trying to allocate space for a new directory entry.\n");
-				return -1;
-			}
-		}
-		else if (dirInode->blocksFileSize <= direct_quantity + simple_indirect_quantity)
-		{
-			// Middle single indirection block
+		strcpy(record.name, linkname);
+		record.TypeVal = TYPEVAL_LINK;
+		record.inodeNumber = inodeNumber;
 
-			BYTE *simple_ind_buffer = getZeroedBuffer(sizeof(BYTE) * SECTOR_SIZE);
-			if (read_sector(getDataBlocksFirstSector(getPartition(), getSuperblock()) + dirInode->singleIndPtr * getSuperblock()->blockSize, simple_ind_buffer) != 0)
-			{
-				printf("ERROR: There was an error while trying to allocate space for a new directory entry.\n");
-				return -1;
-			}
-			memcpy(simple_ind_buffer + (dirInode->blocksFileSize - direct_quantity - 1) * sizeof(newBlock), &newBlock, sizeof(newBlock));
-			if (write_sector(getDataBlocksFirstSector(getPartition(), getSuperblock()) + dirInode->singleIndPtr * getSuperblock()->blockSize, simple_ind_buffer) != 0)
-			{
-				printf("ERROR: There was an error while trying to allocate space for a new directory entry.\n");
-				return -1;
-			}
-		}
-		else if (dirInode->blocksFileSize == direct_quantity + simple_indirect_quantity + 1)
-		{
-			// Allocate bitmap for doubleIndirectionBlock
-			int newDoubleIndirectionBlock = searchBitmap2(BITMAP_DADOS, 0);
-			if (newDoubleIndirectionBlock == -1)
-			{
-				printf("ERROR: There is no space left to create a new directory entry.\n");
-				return -1;
-			}
-			if (setBitmap2(BITMAP_DADOS, newDoubleIndirectionBlock, 1) != 0)
-			{
-				printf("ERROR: There is no space left to create a new directory entry.\n");
-				return -1;
-			}
-			dirInode->doubleIndPtr = newDoubleIndirectionBlock;
-
-			// Allocate bitmap for simpleIndirectionBlock
-			int newSimpleIndirectionBlock = searchBitmap2(BITMAP_DADOS, 0);
-			if (newSimpleIndirectionBlock == -1)
-			{
-				printf("ERROR: There is no space left to create a new directory entry.\n");
-				return -1;
-			}
-			if (setBitmap2(BITMAP_DADOS, newSimpleIndirectionBlock, 1) != 0)
-			{
-				printf("ERROR: There is no space left to create a new directory entry.\n");
-				return -1;
-			}
-
-			BYTE *double_ind_buffer = getZeroedBuffer(sizeof(BYTE) * SECTOR_SIZE);
-			memcpy(double_ind_buffer, &newSimpleIndirectionBlock, sizeof(newSimpleIndirectionBlock));
-			if (write_sector(getDataBlocksFirstSector(getPartition(), getSuperblock()) + dirInode->doubleIndPtr * getSuperblock()->blockSize, double_ind_buffer) != 0)
-			{
-				printf("ERROR: There was an error while trying to allocate space for a new directory entry.\n");
-				return -1;
-			}
-
-			BYTE *simple_ind_buffer = getZeroedBuffer(sizeof(BYTE) * SECTOR_SIZE);
-			memcpy(simple_ind_buffer, &newBlock, sizeof(newBlock));
-			if (write_sector(getDataBlocksFirstSector(getPartition(), getSuperblock()) + newSimpleIndirectionBlock * getSuperblock()->blockSize, simple_ind_buffer) != 0)
-			{
-				printf("ERROR: There was an error while trying to allocate space for a new directory entry.\n");
-				return -1;
-			}
-		}
-		else if ((dirInode->blocksFileSize - 3) % simple_indirect_quantity == 0)
-		{
-			// Allocate bitmap for simpleIndirectionBlock
-			int newSimpleIndirectionBlock = searchBitmap2(BITMAP_DADOS, 0);
-			if (newSimpleIndirectionBlock == -1)
-			{
-				printf("ERROR: There is no space left to create a new directory entry.\n");
-				return -1;
-			}
-			if (setBitmap2(BITMAP_DADOS, newSimpleIndirectionBlock, 1) != 0)
-			{
-				printf("ERROR: There is no space left to create a new directory entry.\n");
-				return -1;
-			}
-
-			BYTE *double_ind_buffer = getZeroedBuffer(sizeof(BYTE) * SECTOR_SIZE);
-			if (read_sector(getDataBlocksFirstSector(getPartition(), getSuperblock()) + dirInode->doubleIndPtr * getSuperblock()->blockSize, double_ind_buffer) != 0)
-			{
-				printf("ERROR: There was an error while trying to allocate space for a new directory entry.\n");
-				return -1;
-			}
-			memcpy(double_ind_buffer + (dirInode->blocksFileSize - direct_quantity - simple_indirect_quantity - 1) / simple_indirect_quantity * sizeof(newSimpleIndirectionBlock), &newSimpleIndirectionBlock, sizeof(newSimpleIndirectionBlock));
-			if (write_sector(getDataBlocksFirstSector(getPartition(), getSuperblock()) + dirInode->doubleIndPtr * getSuperblock()->blockSize, double_ind_buffer) != 0)
-			{
-				printf("ERROR: There was an error while trying to allocate space for a new directory entry.\n");
-				return -1;
-			}
-
-			BYTE *simple_ind_buffer = getZeroedBuffer(sizeof(BYTE) * SECTOR_SIZE);
-			memcpy(simple_ind_buffer, &newBlock, sizeof(newBlock));
-			if (write_sector(getDataBlocksFirstSector(getPartition(), getSuperblock()) + newSimpleIndirectionBlock * getSuperblock()->blockSize, simple_ind_buffer) != 0)
-			{
-				printf("ERROR: There was an error while trying to allocate space for a new directory entry.\n");
-				return -1;
-			}
-		}
-		else
-		{
-			// Discover where is the simpleIndBlock
-			BYTE *double_ind_buffer = getZeroedBuffer(sizeof(BYTE) * SECTOR_SIZE);
-			if (read_sector(getDataBlocksFirstSector(getPartition(), getSuperblock()) + dirInode->doubleIndPtr * getSuperblock()->blockSize, double_ind_buffer))
-			{
-				printf("ERROR: There was an error while trying to allocate space for a new directory entry.\n");
-				return -1;
-			}
-			DWORD simple_ind_ptr = *((DWORD *)(double_ind_buffer + (dirInode->blocksFileSize - direct_quantity - simple_indirect_quantity - 1) / simple_indirect_quantity * sizeof(DWORD)));
-
-			BYTE *simple_ind_buffer = getZeroedBuffer(sizeof(BYTE) * SECTOR_SIZE);
-			if (read_sector(getDataBlocksFirstSector(getPartition(), getSuperblock()) + simple_ind_ptr, simple_ind_buffer) != 0)
-			{
-				printf("ERROR: There was an error while trying to allocate space for a new directory entry.\n");
-				return -1;
-			}
-			memcpy(simple_ind_buffer + (dirInode->blocksFileSize - direct_quantity - simple_indirect_quantity - 1) % simple_indirect_quantity * sizeof(newBlock), &newBlock, sizeof(newBlock));
-			if (write_sector(getDataBlocksFirstSector(getPartition(), getSuperblock()) + simple_ind_ptr, simple_ind_buffer) != 0)
-			{
-				printf("ERROR: There was an error while trying to allocate space for a new directory entry.\n");
-				return -1;
-			}
-		}
+		I_NODE *dirInode = getInode(0);
+		result = appendRecord(dirInode, &record);
+		releaseInode(dirInode);
 	}
 
-	BYTE *dir_inode_buffer = getBuffer(sizeof(BYTE) * SECTOR_SIZE);
-	if (read_sector(getInodesFirstSector(getPartition(), getSuperblock()), dir_inode_buffer) != 0)
+	// Without a record nothing points to the inode and its block
+	if (result != 0)
 	{
-		printf("ERROR: There was an error while trying to create a new directory entry.\n");
-		return -1;
+		setBitmap2(BITMAP_INODE, inodeNumber, 0);
+		setBitmap2(BITMAP_DADOS, blockNum, 0);
 	}
-	memcpy(dir_inode_buffer, dirInode, sizeof(I_NODE));
-	if (write_sector(getInodesFirstSector(getPartition(), getSuperblock()), dir_inode_buffer) != 0)
-	{
-		printf("ERROR: There was an error while trying to create a new directory entry.\n");
-		return -1;
-	}
-
-	//Encontra o inode:
-	I_NODE *fileInode = getInode(inodeNumber);
-
-	//Copia o nome do arquivo para o buffer de escrita
-	BYTE *data_buffer = getZeroedBuffer(sizeof(BYTE) * SECTOR_SIZE);
-	memcpy(data_buffer, (BYTE *)filename, strlen(filename));
-
-	//Writes in the first block/sector of the file.
-	if (writeDataBlockSector(0, 0, fileInode, (BYTE *)data_buffer) != 0)
-	{
-		printf("ERROR: Failed writing record\n");
-		return -1;
-	}
-
-	// Free dynamically allocated memory
-	free(record_buffer);
-	free(data_buffer);
-	free(buffer_inode);
-	free(dirInode);
 
 	// Remember to close the opened bitmap
 	closeBitmap2();
 
-	// Return a handler to this file
-	return 0;
+	return result;
 }
 
 /*-----------------------------------------------------------------------------
@@ -998,6 +843,7 @@ Função:	Função usada para criar um caminho alternativo (hardlink)
 -----------------------------------------------------------------------------*/
 int hln2(char *linkname, char *filename)
 {
+	LOCK_LIBRARY();
 	initialize();
 
 	opendir2();
@@ -1014,275 +860,55 @@ int hln2(char *linkname, char *filename)
 	// Configure bitmap
 	openBitmap2(getPartition()->firstSector);
 
-	I_NODE *dirInode = getInode(0);
 	RECORD record, hardLinkRecord;
 
 	// Cancel operatino if link has same name as other file
-	int filesQuantity = dirInode->bytesFileSize / RECORD_SIZE;
-	for (int i = 0; i < filesQuantity; i++)
+	if (getRecordByName(linkname, &record) == 0)
 	{
-		getRecordByNumber(i, &record);
-		if (strcmp(record.name, linkname) == 0 && record.TypeVal != TYPEVAL_INVALIDO)
-		{
-			printf("ERROR: Trying to create hard link with same name as other file.\n");
-			return -1;
-		}
+		printf("ERROR: Trying to create hard link with same name as other file.\n");
+		return -1;
 	}
 
-	for (int i = 0; i < filesQuantity; i++)
-	{
-		getRecordByNumber(i, &record);
-
-		//If found a file with the given name
-		if (strcmp(record.name, filename) == 0 && record.TypeVal != TYPEVAL_INVALIDO)
-		{
-
-			// Copy information from file Record to hardLinkRecord
-			memcpy(&hardLinkRecord, &record, sizeof(record));
-			strcpy(hardLinkRecord.name, linkname);
-
-			//Get file Inode and increment 1 in the reference counter)
-			DWORD inodeNumber = hardLinkRecord.inodeNumber;
-			I_NODE *inode = getInode(inodeNumber);
-			inode->RefCounter = inode->RefCounter + 1;
-
-			// Compute where we will save the new record
-			DWORD newRecordBlock = dirInode->bytesFileSize / getBlocksize();
-			DWORD newRecordSector = dirInode->bytesFileSize % getBlocksize() / SECTOR_SIZE;
-			DWORD newRecordSectorOffset = dirInode->bytesFileSize % SECTOR_SIZE;
-
-			// Save it
-			BYTE *record_buffer = getBuffer(sizeof(BYTE) * SECTOR_SIZE);
-			if (readDataBlockSector(newRecordBlock, newRecordSector, dirInode, (BYTE *)record_buffer) != 0)
-			{
-				printf("ERROR: Failed reading record\n");
-				return -1;
-			}
-			memcpy(record_buffer + newRecordSectorOffset, &hardLinkRecord, sizeof(RECORD));
-			if (writeDataBlockSector(newRecordBlock, newRecordSector, dirInode, (BYTE *)record_buffer) != 0)
-			{
-				printf("ERROR: Failed writing record\n");
-				return -1;
-			}
-
-			// Compute where we will save the inode
-			DWORD inodeSector = inodeNumber / (SECTOR_SIZE / sizeof(I_NODE));
-			DWORD inodeSectorOffset = (inodeNumber % (SECTOR_SIZE / sizeof(I_NODE))) * sizeof(I_NODE);
-
-			// Save it
-			BYTE *buffer_inode = getBuffer(sizeof(BYTE) * SECTOR_SIZE);
-			if (read_sector(getInodesFirstSector(getPartition(), getSuperblock()) + inodeSector, buffer_inode) != 0)
-			{
-				printf("ERROR: Failed reading record\n");
-				return -1;
-			}
-
-			memcpy(buffer_inode + inodeSectorOffset, inode, sizeof(I_NODE));
-			if (write_sector(getInodesFirstSector(getPartition(), getSuperblock()) + inodeSector, buffer_inode) != 0)
-			{
-				printf("ERROR: Failed writing record\n");
-				return -1;
-			}
-
-			// We need to update the direntry inode
-			dirInode->bytesFileSize += sizeof(RECORD);
+	// The file must exist
+	if (getRecordByName(filename, &record) != 0)
+		return -1;
 
-			// Need to create a new block for the directory
-			if (dirInode->bytesFileSize % getBlocksize() == 0)
-			{
-				dirInode->blocksFileSize++;
-
-				int newBlock = searchBitmap2(BITMAP_DADOS, 0);
-				if (newBlock == -1)
-				{
-					printf("ERROR: There is no space left to create a new directory entry.\n");
-					return -1;
-				}
-				setBitmap2(BITMAP_DADOS, newBlock, 1);
-
-				DWORD direct_quantity = getInodeDirectQuantity();
-				DWORD simple_indirect_quantity = getInodeSimpleIndirectQuantity();
-				// DWORD double_indirect_quantity = getInodeDoubleIndirectQuantity();
-
-				if (dirInode->blocksFileSize == direct_quantity)
-				{
-					// Second block
-					dirInode->dataPtr[1] = newBlock;
-				}
-				else if (dirInode->blocksFileSize == direct_quantity + 1)
-				{
-					// Allocate block for the simple indirection block
-
-					// Find bitmap entry
-					int newSimpleIndirectionBlock = searchBitmap2(BITMAP_DADOS, 0);
-					if (newSimpleIndirectionBlock == -1)
-					{
-						printf("ERROR: There is no space left to create a new directory entry.\n");
-						return -1;
-					}
-					if (setBitmap2(BITMAP_DADOS, newSimpleIndirectionBlock, 1) != 0)
-					{
-						printf("ERROR: There is no space left to create a new directory entry.\n");
-						return -1;
-					}
-					dirInode->singleIndPtr = newSimpleIndirectionBlock;
-
-					BYTE *simple_ind_buffer = getZeroedBuffer(sizeof(BYTE) * SECTOR_SIZE);
-					memcpy(simple_ind_buffer, &newBlock, sizeof(newBlock));
-					if (write_sector(getDataBlocksFirstSector(getPartition(), getSuperblock()) + dirInode->singleIndPtr * getSuperblock()->blockSize, simple_ind_buffer) != 0)
-					{
-						printf("ERROR: There was an error while trying to allocate space for a new directory entry.\n");
-						return -1;
-					}
-				}
-				else if (dirInode->blocksFileSize <= direct_quantity + simple_indirect_quantity)
-				{
-					// Middle single indirection block
-
-					BYTE *simple_ind_buffer = getZeroedBuffer(sizeof(BYTE) * SECTOR_SIZE);
-					if (read_sector(getDataBlocksFirstSector(getPartition(), getSuperblock()) + dirInode->singleIndPtr * getSuperblock()->blockSize, simple_ind_buffer) != 0)
-					{
-						printf("ERROR: There was an error while trying to allocate space for a new directory entry.\n");
-						return -1;
-					}
-					memcpy(simple_ind_buffer + (dirInode->blocksFileSize - direct_quantity - 1) * sizeof(newBlock), &newBlock, sizeof(newBlock));
-					if (write_sector(getDataBlocksFirstSector(getPartition(), getSuperblock()) + dirInode->singleIndPtr * getSuperblock()->blockSize, simple_ind_buffer) != 0)
-					{
-						printf("ERROR: There was an error while trying to allocate space for a new directory entry.\n");
-						return -1;
-					}
-				}
-				else if (dirInode->blocksFileSize == direct_quantity + simple_indirect_quantity + 1)
-				{
-					// Allocate bitmap for doubleIndirectionBlock
-					int newDoubleIndirectionBlock = searchBitmap2(BITMAP_DADOS, 0);
-					if (newDoubleIndirectionBlock == -1)
-					{
-						printf("ERROR: There is no space left to create a new directory entry.\n");
-						return -1;
-					}
-					if (setBitmap2(BITMAP_DADOS, newDoubleIndirectionBlock, 1) != 0)
-					{
-						printf("ERROR: There is no space left to create a new directory entry.\n");
-						return -1;
-					}
-					dirInode->doubleIndPtr = newDoubleIndirectionBlock;
-
-					// Allocate bitmap for simpleIndirectionBlock
-					int newSimpleIndirectionBlock = searchBitmap2(BITMAP_DADOS, 0);
-					if (newSimpleIndirectionBlock == -1)
-					{
-						printf("ERROR: There is no space left to create a new directory entry.\n");
-						return -1;
-					}
-					if (setBitmap2(BITMAP_DADOS, newSimpleIndirectionBlock, 1) != 0)
-					{
-						printf("ERROR: There is no space left to create a new directory entry.\n");
-						return -1;
-					}
-
-					BYTE *double_ind_buffer = getZeroedBuffer(sizeof(BYTE) * SECTOR_SIZE);
-					memcpy(double_ind_buffer, &newSimpleIndirectionBlock, sizeof(newSimpleIndirectionBlock));
-					if (write_sector(getDataBlocksFirstSector(getPartition(), getSuperblock()) + dirInode->doubleIndPtr * getSuperblock()->blockSize, double_ind_buffer) != 0)
-					{
-						printf("ERROR: There was an error while trying to allocate space for a new directory entry.\n");
-						return -1;
-					}
-
-					BYTE *simple_ind_buffer = getZeroedBuffer(sizeof(BYTE) * SECTOR_SIZE);
-					memcpy(simple_ind_buffer, &newBlock, sizeof(newBlock));
-					if (write_sector(getDataBlocksFirstSector(getPartition(), getSuperblock()) + newSimpleIndirectionBlock * getSuperblock()->blockSize, simple_ind_buffer) != 0)
-					{
-						printf("ERROR: There was an error while trying to allocate space for a new directory entry.\n");
-						return -1;
-					}
-				}
-				else if ((dirInode->blocksFileSize - 3) % simple_indirect_quantity == 0)
-				{
-					// Allocate bitmap for simpleIndirectionBlock
-					int newSimpleIndirectionBlock = searchBitmap2(BITMAP_DADOS, 0);
-					if (newSimpleIndirectionBlock == -1)
-					{
-						printf("ERROR: There is no space left to create a new directory entry.\n");
-						return -1;
-					}
-					if (setBitmap2(BITMAP_DADOS, newSimpleIndirectionBlock, 1) != 0)
-					{
-						printf("ERROR: There is no space left to create a new directory entry.\n");
-						return -1;
-					}
-
-					BYTE *double_ind_buffer = getZeroedBuffer(sizeof(BYTE) * SECTOR_SIZE);
-					if (read_sector(getDataBlocksFirstSector(getPartition(), getSuperblock()) + dirInode->doubleIndPtr * getSuperblock()->blockSize, double_ind_buffer) != 0)
-					{
-						printf("ERROR: There was an error while trying to allocate space for a new directory entry.\n");
-						return -1;
-					}
-					memcpy(double_ind_buffer + (dirInode->blocksFileSize - direct_quantity - simple_indirect_quantity - 1) / simple_indirect_quantity * sizeof(newSimpleIndirectionBlock), &newSimpleIndirectionBlock, sizeof(newSimpleIndirectionBlock));
-					if (write_sector(getDataBlocksFirstSector(getPartition(), getSuperblock()) + dirInode->doubleIndPtr * getSuperblock()->blockSize, double_ind_buffer) != 0)
-					{
-						printf("ERROR: There was an error while trying to allocate space for a new directory entry.\n");
-						return -1;
-					}
-
-					BYTE *simple_ind_buffer = getZeroedBuffer(sizeof(BYTE) * SECTOR_SIZE);
-					memcpy(simple_ind_buffer, &newBlock, sizeof(newBlock));
-					if (write_sector(getDataBlocksFirstSector(getPartition(), getSuperblock()) + newSimpleIndirectionBlock * getSuperblock()->blockSize, simple_ind_buffer) != 0)
-					{
-						printf("ERROR: There was an error while trying to allocate space for a new directory entry.\n");
-						return -1;
-					}
-				}
-				else
-				{
-					// Discover where is the simpleIndBlock
-					BYTE *double_ind_buffer = getZeroedBuffer(sizeof(BYTE) * SECTOR_SIZE);
-					if (read_sector(getDataBlocksFirstSector(getPartition(), getSuperblock()) + dirInode->doubleIndPtr * getSuperblock()->blockSize, double_ind_buffer))
-					{
-						printf("ERROR: There was an error while trying to allocate space for a new directory entry.\n");
-						return -1;
-					}
-					DWORD simple_ind_ptr = *((DWORD *)(double_ind_buffer + (dirInode->blocksFileSize - direct_quantity - simple_indirect_quantity - 1) / simple_indirect_quantity * sizeof(DWORD)));
-
-					BYTE *simple_ind_buffer = getZeroedBuffer(sizeof(BYTE) * SECTOR_SIZE);
-					if (read_sector(getDataBlocksFirstSector(getPartition(), getSuperblock()) + simple_ind_ptr, simple_ind_buffer) != 0)
-					{
-						printf("ERROR: There was an error while trying to allocate space for a new directory entry.\n");
-						return -1;
-					}
-					memcpy(simple_ind_buffer + (dirInode->blocksFileSize - direct_quantity - simple_indirect_quantity - 1) % simple_indirect_quantity * sizeof(newBlock), &newBlock, sizeof(newBlock));
-					if (write_sector(getDataBlocksFirstSector(getPartition(), getSuperblock()) + simple_ind_ptr, simple_ind_buffer) != 0)
-					{
-						printf("ERROR: There was an error while trying to allocate space for a new directory entry.\n");
-						return -1;
-					}
-				}
-			}
+	// Copy information from file Record to hardLinkRecord
+	memcpy(&hardLinkRecord, &record, sizeof(record));
+	strcpy(hardLinkRecord.name, linkname);
 
-			BYTE *dir_inode_buffer = getBuffer(sizeof(BYTE) * SECTOR_SIZE);
-			if (read_sector(getInodesFirstSector(getPartition(), getSuperblock()), dir_inode_buffer) != 0)
-			{
-				printf("ERROR: There was an error while trying to create a new directory entry.\n");
-				return -1;
-			}
-			memcpy(dir_inode_buffer, dirInode, sizeof(I_NODE));
-			if (write_sector(getInodesFirstSector(getPartition(), getSuperblock()), dir_inode_buffer) != 0)
-			{
-				printf("ERROR: There was an error while trying to create a new directory entry.\n");
-				return -1;
-			}
+	//Get file Inode and increment 1 in the reference counter). Every way out, from
+	// here on, goes through the end of the function, which releases both inodes.
+	I_NODE *inode = getInode(hardLinkRecord.inodeNumber);
+	if (inode == NULL)
+		return -1;
 
-			// Free dynamically allocated memory
-			free(record_buffer);
-			free(buffer_inode);
-			free(dirInode);
+	int result = 0;
+	inode->RefCounter = inode->RefCounter + 1;
+	if (writeInode(inode) != 0)
+	{
+		printf("ERROR: Failed writing inode\n");
+		result = -1;
+	}
 
-			// Remember to close the opened bitmap
-			closeBitmap2();
+	// Then the new record, at the end of the directory
+	if (result == 0)
+	{
+		I_NODE *dirInode = getInode(0);
+		result = appendRecord(dirInode, &hardLinkRecord);
+		releaseInode(dirInode);
+	}
 
-			return 0;
-		}
+	// Without the record the file has one link less again
+	if (result != 0)
+	{
+		inode->RefCounter = inode->RefCounter - 1;
+		markInodeDirty(inode);
 	}
+	releaseInode(inode);
+
+	// Remember to close the opened bitmap
+	closeBitmap2();
 
-	return -1;
+	return result;
 }
@@ -1,13 +1,20 @@
+#define _GNU_SOURCE
 #include <string.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
 
 #include "t2fs.h"
 #include "t2disk.h"
 #include "apidisk.h"
 #include "bitmap2.h"
 #include "t2fslib.h"
+#include "t2cache.h"
+#include "t2space.h"
 
 // Debug variables
 BOOL debug = TRUE;
@@ -18,12 +25,82 @@ SUPERBLOCK *superblock = NULL;
 int mounted_partition = -1;
 BOOL rootOpened = FALSE;
 DWORD rootFolderFileIndex = 0;
+DWORD cacheSectors = CACHE_DEFAULT_SECTORS;
+int inodeFormat = INODE_FORMAT_INDIRECT;
 OPEN_FILE *open_files[] = {NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL};
 
+// In-core inode, shared by everyone using the same inode number
+typedef struct inode_entry
+{
+    I_NODE inode; // Must come first, callers only see this part
+    DWORD number;
+    int references;
+    BOOL dirty;
+    DWORD *blockMap; // Physical block of each logical block, BLOCK_UNMAPPED until translated
+    DWORD mapSize;
+    EXTENT *extents; // Extents of an inode mapped by extents, sorted, NULL until loaded
+    DWORD extentCount;
+    DWORD extentSize;
+    DWORD extentsDirty;  // First extent not saved yet (`extentCount` if all are)
+    DWORD *extentBlocks; // Chain of extent blocks
+    DWORD extentBlockCount;
+    struct inode_entry *next;
+} INODE_ENTRY;
+
+INODE_ENTRY *inode_table[INODE_HASH_SIZE];
+int cached_inodes = 0;
+
+// Valid root directory record, indexed by its name
+typedef struct dirent_entry
+{
+    RECORD record;
+    int index; // Position of the record in the directory
+    struct dirent_entry *next;
+} DIRENT_ENTRY;
+
+// Name lookup table, built on the first lookup (NULL until then)
+DIRENT_ENTRY **dirent_table = NULL;
+DWORD dirent_buckets = 0;
+DWORD dirent_quantity = 0;
+
+// Every structure above is shared by the library calls and the orphan reclaimer
+pthread_mutex_t library_lock = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+
+// Thread freeing the blocks of the deleted files while the partition is mounted.
+// `reclaimer_running` goes with the library lock, the rest with `reclaimer_mutex`.
+pthread_t reclaimer;
+pthread_mutex_t reclaimer_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t reclaimer_cond = PTHREAD_COND_INITIALIZER;
+BOOL reclaimer_running = FALSE;
+BOOL reclaimer_stop = FALSE;
+BOOL reclaimer_wake = FALSE;
+
+static void startReclaimer();
+static void stopReclaimer();
+
+// Release the disk image when the program finishes
+static void finalize()
+{
+    pthread_mutex_lock(&library_lock);
+    stopReclaimer();
+
+    // Changes still in the caches would be lost otherwise
+    if (superblock != NULL)
+        syncInodes();
+    releaseBitmap2();
+    cacheClose();
+    close_disk();
+    pthread_mutex_unlock(&library_lock);
+}
+
 void initialize()
 {
     if (mbr == NULL)
     {
+        // Open the disk only once, keeping it open until the program exits
+        if (open_disk() == 0)
+            atexit(finalize);
+
         readMBR();
     }
 }
@@ -59,8 +136,26 @@ int formatPartition(int partition_number, int sectors_per_block)
 {
     PARTITION partition = mbr->partitions[partition_number];
     SUPERBLOCK sb;
-    BYTE *buffer = getZeroedBuffer(sizeof(BYTE) * SECTOR_SIZE);
-    BYTE *zeroed_buffer = getZeroedBuffer(sizeof(BYTE) * SECTOR_SIZE);
+
+    // Whatever was cached from the old file system is no longer valid. The open
+    // files and the inodes in memory are forgotten without saving them, or they
+    // would be written over the new inode table.
+    if (partition_number == mounted_partition)
+    {
+        stopReclaimer();
+        for (int i = 0; i < MAX_OPEN_FILES; i++)
+            if (open_files[i] != NULL)
+            {
+                free(open_files[i]->record);
+                free(open_files[i]);
+                open_files[i] = NULL;
+            }
+        discardInodes();
+        dropDirectoryEntries();
+        rootFolderFileIndex = 0;
+    }
+    releaseBitmap2();
+    cacheInvalidate(partition_number);
 
     // Calcula variáveis auxiliares
     DWORD sectorQuantity = partition.lastSector - partition.firstSector + 1;
@@ -82,57 +177,56 @@ int formatPartition(int partition_number, int sectors_per_block)
     sb.inodeAreaSize = (WORD)inodeOccupiedBlocks;
     sb.blockSize = (WORD)sectors_per_block;
     sb.diskSize = (DWORD)sectorQuantity / sectors_per_block;
+    sb.firstOrphan = 0;
     sb.Checksum = computeChecksum(&sb);
 
+    // Both bitmaps are written from the same zeroed buffer, so it must fit the biggest of them
+    DWORD first_bbitmap = getBlockBitmapFirstSector(&partition, &sb);
+    DWORD last_bbitmap = getBlockBitmapLastSector(&partition, &sb);
+    DWORD first_ibitmap = getInodeBitmapFirstSector(&partition, &sb);
+    DWORD last_ibitmap = getInodeBitmapLastSector(&partition, &sb);
+    DWORD bitmap_sectors = last_bbitmap - first_bbitmap > last_ibitmap - first_ibitmap ? last_bbitmap - first_bbitmap : last_ibitmap - first_ibitmap;
+
+    BYTE *buffer = getZeroedBuffer(sizeof(BYTE) * SECTOR_SIZE * sb.blockSize);
+    BYTE *zeroed_buffer = getZeroedBuffer(sizeof(BYTE) * SECTOR_SIZE * bitmap_sectors);
+
     // Fill buffer with superBlock
     memcpy(buffer, (BYTE *)(&sb), sizeof(sb));
 
     // Escreve superBlock no disco (os dados de verdade ocupam apenas o primeiro setor, os outros são zerados)
-    if (write_sector(partition.firstSector, buffer) != 0)
+    if (write_sectors(partition.firstSector, sb.blockSize, buffer) != 0)
     {
-        printf("ERROR: Failed writing main superBlock sector for partition %d.\n", partition_number);
+        printf("ERROR: Failed writing superBlock for partition %d.\n", partition_number);
         return -1;
     }
 
-    for (DWORD sectorIdx = partition.firstSector + 1; sectorIdx < partition.firstSector + sb.blockSize; ++sectorIdx)
-    {
-        if (write_sector(sectorIdx, (BYTE *)zeroed_buffer) != 0)
-        {
-            printf("ERROR: Failed writing zeroed superBlock sector %d for partition %d.\n", sectorIdx, partition_number);
-            return -1;
-        }
+    printf("INFO: Formatted superBlock sectors %d to %d for partition %d.\n", partition.firstSector, partition.firstSector + sb.blockSize - 1, partition_number);
 
-        printf("INFO: Formatted zeroed superBlock sector %d for partition %d.\n", sectorIdx, partition_number);
+    // The mounted partition goes on with the new superblock, whose orphan list is empty
+    if (partition_number == mounted_partition)
+    {
+        memcpy(superblock, &sb, sizeof(SUPERBLOCK));
+        startReclaimer();
     }
 
     // Criar/limpar bitmap dos blocos com o zeroed_buffer
-    DWORD first_bbitmap = getBlockBitmapFirstSector(&partition, &sb);
-    DWORD last_bbitmap = getBlockBitmapLastSector(&partition, &sb);
-    for (DWORD sectorIdx = first_bbitmap; sectorIdx < last_bbitmap; ++sectorIdx)
+    if (write_sectors(first_bbitmap, last_bbitmap - first_bbitmap, (BYTE *)zeroed_buffer) != 0)
     {
-        if (write_sector(sectorIdx, (BYTE *)zeroed_buffer) != 0)
-        {
-            printf("ERROR: Failed writing block bitmap sector %d on partition %d while formatting it.\n", sectorIdx, partition_number);
-            return -1;
-        }
-
-        printf("INFO: Formatted free block bitmap sector %d\n", sectorIdx);
+        printf("ERROR: Failed writing block bitmap on partition %d while formatting it.\n", partition_number);
+        return -1;
     }
 
+    printf("INFO: Formatted free block bitmap sectors %d to %d\n", first_bbitmap, last_bbitmap - 1);
+
     // Criar/limpar bitmap dos inodes
-    DWORD first_ibitmap = getInodeBitmapFirstSector(&partition, &sb);
-    DWORD last_ibitmap = getInodeBitmapLastSector(&partition, &sb);
-    for (DWORD sectorIdx = first_ibitmap; sectorIdx < last_ibitmap; ++sectorIdx)
+    if (write_sectors(first_ibitmap, last_ibitmap - first_ibitmap, (BYTE *)zeroed_buffer) != 0)
     {
-        if (write_sector(sectorIdx, (BYTE *)zeroed_buffer) != 0)
-        {
-            printf("ERROR: Failed writing inode bitmap sector %d on partition %d while formatting it.\n", sectorIdx, partition_number);
-            return -1;
-        }
-
-        printf("INFO: Formatted free inode bitmap sector %d\n", sectorIdx);
+        printf("ERROR: Failed writing inode bitmap on partition %d while formatting it.\n", partition_number);
+        return -1;
     }
 
+    printf("INFO: Formatted free inode bitmap sectors %d to %d\n", first_ibitmap, last_ibitmap - 1);
+
     // Lembrar de liberar memória utilizada pelos buffers
     free(buffer);
     free(zeroed_buffer);
@@ -176,25 +270,16 @@ int createRootFolder(int partition_number)
     memcpy(&sb, buffer, sizeof(sb));
 
     // Create inode and mark it on the bitmap, automatically pointing to the first entry in the data block
-    BYTE *inode_buffer = getZeroedBuffer(sizeof(BYTE) * SECTOR_SIZE);
+    // The whole first inode block is written at once, the rest of it zeroed
+    BYTE *inode_buffer = getZeroedBuffer(sizeof(BYTE) * SECTOR_SIZE * sb.blockSize);
     I_NODE inode = {(DWORD)1, (DWORD)0, {(DWORD)0, (DWORD)0}, (DWORD)0, (DWORD)0, (DWORD)1, (DWORD)0};
     memcpy(inode_buffer, &inode, sizeof(inode));
-    if (write_sector(getInodesFirstSector(&partition, &sb), inode_buffer) != 0)
+    if (write_sectors(getInodesFirstSector(&partition, &sb), sb.blockSize, inode_buffer) != 0)
     {
         printf("ERROR: Couldn't write root folder inode.\n");
         return -1;
     };
-    printf("INFO: Wrote root folder inode sector on %d sector\n", getInodesFirstSector(&partition, &sb));
-    memset(inode_buffer, 0, sizeof(BYTE) * SECTOR_SIZE);
-    for (int i = 1; i < sb.blockSize; ++i)
-    {
-        if (write_sector(getInodesFirstSector(&partition, &sb) + i, inode_buffer) != 0)
-        {
-            printf("ERROR: Couldn't write root folder inode.\n");
-            return -1;
-        }
-        printf("INFO: Wrote extra root folder inode sector %d\n", getInodesFirstSector(&partition, &sb) + i);
-    }
+    printf("INFO: Wrote root folder inode block on sectors %d to %d\n", getInodesFirstSector(&partition, &sb), getInodesFirstSector(&partition, &sb) + sb.blockSize - 1);
     if (setBitmap2(BITMAP_INODE, 0, 1) != 0)
     {
         printf("ERROR: Failed setting bitmap for root folder inode.\n");
@@ -203,16 +288,13 @@ int createRootFolder(int partition_number)
     printf("INFO: Set inode bitmap for root folder.\n");
 
     // Create folder data block, emptied
-    BYTE *data_buffer = getZeroedBuffer(sizeof(BYTE) * SECTOR_SIZE);
-    for (int i = 0; i < sb.blockSize; ++i)
+    BYTE *data_buffer = getZeroedBuffer(sizeof(BYTE) * SECTOR_SIZE * sb.blockSize);
+    if (write_sectors(getDataBlocksFirstSector(&partition, &sb), sb.blockSize, data_buffer) != 0)
     {
-        if (write_sector(getDataBlocksFirstSector(&partition, &sb) + i, data_buffer) != 0)
-        {
-            printf("ERROR: Couldn't write root folder data block.\n");
-            return -1;
-        }
-        printf("INFO: Wrote root folder data on sector %d\n", getDataBlocksFirstSector(&partition, &sb) + i);
+        printf("ERROR: Couldn't write root folder data block.\n");
+        return -1;
     }
+    printf("INFO: Wrote root folder data on sectors %d to %d\n", getDataBlocksFirstSector(&partition, &sb), getDataBlocksFirstSector(&partition, &sb) + sb.blockSize - 1);
     if (setBitmap2(BITMAP_DADOS, 0, 1) != 0)
     {
         printf("ERROR: Failed setting bitmap for root folder data block.\n");
@@ -240,20 +322,61 @@ int configureMountedPartition(int partition_number)
         return -1;
     }
 
+    // Every access to the partition goes through its sector cache from now on
+    if (cacheOpen(partition_number, cacheSectors) != 0)
+    {
+        printf("ERROR: Couldn't create the partition cache.\n");
+        free(buffer);
+        return -1;
+    }
+
     superblock = (SUPERBLOCK *)malloc(sizeof(SUPERBLOCK));
     memcpy(superblock, buffer, sizeof(SUPERBLOCK));
 
+    // Both bitmaps are kept in memory while the partition is mounted
+    if (openBitmap2(getMBR()->partitions[partition_number].firstSector) != 0)
+    {
+        printf("ERROR: Couldn't read the bitmaps.\n");
+        free(superblock);
+        superblock = NULL;
+        cacheClose();
+        free(buffer);
+        return -1;
+    }
+
     // Mark mounted partition
     mounted_partition = partition_number;
 
     // Remember to clean up buffer allocated memory
     free(buffer);
 
+    // Files deleted before the last unmount may still have blocks to free
+    startReclaimer();
+
     return 0;
 }
 
 inline int unmountPartition()
 {
+    // Orphans not freed yet stay in the list, to be freed after the next mount
+    stopReclaimer();
+
+    // Files can't stay open without their partition
+    for (int i = 0; i < MAX_OPEN_FILES; i++)
+        if (open_files[i] != NULL)
+            closeFile(i);
+
+    // Write back the caches and make sure everything written reached the disk image
+    dropDirectoryEntries();
+    dropInodes();
+    releaseBitmap2();
+    cacheClose();
+    if (sync_disk() != 0)
+    {
+        printf("ERROR: Failed syncing disk.\n");
+        return -1;
+    }
+
     if (superblock != NULL)
     {
         free(superblock);
@@ -277,7 +400,7 @@ int closeFile(FILE2 handle)
 
     // Free dynamically allocated memory
     free(open_files[handle]->record);
-    free(open_files[handle]->inode);
+    releaseInode(open_files[handle]->inode);
     free(open_files[handle]);
 
     open_files[handle] = NULL;
@@ -306,6 +429,11 @@ int countOpenedFiles()
     return counter;
 }
 
+inline BOOL isFileOpen(FILE2 handle)
+{
+    return handle >= 0 && handle < MAX_OPEN_FILES && open_files[handle] != NULL;
+}
+
 inline FILE2 getHandler()
 {
     for (int i = 0; i < MAX_OPEN_FILES; i++)
@@ -324,6 +452,9 @@ FILE2 openFile(RECORD *record)
     file->inode = getInode(record->inodeNumber);
     file->file_position = 0;
     file->handle = handle;
+    file->readahead_position = 0;
+    file->readahead_window = 0;
+    file->readahead_block = 0;
 
     open_files[handle] = file;
 
@@ -352,306 +483,650 @@ inline DWORD getNewDataBlock()
     return newBlock;
 }
 
-FILE2 writeFile(FILE2 handle, char *buffer, int size)
+int allocateBlocks(DWORD count, DWORD goal, DWORD *length)
 {
-    openBitmap2(getPartition()->firstSector);
-
-    DWORD direct_quantity = getInodeDirectQuantity();
-    DWORD simple_indirect_quantity = getInodeSimpleIndirectQuantity();
-    // DWORD double_indirect_quantity = getInodeDoubleIndirectQuantity();
+    int run;
+    int first = searchRunBitmap2(BITMAP_DADOS, goal, count, &run);
+    if (first < 0)
+        return -1;
 
-    DWORD *bytesFilePosition = &(open_files[handle]->file_position);
-    DWORD initialBytesFilePosition = *bytesFilePosition;
-    RECORD *fileRecord = open_files[handle]->record;
-    I_NODE *fileInode = open_files[handle]->inode;
+    for (int i = 0; i < run; i++)
+        setBitmap2(BITMAP_DADOS, first + i, 1);
+    *length = run;
 
-    BYTE *buffer_inode;
+    return first;
+}
 
-    DWORD newDataBlock, newInodeBlock;
-    DWORD newDataSector;
-    DWORD newDataSectorOffset;
+// Hands out the next block allocated in advance by `writeFile`, or a new one if there are none left
+static DWORD takeNewBlock(DWORD *blocks, DWORD quantity, DWORD *used)
+{
+    if (*used < quantity)
+        return blocks[(*used)++];
 
-    int newSimpleIndirectionBlock;
-    BYTE *simple_ind_buffer;
-    int newDoubleIndirectionBlock;
-    BYTE *double_ind_buffer;
-    DWORD simple_ind_ptr;
+    return getNewDataBlock();
+}
 
-    //Enquanto o o tamanho do buffer de escrita nao acaba
-    DWORD bufferByteLocation = 0;
-    while (bufferByteLocation < (DWORD)size)
+// Gives back the blocks `first` to `quantity - 1` of `blocks`, allocated in advance
+// by `writeFileAt` and left unused, a run of consecutive blocks at a time
+static void freeUnusedBlocks(DWORD *blocks, DWORD first, DWORD quantity)
+{
+    for (DWORD i = first, end; i < quantity; i = end)
     {
-        newDataBlock = *bytesFilePosition / getBlocksize();
-        newDataSector = *bytesFilePosition % getBlocksize() / SECTOR_SIZE;
-        newDataSectorOffset = *bytesFilePosition % SECTOR_SIZE;
-
-        //===============New block allocation========================
-        if (newDataBlock + 1 > fileInode->blocksFileSize)
-        {
-            fileInode->blocksFileSize++;
-
-            if (fileInode->blocksFileSize == direct_quantity)
-            {
-                newInodeBlock = getNewDataBlock();
-                fileInode->dataPtr[1] = newInodeBlock;
-            }
+        for (end = i + 1; end < quantity && blocks[end] == blocks[end - 1] + 1; end++)
+            ;
+        setRangeBitmap2(BITMAP_DADOS, blocks[i], end - i, 0);
+    }
+}
 
-            //------------------------------------------------------------
-            //------------------------------------------------------------
-            //------------------------------------------------------------
-            else if (fileInode->blocksFileSize == direct_quantity + 1)
-            {
-                // Allocate block for the simple indirection block
+// Writes `pointer` as the `index`-th pointer stored in the index block `block_number`
+static int writePointer(DWORD block_number, DWORD index, DWORD pointer)
+{
+    BYTE buffer[SECTOR_SIZE];
+    DWORD sector = getDataBlocksFirstSector(getPartition(), getSuperblock()) + block_number * getSuperblock()->blockSize + (index * PTR_SIZE) / SECTOR_SIZE;
 
-                // Find bitmap entry
-                newSimpleIndirectionBlock = searchBitmap2(BITMAP_DADOS, 0);
-                if (newSimpleIndirectionBlock == -1)
-                {
-                    printf("ERROR: There is no space left to create a new directory entry.\n");
-                    return -1;
-                }
+    if (cacheReadSector(sector, buffer) != 0)
+        return -1;
+    memcpy(buffer + (index * PTR_SIZE) % SECTOR_SIZE, &pointer, PTR_SIZE);
 
-                if (setBitmap2(BITMAP_DADOS, newSimpleIndirectionBlock, 1) != 0)
-                {
-                    printf("ERROR: There is no space left to create a new directory entry.\n");
-                    return -1;
-                }
-                fileInode->singleIndPtr = newSimpleIndirectionBlock;
+    return cacheWriteSector(sector, buffer);
+}
 
-                simple_ind_buffer = getZeroedBuffer(sizeof(BYTE) * SECTOR_SIZE);
-                newInodeBlock = getNewDataBlock();
-                memcpy(simple_ind_buffer, &newInodeBlock, sizeof(newInodeBlock));
-                if (write_sector(getDataBlocksFirstSector(getPartition(), getSuperblock()) + fileInode->singleIndPtr * getSuperblock()->blockSize, simple_ind_buffer) != 0)
-                {
-                    printf("ERROR: There was an error while trying to allocate space for a new directory entry.\n");
-                    return -1;
-                }
-            }
-            else if (fileInode->blocksFileSize <= direct_quantity + simple_indirect_quantity)
-            {
-                // Middle single indirection block
+// Allocates an index block, saving it in `block`. Every pointer in it starts
+// invalid, as the blocks it covers are holes until they are written.
+static int newIndexBlock(DWORD *block)
+{
+    int newBlock = searchBitmap2(BITMAP_DADOS, 0);
+    if (newBlock == -1 || setBitmap2(BITMAP_DADOS, newBlock, 1) != 0)
+    {
+        printf("ERROR: There is no space left for an index block.\n");
+        return -1;
+    }
 
-                simple_ind_buffer = getZeroedBuffer(sizeof(BYTE) * SECTOR_SIZE);
+    BYTE *zeros = getZeroedBuffer(getBlocksize());
+    int result = cacheWriteSectors(getDataBlocksFirstSector(getPartition(), getSuperblock()) + newBlock * getSuperblock()->blockSize, getSuperblock()->blockSize, zeros);
+    free(zeros);
+    if (result != 0)
+    {
+        printf("ERROR: Couldn't write index block %d.\n", newBlock);
+        return -1;
+    }
 
-                BYTE sectorInBlock = (DWORD)((fileInode->blocksFileSize - direct_quantity - 1) * sizeof(newInodeBlock)) / SECTOR_SIZE;
-                BYTE offsetInSector = (DWORD)((fileInode->blocksFileSize - direct_quantity - 1) * sizeof(newInodeBlock)) % SECTOR_SIZE;
+    *block = newBlock;
 
-                if (read_sector((getDataBlocksFirstSector(getPartition(), getSuperblock()) + fileInode->singleIndPtr * getSuperblock()->blockSize) + sectorInBlock, simple_ind_buffer) != 0)
-                {
-                    printf("ERROR: There was an error while trying to allocate space for a new directory entry.\n");
-                    return -1;
-                }
+    return 0;
+}
 
-                newInodeBlock = getNewDataBlock();
+// Sets the pointers `first` to `end - 1` of the index block `block_number` as invalid
+static int clearIndexPointers(DWORD block_number, DWORD first, DWORD end)
+{
+    for (DWORD i = first; i < end; i++)
+        if (writePointer(block_number, i, INVALID_PTR) != 0)
+            return -1;
 
-                memcpy(simple_ind_buffer + offsetInSector, &newInodeBlock, sizeof(newInodeBlock));
+    return 0;
+}
 
-                sectorInBlock = (DWORD)((fileInode->blocksFileSize - direct_quantity - 1) * sizeof(newInodeBlock)) / SECTOR_SIZE;
-                if (write_sector((getDataBlocksFirstSector(getPartition(), getSuperblock()) + fileInode->singleIndPtr * getSuperblock()->blockSize) + sectorInBlock, simple_ind_buffer) != 0)
-                {
-                    printf("ERROR: There was an error while trying to allocate space for a new directory entry.\n");
-                    return -1;
-                }
-            }
-            else if (fileInode->blocksFileSize == direct_quantity + simple_indirect_quantity + 1)
-            {
-                // Allocate bitmap for doubleIndirectionBlock
-                newDoubleIndirectionBlock = searchBitmap2(BITMAP_DADOS, 0);
-                if (newDoubleIndirectionBlock == -1)
-                {
-                    printf("ERROR: There is no space left to create a new directory entry.\n");
-                    return -1;
-                }
-                if (setBitmap2(BITMAP_DADOS, newDoubleIndirectionBlock, 1) != 0)
-                {
-                    printf("ERROR: There is no space left to create a new directory entry.\n");
-                    return -1;
-                }
-                fileInode->doubleIndPtr = newDoubleIndirectionBlock;
+// Makes the block `last` the last block of `inode`, leaving the blocks between
+// its old end and `last` as holes. The caller must map `last` right after.
+// Pointers left in the index blocks by a truncated end of file are cleared, and
+// the index blocks the new blocks would need are left for `mapBlock` to allocate.
+static int growBlocks(I_NODE *inode, DWORD last)
+{
+    DWORD direct_quantity = getInodeDirectQuantity();
+    DWORD simple_indirect_quantity = getInodeSimpleIndirectQuantity();
+    DWORD double_first = direct_quantity + simple_indirect_quantity;
+    DWORD old = inode->blocksFileSize;
+    int result = 0;
 
-                // Allocate bitmap for simpleIndirectionBlock
-                newSimpleIndirectionBlock = searchBitmap2(BITMAP_DADOS, 0);
-                if (newSimpleIndirectionBlock == -1)
-                {
-                    printf("ERROR: There is no space left to create a new directory entry.\n");
-                    return -1;
-                }
-                if (setBitmap2(BITMAP_DADOS, newSimpleIndirectionBlock, 1) != 0)
-                {
-                    printf("ERROR: There is no space left to create a new directory entry.\n");
-                    return -1;
-                }
+    if (!isExtentInode(inode))
+    {
+        for (DWORD i = old; i < last && i < direct_quantity; i++)
+            inode->dataPtr[i] = INVALID_PTR;
 
-                double_ind_buffer = getZeroedBuffer(sizeof(BYTE) * SECTOR_SIZE);
-                memcpy(double_ind_buffer, &newSimpleIndirectionBlock, sizeof(newSimpleIndirectionBlock));
-                if (write_sector(getDataBlocksFirstSector(getPartition(), getSuperblock()) + fileInode->doubleIndPtr * getSuperblock()->blockSize, double_ind_buffer) != 0)
-                {
-                    printf("ERROR: There was an error while trying to allocate space for a new directory entry.\n");
-                    return -1;
-                }
+        if (old <= direct_quantity && last >= direct_quantity)
+            inode->singleIndPtr = INVALID_PTR;
+        else if (old > direct_quantity && old < double_first && inode->singleIndPtr != INVALID_PTR)
+            result = clearIndexPointers(inode->singleIndPtr, old - direct_quantity, (last < double_first ? last : double_first) - direct_quantity);
 
-                simple_ind_buffer = getZeroedBuffer(sizeof(BYTE) * SECTOR_SIZE);
-                newInodeBlock = getNewDataBlock();
-                memcpy(simple_ind_buffer, &newInodeBlock, sizeof(newInodeBlock));
-                if (write_sector(getDataBlocksFirstSector(getPartition(), getSuperblock()) + newSimpleIndirectionBlock * getSuperblock()->blockSize, simple_ind_buffer) != 0)
-                {
-                    printf("ERROR: There was an error while trying to allocate space for a new directory entry.\n");
-                    return -1;
-                }
-            }
-            else if ((fileInode->blocksFileSize - 3) % simple_indirect_quantity == 0)
+        if (old <= double_first && last >= double_first)
+            inode->doubleIndPtr = INVALID_PTR;
+        else if (old > double_first && inode->doubleIndPtr != INVALID_PTR && result == 0)
+        {
+            // The rest of the index block holding the old end, and then the
+            // index blocks which don't exist yet
+            DWORD group = (old - double_first) / simple_indirect_quantity;
+            DWORD group_first = double_first + group * simple_indirect_quantity;
+            DWORD index_block;
+            if (old > group_first && (result = readPointer(inode->doubleIndPtr, group, &index_block)) == 0 && index_block != INVALID_PTR)
             {
-                // Allocate bitmap for simpleIndirectionBlock
-                newSimpleIndirectionBlock = searchBitmap2(BITMAP_DADOS, 0);
-                if (newSimpleIndirectionBlock == -1)
-                {
-                    printf("ERROR: There is no space left to create a new directory entry.\n");
-                    return -1;
-                }
-                if (setBitmap2(BITMAP_DADOS, newSimpleIndirectionBlock, 1) != 0)
-                {
-                    printf("ERROR: There is no space left to create a new directory entry.\n");
-                    return -1;
-                }
-
-                double_ind_buffer = getZeroedBuffer(sizeof(BYTE) * SECTOR_SIZE);
-                if (read_sector(getDataBlocksFirstSector(getPartition(), getSuperblock()) + fileInode->doubleIndPtr * getSuperblock()->blockSize, double_ind_buffer) != 0)
-                {
-                    printf("ERROR: There was an error while trying to allocate space for a new directory entry.\n");
-                    return -1;
-                }
-                memcpy(double_ind_buffer + (fileInode->blocksFileSize - direct_quantity - simple_indirect_quantity - 1) / simple_indirect_quantity * sizeof(newSimpleIndirectionBlock), &newSimpleIndirectionBlock, sizeof(newSimpleIndirectionBlock));
-                if (write_sector(getDataBlocksFirstSector(getPartition(), getSuperblock()) + fileInode->doubleIndPtr * getSuperblock()->blockSize, double_ind_buffer) != 0)
-                {
-                    printf("ERROR: There was an error while trying to allocate space for a new directory entry.\n");
-                    return -1;
-                }
-
-                simple_ind_buffer = getZeroedBuffer(sizeof(BYTE) * SECTOR_SIZE);
-                newInodeBlock = getNewDataBlock();
-                memcpy(simple_ind_buffer, &newInodeBlock, sizeof(newInodeBlock));
-                if (write_sector(getDataBlocksFirstSector(getPartition(), getSuperblock()) + newSimpleIndirectionBlock * getSuperblock()->blockSize, simple_ind_buffer) != 0)
-                {
-                    printf("ERROR: There was an error while trying to allocate space for a new directory entry.\n");
-                    return -1;
-                }
+                DWORD end = last < group_first + simple_indirect_quantity ? last : group_first + simple_indirect_quantity;
+                result = clearIndexPointers(index_block, old - group_first, end - group_first);
             }
-            else
-            {
-                // Discover where is the simpleIndBlock
-                double_ind_buffer = getZeroedBuffer(sizeof(BYTE) * SECTOR_SIZE);
 
-                if (read_sector(getDataBlocksFirstSector(getPartition(), getSuperblock()) + fileInode->doubleIndPtr * getSuperblock()->blockSize, double_ind_buffer))
-                {
-                    printf("ERROR: There was an error while trying to allocate space for a new directory entry.\n");
-                    return -1;
-                }
+            DWORD lastGroup = (last - double_first) / simple_indirect_quantity;
+            for (DWORD g = old > group_first ? group + 1 : group; g <= lastGroup && result == 0; g++)
+                result = writePointer(inode->doubleIndPtr, g, INVALID_PTR);
+        }
+    }
 
-                simple_ind_ptr = *((DWORD *)(double_ind_buffer + (fileInode->blocksFileSize - direct_quantity - simple_indirect_quantity - 1) / simple_indirect_quantity * sizeof(DWORD)));
+    if (result != 0)
+    {
+        printf("ERROR: Couldn't clear the pointers past block %u.\n", old);
+        return -1;
+    }
 
-                simple_ind_buffer = getZeroedBuffer(sizeof(BYTE) * SECTOR_SIZE);
-                if (read_sector(getDataBlocksFirstSector(getPartition(), getSuperblock()) + simple_ind_ptr, simple_ind_buffer) != 0)
-                {
-                    printf("ERROR: There was an error while trying to allocate space for a new directory entry.\n");
-                    return -1;
-                }
+    inode->blocksFileSize = last + 1;
+    forgetBlockMap(inode, old);
+    markInodeDirty(inode);
+
+    return 0;
+}
 
-                newInodeBlock = getNewDataBlock();
+// Points the logical block `block_number` of `inode`, which must be a hole, to the
+// data block `data_block`, allocating the index blocks missing on the way
+static int mapBlock(I_NODE *inode, DWORD block_number, DWORD data_block)
+{
+    DWORD direct_quantity = getInodeDirectQuantity();
+    DWORD simple_indirect_quantity = getInodeSimpleIndirectQuantity();
+    INODE_ENTRY *entry = (INODE_ENTRY *)inode;
 
-                memcpy(simple_ind_buffer + (fileInode->blocksFileSize - direct_quantity - simple_indirect_quantity - 1) % simple_indirect_quantity * sizeof(newInodeBlock), &newInodeBlock, sizeof(newInodeBlock));
+    if (isExtentInode(inode))
+        return mapExtentBlock(inode, block_number, data_block);
 
-                if (write_sector(getDataBlocksFirstSector(getPartition(), getSuperblock()) + simple_ind_ptr, simple_ind_buffer) != 0)
-                {
-                    printf("ERROR: There was an error while trying to allocate space for a new directory entry.\n");
-                    return -1;
-                }
-            }
-            //------------------------------------------------------------
-            //------------------------------------------------------------
-            //------------------------------------------------------------
-
-            DWORD inodeSector = fileRecord->inodeNumber / (SECTOR_SIZE / sizeof(I_NODE));
-            DWORD inodeSectorOffset = (fileRecord->inodeNumber % (SECTOR_SIZE / sizeof(I_NODE))) * sizeof(I_NODE);
-            // Update and save inode
-            buffer_inode = getBuffer(sizeof(BYTE) * SECTOR_SIZE);
-            if (read_sector(getInodesFirstSector(getPartition(), getSuperblock()) + inodeSector, buffer_inode) != 0)
-            {
-                printf("ERROR: Failed reading record\n");
-                return -1;
-            }
-            memcpy(buffer_inode + inodeSectorOffset, fileInode, sizeof(I_NODE));
-            if (write_sector(getInodesFirstSector(getPartition(), getSuperblock()) + inodeSector, buffer_inode) != 0)
-            {
-                printf("ERROR: Failed writing record\n");
+    if (block_number < direct_quantity)
+        inode->dataPtr[block_number] = data_block;
+    else
+    {
+        DWORD index_block, index;
+        if (block_number < direct_quantity + simple_indirect_quantity)
+        {
+            if (inode->singleIndPtr == INVALID_PTR && newIndexBlock(&inode->singleIndPtr) != 0)
                 return -1;
-            }
+            index_block = inode->singleIndPtr;
+            index = block_number - direct_quantity;
         }
-        //===============End new block allocation========================
-
-        BYTE *data_buffer = getZeroedBuffer(sizeof(BYTE) * SECTOR_SIZE);
-        if (readDataBlockSector(newDataBlock, newDataSector, fileInode, (BYTE *)data_buffer) != 0)
+        else
         {
-            printf("ERROR: Failed reading record\n");
-            return -1;
+            DWORD group = (block_number - direct_quantity - simple_indirect_quantity) / simple_indirect_quantity;
+            if (inode->doubleIndPtr == INVALID_PTR && newIndexBlock(&inode->doubleIndPtr) != 0)
+                return -1;
+            if (readPointer(inode->doubleIndPtr, group, &index_block) != 0)
+                return -1;
+            if (index_block == INVALID_PTR && (newIndexBlock(&index_block) != 0 || writePointer(inode->doubleIndPtr, group, index_block) != 0))
+                return -1;
+            index = (block_number - direct_quantity - simple_indirect_quantity) % simple_indirect_quantity;
         }
-        for (DWORD dataByteLocation = newDataSectorOffset; bufferByteLocation < (DWORD)size; dataByteLocation++, bufferByteLocation++)
-        {
-            if (dataByteLocation >= sizeof(BYTE) * SECTOR_SIZE)
-                break;
 
-            (*bytesFilePosition)++;
-            data_buffer[dataByteLocation] = buffer[bufferByteLocation];
-        }
-        if (writeDataBlockSector(newDataBlock, newDataSector, fileInode, (BYTE *)data_buffer) != 0)
-        {
-            printf("ERROR: Failed writing record\n");
+        if (writePointer(index_block, index, data_block) != 0)
             return -1;
-        }
     }
 
-    fileInode->bytesFileSize = *bytesFilePosition > fileInode->bytesFileSize ? *bytesFilePosition : fileInode->bytesFileSize;
-    DWORD inodeSector = fileRecord->inodeNumber / (SECTOR_SIZE / sizeof(I_NODE));
-    DWORD inodeSectorOffset = (fileRecord->inodeNumber % (SECTOR_SIZE / sizeof(I_NODE))) * sizeof(I_NODE);
-    buffer_inode = getBuffer(sizeof(BYTE) * SECTOR_SIZE);
-    if (read_sector(getInodesFirstSector(getPartition(), getSuperblock()) + inodeSector, buffer_inode) != 0)
-    {
-        printf("ERROR: Failed reading record\n");
+    if (block_number < entry->mapSize)
+        entry->blockMap[block_number] = data_block;
+    markInodeDirty(inode);
+
+    return 0;
+}
+
+// Writes zeros over the bytes of `inode` from `first` to `end - 1`, all in the same
+// block, unless it is a hole
+static int zeroFileBytes(I_NODE *inode, DWORD first, DWORD end)
+{
+    DWORD address;
+    if (getDataBlockSectorAddress(first / getBlocksize(), 0, inode, &address) != 0)
         return -1;
-    }
-    memcpy(buffer_inode + inodeSectorOffset, fileInode, sizeof(I_NODE));
-    if (write_sector(getInodesFirstSector(getPartition(), getSuperblock()) + inodeSector, buffer_inode) != 0)
+    if (address == HOLE_SECTOR)
+        return 0;
+
+    BYTE buffer[SECTOR_SIZE];
+    while (first < end)
     {
-        printf("ERROR: Failed writing record\n");
-        return -1;
+        DWORD sector = address + first % getBlocksize() / SECTOR_SIZE;
+        DWORD offset = first % SECTOR_SIZE;
+        DWORD bytes = SECTOR_SIZE - offset < end - first ? SECTOR_SIZE - offset : end - first;
+
+        if (cacheReadSector(sector, buffer) != 0)
+            return -1;
+        memset(buffer + offset, 0, bytes);
+        if (cacheWriteSector(sector, buffer) != 0)
+            return -1;
+
+        first += bytes;
     }
-    return *bytesFilePosition - initialBytesFilePosition;
+
+    return 0;
 }
 
-int readFile(FILE2 handle, char *buffer, int size)
+int truncateFile(FILE2 handle)
 {
-    DWORD *bytesFilePosition = &(open_files[handle]->file_position);
-    I_NODE *fileInode = open_files[handle]->inode;
-
-    //where is my pointer
-    DWORD currentBlock = *bytesFilePosition / getBlocksize();
-    DWORD currentSector = *bytesFilePosition % getBlocksize() / SECTOR_SIZE;
-    DWORD currentSectorOffset = *bytesFilePosition % SECTOR_SIZE;
-
     openBitmap2(getPartition()->firstSector);
 
-    int bufferOffsetTotal = 0;
-    int sizeSmallerThanOffset = 0;
+    OPEN_FILE *file = open_files[handle];
+    I_NODE *inode = file->inode;
 
-    BYTE *file_buffer = getBuffer(sizeof(BYTE) * SECTOR_SIZE);
+    // Nothing to cut at or past the end of the file
+    if (file->file_position >= inode->bytesFileSize)
+        return 0;
 
-    if ((DWORD)size > fileInode->bytesFileSize - *bytesFilePosition)
-        size = fileInode->bytesFileSize - *bytesFilePosition;
+    // The blocks past the position go in runs, along with their index blocks
+    if (truncateBlocks(inode, (file->file_position + getBlocksize() - 1) / getBlocksize()) != 0)
+        return -1;
+    inode->bytesFileSize = file->file_position;
+    markInodeDirty(inode);
 
-    if (size > 0)
+    // As in writeFileAt, the inode and the bitmaps are saved once
+    if (cacheGetMode() == CACHE_WRITE_THROUGH && (writeInode(inode) != 0 || closeBitmap2() != 0))
     {
-        if (currentSectorOffset > 0) //Test if exists any first sector offset to read
-        {
-
+        printf("ERROR: Failed writing inode\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+int seekFile(FILE2 handle, DWORD offset)
+{
+    OPEN_FILE *file = open_files[handle];
+
+    // Only the position changes, the blocks past the end of the file are
+    // only allocated once something is written there
+    file->file_position = offset == (DWORD)-1 ? file->inode->bytesFileSize : offset;
+
+    return 0;
+}
+
+FILE2 writeFile(FILE2 handle, char *buffer, int size)
+{
+    return writeFileAt(handle, buffer, size, &(open_files[handle]->file_position));
+}
+
+int writeFileAt(FILE2 handle, char *buffer, int size, DWORD *bytesFilePosition)
+{
+    openBitmap2(getPartition()->firstSector);
+
+    DWORD simple_indirect_quantity = getInodeSimpleIndirectQuantity();
+
+    DWORD initialBytesFilePosition = *bytesFilePosition;
+    I_NODE *fileInode = open_files[handle]->inode;
+
+    // An inode of pointers can't reach the blocks past the ones its double indirect
+    // block covers, so a write stops at the last byte it can address
+    if (!isExtentInode(fileInode))
+    {
+        unsigned long long maxBytes = (unsigned long long)(getInodeDirectQuantity() + simple_indirect_quantity + getInodeDoubleIndirectQuantity()) * getBlocksize();
+        if (*bytesFilePosition >= maxBytes)
+            size = 0;
+        else if ((unsigned long long)size > maxBytes - *bytesFilePosition)
+            size = (int)(maxBytes - *bytesFilePosition);
+    }
+
+    DWORD newDataBlock, newInodeBlock;
+    DWORD newDataSector;
+    DWORD newDataSectorOffset;
+
+    // The bytes between the end of the file and a write past it read as zeros.
+    // Whole blocks in between are left as holes, and only what is left of the
+    // block holding the end of the file (if it has one) needs to be cleared.
+    DWORD fileSize = fileInode->bytesFileSize;
+    if (*bytesFilePosition > fileSize && size > 0 && fileSize / getBlocksize() < fileInode->blocksFileSize)
+    {
+        DWORD end = (fileSize / getBlocksize() + 1) * getBlocksize();
+        if (zeroFileBytes(fileInode, fileSize, end < *bytesFilePosition ? end : *bytesFilePosition) != 0)
+        {
+            printf("ERROR: Couldn't clear the end of the file.\n");
+            return -1;
+        }
+    }
+
+    // Whole data sectors are written all together, straight from `buffer`,
+    // in a single batch after the loop
+    DWORD sectorsToWrite = (*bytesFilePosition % SECTOR_SIZE + size + SECTOR_SIZE - 1) / SECTOR_SIZE;
+    BYTE *data_buffer = getBuffer(sizeof(BYTE) * SECTOR_SIZE);
+    BYTE *zero_block = NULL;
+    SECTOR_REQUEST *requests = (SECTOR_REQUEST *)malloc(sizeof(SECTOR_REQUEST) * (sectorsToWrite > 0 ? sectorsToWrite : 1));
+    int requestsQuantity = 0;
+
+    // Every block this write needs, past the end of the file or in its holes, is
+    // allocated up front, in runs as long as possible, starting right after the
+    // last block of the file
+    DWORD firstBlock = *bytesFilePosition / getBlocksize();
+    DWORD blocksAfterWrite = size > 0 ? (*bytesFilePosition + size + getBlocksize() - 1) / getBlocksize() : firstBlock;
+    DWORD blocksNeeded = 0;
+    for (DWORD block = firstBlock; block < blocksAfterWrite; block++)
+    {
+        DWORD address;
+        if (block >= fileInode->blocksFileSize || (getDataBlockSectorAddress(block, 0, fileInode, &address) == 0 && address == HOLE_SECTOR))
+            blocksNeeded++;
+    }
+    DWORD *newBlocks = (DWORD *)malloc(sizeof(DWORD) * (blocksNeeded > 0 ? blocksNeeded : 1));
+    DWORD newBlocksQuantity = 0, newBlocksUsed = 0;
+
+    // The blocks of the deleted files may still be waiting to be freed. The index
+    // blocks are allocated one at a time later, so there must be room for them too.
+    DWORD freeRuns, freeBlocks;
+    spaceGetStats(&freeRuns, &freeBlocks);
+    if (getSuperblock()->firstOrphan != 0 && freeBlocks < blocksNeeded + blocksNeeded / simple_indirect_quantity + 2)
+        reclaimOrphans();
+
+    DWORD goal = 0, lastAddress;
+    if (fileInode->blocksFileSize > 0 && getDataBlockSectorAddress(fileInode->blocksFileSize - 1, 0, fileInode, &lastAddress) == 0 && lastAddress != HOLE_SECTOR)
+        goal = (lastAddress - getDataBlocksFirstSector(getPartition(), getSuperblock())) / getSuperblock()->blockSize + 1;
+
+    while (newBlocksQuantity < blocksNeeded)
+    {
+        DWORD length;
+        int first = allocateBlocks(blocksNeeded - newBlocksQuantity, goal, &length);
+        if (first < 0)
+            break;
+
+        for (DWORD i = 0; i < length; i++)
+            newBlocks[newBlocksQuantity++] = first + i;
+        goal = first + length;
+    }
+
+    //Enquanto o o tamanho do buffer de escrita nao acaba
+    DWORD bufferByteLocation = 0;
+    while (bufferByteLocation < (DWORD)size)
+    {
+        newDataBlock = *bytesFilePosition / getBlocksize();
+        newDataSector = *bytesFilePosition % getBlocksize() / SECTOR_SIZE;
+        newDataSectorOffset = *bytesFilePosition % SECTOR_SIZE;
+
+        DWORD data_address = HOLE_SECTOR;
+        if (newDataBlock < fileInode->blocksFileSize && getDataBlockSectorAddress(newDataBlock, newDataSector, fileInode, &data_address) != 0)
+        {
+            printf("ERROR: Failed reading record\n");
+            free(data_buffer);
+            free(zero_block);
+            free(requests);
+            freeUnusedBlocks(newBlocks, newBlocksUsed, newBlocksQuantity);
+            free(newBlocks);
+            return -1;
+        }
+
+        //===============New block allocation========================
+        // Blocks past the end of the file, and holes, get a block of their own.
+        // The index blocks on the way are allocated as they are needed.
+        if (data_address == HOLE_SECTOR)
+        {
+            newInodeBlock = takeNewBlock(newBlocks, newBlocksQuantity, &newBlocksUsed);
+            if (newInodeBlock == (DWORD)-1 || (newDataBlock >= fileInode->blocksFileSize && growBlocks(fileInode, newDataBlock) != 0) || mapBlock(fileInode, newDataBlock, newInodeBlock) != 0)
+            {
+                printf("ERROR: Couldn't map block %u of the file.\n", newDataBlock);
+                if (newInodeBlock != (DWORD)-1)
+                    setBitmap2(BITMAP_DADOS, newInodeBlock, 0);
+                free(data_buffer);
+                free(zero_block);
+                free(requests);
+                freeUnusedBlocks(newBlocks, newBlocksUsed, newBlocksQuantity);
+                free(newBlocks);
+                return -1;
+            }
+
+            DWORD blockAddress = getDataBlocksFirstSector(getPartition(), getSuperblock()) + newInodeBlock * getSuperblock()->blockSize;
+            data_address = blockAddress + newDataSector;
+
+            // What this write leaves of the block, before the end of the file or
+            // before where the write starts, must read as zeros
+            DWORD blockStart = newDataBlock * getBlocksize();
+            if (blockStart < initialBytesFilePosition || (blockStart + getBlocksize() > initialBytesFilePosition + size && blockStart < fileSize))
+            {
+                if (zero_block == NULL)
+                    zero_block = getZeroedBuffer(getBlocksize());
+                if (cacheWriteSectors(blockAddress, getSuperblock()->blockSize, zero_block) != 0)
+                {
+                    printf("ERROR: Failed writing record\n");
+                    free(data_buffer);
+                    free(zero_block);
+                    free(requests);
+                    freeUnusedBlocks(newBlocks, newBlocksUsed, newBlocksQuantity);
+                    free(newBlocks);
+                    return -1;
+                }
+            }
+        }
+        //===============End new block allocation========================
+
+        DWORD bytes = SECTOR_SIZE - newDataSectorOffset;
+        if (bytes > size - bufferByteLocation)
+            bytes = size - bufferByteLocation;
+
+        if (bytes < SECTOR_SIZE)
+        {
+            // A sector past the end of the file (as in a block we just allocated)
+            // holds nothing worth reading
+            if (*bytesFilePosition - newDataSectorOffset >= fileInode->bytesFileSize)
+                memset(data_buffer, 0, SECTOR_SIZE);
+            else if (cacheReadSector(data_address, data_buffer) != 0)
+            {
+                printf("ERROR: Failed reading record\n");
+                free(data_buffer);
+                free(zero_block);
+                free(requests);
+                freeUnusedBlocks(newBlocks, newBlocksUsed, newBlocksQuantity);
+                free(newBlocks);
+                return -1;
+            }
+            memcpy(data_buffer + newDataSectorOffset, buffer + bufferByteLocation, bytes);
+
+            // Partial sectors are kept in the cache, as the next small write2 will probably want them
+            if (cacheWriteSector(data_address, data_buffer) != 0)
+            {
+                printf("ERROR: Failed writing record\n");
+                free(data_buffer);
+                free(zero_block);
+                free(requests);
+                freeUnusedBlocks(newBlocks, newBlocksUsed, newBlocksQuantity);
+                free(newBlocks);
+                return -1;
+            }
+        }
+        else
+        {
+            // Every whole sector left in this block is written as it is, no need to read it
+            DWORD sectors = (size - bufferByteLocation) / SECTOR_SIZE;
+            if (sectors > getSuperblock()->blockSize - newDataSector)
+                sectors = getSuperblock()->blockSize - newDataSector;
+            bytes = sectors * SECTOR_SIZE;
+            BYTE *source = (BYTE *)buffer + bufferByteLocation;
+
+            // Queue the sectors, merging them with the previous ones when they are contiguous on disk and in memory
+            if (requestsQuantity > 0 && requests[requestsQuantity - 1].first + requests[requestsQuantity - 1].count == data_address && requests[requestsQuantity - 1].buffer + requests[requestsQuantity - 1].count * SECTOR_SIZE == source)
+                requests[requestsQuantity - 1].count += sectors;
+            else
+                requests[requestsQuantity++] = (SECTOR_REQUEST){data_address, sectors, source};
+        }
+
+        *bytesFilePosition += bytes;
+        bufferByteLocation += bytes;
+    }
+
+    if (cacheWriteBatch(requests, requestsQuantity) != 0)
+    {
+        printf("ERROR: Failed writing record\n");
+        free(data_buffer);
+        free(zero_block);
+        free(requests);
+        freeUnusedBlocks(newBlocks, newBlocksUsed, newBlocksQuantity);
+        free(newBlocks);
+        return -1;
+    }
+    free(data_buffer);
+    free(zero_block);
+    free(requests);
+
+    // Blocks allocated in advance and left unused are given back
+    freeUnusedBlocks(newBlocks, newBlocksUsed, newBlocksQuantity);
+    free(newBlocks);
+
+    if (size > 0 && *bytesFilePosition > fileInode->bytesFileSize)
+    {
+        fileInode->bytesFileSize = *bytesFilePosition;
+        markInodeDirty(fileInode);
+    }
+
+    // With a write-through cache the changed inode and bitmaps are saved once per
+    // write2. Otherwise the inode waits in core until the file is closed or synced,
+    // and the bitmaps until the partition is synced or unmounted
+    if (cacheGetMode() == CACHE_WRITE_THROUGH && ((((INODE_ENTRY *)fileInode)->dirty && writeInode(fileInode) != 0) || closeBitmap2() != 0))
+    {
+        printf("ERROR: Failed writing inode\n");
+        return -1;
+    }
+
+    return *bytesFilePosition - initialBytesFilePosition;
+}
+
+// Adds up the sizes of the `count` buffers of `vector`, or returns -1 if any of
+// them is negative or the total doesn't fit in an int
+static int getVectorSize(IOVEC2 *vector, int count)
+{
+    int total = 0;
+    for (int i = 0; i < count; i++)
+    {
+        if (vector[i].size < 0 || vector[i].size > INT_MAX - total)
+        {
+            printf("ERROR: Invalid size for buffer %d of the vector.\n", i);
+            return -1;
+        }
+        total += vector[i].size;
+    }
+
+    return total;
+}
+
+int writeFileVector(FILE2 handle, IOVEC2 *vector, int count)
+{
+    if (getVectorSize(vector, count) < 0)
+        return -1;
+
+    // Each buffer is written straight from where it is, one after the other, so
+    // nothing as big as the whole vector is ever allocated
+    int total = 0;
+    for (int i = 0; i < count; i++)
+    {
+        if (vector[i].size == 0)
+            continue;
+
+        int bytesWritten = writeFile(handle, vector[i].base, vector[i].size);
+        if (bytesWritten < 0)
+            return total > 0 ? total : -1;
+
+        total += bytesWritten;
+        if (bytesWritten < vector[i].size)
+            break;
+    }
+
+    return total;
+}
+
+// Reads the blocks in the read-ahead window of `file` into the cache. Nothing is
+// read until half of what was read ahead before has been consumed, so that the
+// device is always asked for big runs of blocks
+static void readAhead(OPEN_FILE *file)
+{
+    I_NODE *inode = file->inode;
+    DWORD blockSize = getSuperblock()->blockSize;
+    DWORD current = file->file_position / getBlocksize();
+
+    // Never use more than a quarter of the cache for it
+    CACHESTATS2 stats;
+    cacheGetStats(&stats);
+    DWORD window = file->readahead_window;
+    if (window > stats.capacity / 4 / blockSize)
+        window = stats.capacity / 4 / blockSize;
+
+    if (window == 0 || current + window / 2 < file->readahead_block)
+        return;
+
+    DWORD first = current > file->readahead_block ? current : file->readahead_block;
+    DWORD last = current + window < inode->blocksFileSize ? current + window : inode->blocksFileSize;
+
+    // Blocks which are contiguous on disk are read together
+    DWORD start = 0, count = 0;
+    for (DWORD block = first; block < last; block++)
+    {
+        DWORD address;
+        if (getDataBlockSectorAddress(block, 0, inode, &address) != 0)
+            return;
+
+        // Holes have nothing to read
+        if (address == HOLE_SECTOR)
+            continue;
+
+        if (count > 0 && start + count == address)
+            count += blockSize;
+        else
+        {
+            if (count > 0)
+                cachePrefetch(start, count);
+            start = address;
+            count = blockSize;
+        }
+    }
+    if (count > 0)
+        cachePrefetch(start, count);
+
+    if (last > file->readahead_block)
+        file->readahead_block = last;
+}
+
+int readFile(FILE2 handle, char *buffer, int size)
+{
+    OPEN_FILE *file = open_files[handle];
+
+    // Reading on from where the last read stopped doubles the read-ahead window,
+    // reading anywhere else closes it
+    if (file->file_position == file->readahead_position)
+        file->readahead_window = file->readahead_window == 0 ? 1 : file->readahead_window * 2;
+    else
+    {
+        file->readahead_window = 0;
+        file->readahead_block = 0;
+    }
+    if (file->readahead_window > READAHEAD_MAX_BLOCKS)
+        file->readahead_window = READAHEAD_MAX_BLOCKS;
+
+    if (file->file_position < file->inode->bytesFileSize)
+        readAhead(file);
+
+    int bytesRead = readFileAt(handle, buffer, size, &file->file_position);
+    if (bytesRead >= 0)
+        file->readahead_position = file->file_position;
+
+    return bytesRead;
+}
+
+int readFileAt(FILE2 handle, char *buffer, int size, DWORD *bytesFilePosition)
+{
+    I_NODE *fileInode = open_files[handle]->inode;
+
+    // Nothing to read at or past the end of the file
+    if (*bytesFilePosition >= fileInode->bytesFileSize)
+        return 0;
+
+    //where is my pointer
+    DWORD currentBlock = *bytesFilePosition / getBlocksize();
+    DWORD currentSector = *bytesFilePosition % getBlocksize() / SECTOR_SIZE;
+    DWORD currentSectorOffset = *bytesFilePosition % SECTOR_SIZE;
+
+    openBitmap2(getPartition()->firstSector);
+
+    int bufferOffsetTotal = 0;
+    int sizeSmallerThanOffset = 0;
+
+    // The partial sectors at both ends go through here, on the stack so that no
+    // return has to free it
+    BYTE file_buffer[SECTOR_SIZE];
+
+    if ((DWORD)size > fileInode->bytesFileSize - *bytesFilePosition)
+        size = fileInode->bytesFileSize - *bytesFilePosition;
+
+    if (size > 0)
+    {
+        if (currentSectorOffset > 0) //Test if exists any first sector offset to read
+        {
+
             if ((DWORD)size < SECTOR_SIZE - currentSectorOffset)
             {
                 sizeSmallerThanOffset = SECTOR_SIZE - size - currentSectorOffset;
@@ -678,31 +1153,62 @@ int readFile(FILE2 handle, char *buffer, int size)
 
     //Test if exists any full sector to read
     int numSectorsToRead = size / SECTOR_SIZE;
-    while (numSectorsToRead > 0)
+    if (numSectorsToRead > 0)
     {
+        // Translate every block first, so that all the full sectors are read in a single batch
+        SECTOR_REQUEST *requests = (SECTOR_REQUEST *)malloc(sizeof(SECTOR_REQUEST) * (numSectorsToRead / getSuperblock()->blockSize + 2));
+        int requestsQuantity = 0;
 
-        //where is my pointer now
-        currentBlock = *bytesFilePosition / getBlocksize();
-        currentSector = *bytesFilePosition % getBlocksize() / SECTOR_SIZE;
-
-        if (readDataBlockSector(currentBlock, currentSector, fileInode, (BYTE *)file_buffer) != 0)
+        while (numSectorsToRead > 0)
         {
-            printf("ERROR: Failed reading record\n");
-            return -1;
-        }
-        memcpy(buffer + bufferOffsetTotal, file_buffer, SECTOR_SIZE);
 
-        //updates the buffer offset
-        bufferOffsetTotal += SECTOR_SIZE;
+            //where is my pointer now
+            currentBlock = *bytesFilePosition / getBlocksize();
+            currentSector = *bytesFilePosition % getBlocksize() / SECTOR_SIZE;
+
+            // Every full sector left in this block goes straight into the user buffer
+            int sectorsInBlock = getSuperblock()->blockSize - currentSector;
+            if (sectorsInBlock > numSectorsToRead)
+                sectorsInBlock = numSectorsToRead;
+
+            DWORD address;
+            if (getDataBlockSectorAddress(currentBlock, currentSector, fileInode, &address) != 0)
+            {
+                printf("ERROR: Failed reading record\n");
+                free(requests);
+                return -1;
+            }
+
+            // Holes are read as zeros, and blocks which are contiguous on disk
+            // (and in the buffer) are merged into a single request
+            BYTE *destination = (BYTE *)buffer + bufferOffsetTotal;
+            if (address == HOLE_SECTOR)
+                memset(destination, 0, sectorsInBlock * SECTOR_SIZE);
+            else if (requestsQuantity > 0 && requests[requestsQuantity - 1].first + requests[requestsQuantity - 1].count == address && requests[requestsQuantity - 1].buffer + requests[requestsQuantity - 1].count * SECTOR_SIZE == destination)
+                requests[requestsQuantity - 1].count += sectorsInBlock;
+            else
+                requests[requestsQuantity++] = (SECTOR_REQUEST){address, sectorsInBlock, destination};
+
+            //updates the buffer offset
+            bufferOffsetTotal += sectorsInBlock * SECTOR_SIZE;
+
+            //update the filePosition
+            *bytesFilePosition += sectorsInBlock * SECTOR_SIZE;
 
-        //update the filePosition
-        *bytesFilePosition += SECTOR_SIZE;
+            //update the size left to read
+            size -= sectorsInBlock * SECTOR_SIZE;
 
-        //update the size left to read
-        size -= SECTOR_SIZE;
+            //decrease the number of sectors to read
+            numSectorsToRead -= sectorsInBlock;
+        }
 
-        //decrease the number of sectors to read
-        numSectorsToRead--;
+        if (cacheReadBatch(requests, requestsQuantity) != 0)
+        {
+            printf("ERROR: Failed reading record\n");
+            free(requests);
+            return -1;
+        }
+        free(requests);
     }
     if (size > 0)
     {
@@ -737,6 +1243,30 @@ int readFile(FILE2 handle, char *buffer, int size)
     return bufferOffsetTotal;
 }
 
+int readFileVector(FILE2 handle, IOVEC2 *vector, int count)
+{
+    if (getVectorSize(vector, count) < 0)
+        return -1;
+
+    // Each buffer is read straight into, one after the other, until the end of the file
+    int total = 0;
+    for (int i = 0; i < count; i++)
+    {
+        if (vector[i].size == 0)
+            continue;
+
+        int bytesRead = readFile(handle, vector[i].base, vector[i].size);
+        if (bytesRead < 0)
+            return total > 0 ? total : -1;
+
+        total += bytesRead;
+        if (bytesRead < vector[i].size)
+            break;
+    }
+
+    return total;
+}
+
 inline void openRoot()
 {
     rootOpened = TRUE;
@@ -841,135 +1371,462 @@ inline int getBlocksize()
     return superblock->blockSize * SECTOR_SIZE;
 }
 
-int readDataBlockSector(int block_number, int sector_number, I_NODE *inode, BYTE *buffer)
+inline void setCacheSize(DWORD sectors)
 {
-    // Doesn't try to access not existent blocks
-    if (block_number >= (int)inode->blocksFileSize)
-    {
-        printf("ERROR: Trying to acess not existent block");
-        return -1;
-    }
+    cacheSectors = sectors;
+}
 
-    DWORD direct_quantity = getInodeDirectQuantity();
-    DWORD simple_indirect_quantity = getInodeSimpleIndirectQuantity();
-    // DWORD double_indirect_quantity = getInodeDoubleIndirectQuantity();
+inline void setInodeFormat(int format)
+{
+    inodeFormat = format;
+}
 
-    DWORD double_ind_sector = inode->doubleIndPtr * getSuperblock()->blockSize;
-    DWORD simple_ind_sector = inode->singleIndPtr * getSuperblock()->blockSize;
-    DWORD no_ind_sector = inode->dataPtr[block_number > 2 ? 0 : block_number] * getSuperblock()->blockSize; // We fill with a 0 in the default case, because it will be filled later
+inline int getInodeFormat()
+{
+    return inodeFormat;
+}
 
-    if (block_number >= (int)direct_quantity + (int)simple_indirect_quantity)
+BYTE *readSectorInPlace(DWORD sector, BYTE *buffer)
+{
+    // When the disk is memory mapped we can just point into the mapping. Only the
+    // sectors the cache holds may be newer there, as it writes back what it evicts.
+    BYTE *data = map_sector(sector);
+    if (data != NULL)
     {
-        // Read with double indirection
-        DWORD shifted_block_number = block_number - direct_quantity - simple_indirect_quantity;
-
-        // We need to find where is the block with the simple indirection
-        DWORD double_ind_block_offset = (shifted_block_number / (getBlocksize() / sizeof(DWORD))) * sizeof(DWORD);
-        DWORD double_ind_block_sector_offset = double_ind_block_offset / SECTOR_SIZE;
-        DWORD double_ind_sector_offset = double_ind_block_offset % SECTOR_SIZE;
-        if ((read_sector(getDataBlocksFirstSector(getPartition(), getSuperblock()) + double_ind_sector + double_ind_block_sector_offset, buffer)) != 0)
-        {
-            printf("ERROR: Couldn't read double indirection first data block.\n");
-            return -1;
-        }
-
-        simple_ind_sector = *((DWORD *)(buffer + double_ind_sector_offset)) * getSuperblock()->blockSize;
-        block_number = (shifted_block_number % simple_indirect_quantity) + direct_quantity; // We add direct_quantity to make sense to discount it in the next indirection
+        BYTE *cached = cachePeekSector(sector);
+        return cached != NULL ? cached : data;
     }
 
-    if (block_number >= (int)direct_quantity)
-    {
-        // Read with simple indirection
-        DWORD shifted_block_number = block_number - direct_quantity; // To find out which block inside the indirection we should read
+    // Otherwise the mounted partition is read through its cache
+    data = cacheGetSector(sector);
+    if (data != NULL)
+        return data;
 
-        // We need to find where is the direct block
-        DWORD indirect_sector = (shifted_block_number * sizeof(DWORD)) / SECTOR_SIZE;
-        DWORD indirect_sector_position = (shifted_block_number * sizeof(DWORD)) % SECTOR_SIZE;
-        if ((read_sector(getDataBlocksFirstSector(getPartition(), getSuperblock()) + simple_ind_sector + indirect_sector, buffer)) != 0)
-        {
-            printf("ERROR: Couldn't read simple indirection data block.\n");
-            return -1;
-        }
+    if (read_sector(sector, buffer) != 0)
+        return NULL;
 
-        // Update this value to know where is the block to read
-        no_ind_sector = *((DWORD *)(buffer + indirect_sector_position)) * getSuperblock()->blockSize;
-    }
+    return buffer;
+}
 
-    // Read without indirection
-    DWORD block_to_read = no_ind_sector;
-    DWORD sector_to_read = block_to_read + sector_number;
+int readPointer(DWORD block_number, DWORD index, DWORD *pointer)
+{
+    BYTE buffer[SECTOR_SIZE];
+    DWORD sector = getDataBlocksFirstSector(getPartition(), getSuperblock()) + block_number * getSuperblock()->blockSize + (index * PTR_SIZE) / SECTOR_SIZE;
 
-    if ((read_sector(getDataBlocksFirstSector(getPartition(), getSuperblock()) + sector_to_read, buffer)) != 0)
-    {
-        printf("ERROR: Failed to read folder data sector.\n");
+    BYTE *data = readSectorInPlace(sector, buffer);
+    if (data == NULL)
         return -1;
-    }
+
+    memcpy(pointer, data + (index * PTR_SIZE) % SECTOR_SIZE, PTR_SIZE);
 
     return 0;
 }
 
-int writeDataBlockSector(int block_number, int sector_number, I_NODE *inode, BYTE *write_buffer)
+// Makes room in the block map of `entry` for `size` blocks
+static int growBlockMap(INODE_ENTRY *entry, DWORD size)
 {
-    // Doesn't try to access not existent blocks
-    if (block_number >= (int)inode->blocksFileSize)
-    {
-        printf("ERROR: Trying to acess not existent block");
+    if (size <= entry->mapSize)
+        return 0;
+
+    DWORD newSize = entry->mapSize > 0 ? entry->mapSize : 16;
+    while (newSize < size)
+        newSize *= 2;
+
+    DWORD *blockMap = (DWORD *)realloc(entry->blockMap, sizeof(DWORD) * newSize);
+    if (blockMap == NULL)
         return -1;
-    }
 
-    BYTE *buffer = getBuffer(sizeof(BYTE) * SECTOR_SIZE);
+    for (DWORD i = entry->mapSize; i < newSize; i++)
+        blockMap[i] = BLOCK_UNMAPPED;
+    entry->blockMap = blockMap;
+    entry->mapSize = newSize;
+
+    return 0;
+}
 
+// Translates the logical block `block_number` of `entry`. Indirect blocks are
+// read whole, and every translation found in them is remembered
+static int loadBlockMap(INODE_ENTRY *entry, DWORD block_number)
+{
+    I_NODE *inode = &entry->inode;
     DWORD direct_quantity = getInodeDirectQuantity();
     DWORD simple_indirect_quantity = getInodeSimpleIndirectQuantity();
-    // DWORD double_indirect_quantity = getInodeDoubleIndirectQuantity();
 
-    DWORD double_ind_sector = inode->doubleIndPtr * getSuperblock()->blockSize;
-    DWORD simple_ind_sector = inode->singleIndPtr * getSuperblock()->blockSize;
-    DWORD no_ind_sector = inode->dataPtr[block_number > 2 ? 0 : block_number] * getSuperblock()->blockSize; // We fill with a 0 in the default case, because it will be filled later
+    if (growBlockMap(entry, inode->blocksFileSize) != 0)
+        return -1;
 
-    if (block_number >= (int)direct_quantity + (int)simple_indirect_quantity)
+    if (block_number < direct_quantity)
     {
-        // Read with double indirection
-        DWORD shifted_block_number = block_number - direct_quantity - simple_indirect_quantity;
+        entry->blockMap[block_number] = inode->dataPtr[block_number];
+        return 0;
+    }
+
+    // Find the simple indirection block holding this block, and its first block
+    DWORD index_block = inode->singleIndPtr;
+    DWORD first_block = direct_quantity;
+    if (block_number >= direct_quantity + simple_indirect_quantity)
+    {
+        DWORD group = (block_number - direct_quantity - simple_indirect_quantity) / simple_indirect_quantity;
+        index_block = INVALID_PTR;
+        if (inode->doubleIndPtr != INVALID_PTR && readPointer(inode->doubleIndPtr, group, &index_block) != 0)
+            return -1;
+
+        first_block = direct_quantity + simple_indirect_quantity + group * simple_indirect_quantity;
+    }
+
+    // Every block of a missing index block is a hole
+    DWORD pointers[simple_indirect_quantity];
+    if (index_block == INVALID_PTR)
+        memset(pointers, 0, sizeof(pointers));
+    else if (getPointers(index_block, pointers) != 0)
+        return -1;
 
-        // We need to find where is the block with the simple indirection
-        DWORD double_ind_block_offset = (shifted_block_number / (getBlocksize() / sizeof(DWORD))) * sizeof(DWORD);
-        DWORD double_ind_block_sector_offset = double_ind_block_offset / SECTOR_SIZE;
-        DWORD double_ind_sector_offset = double_ind_block_offset % SECTOR_SIZE;
-        if ((read_sector(getDataBlocksFirstSector(getPartition(), getSuperblock()) + double_ind_sector + double_ind_block_sector_offset, buffer)) != 0)
+    // Blocks past the end of the file are left unmapped, they may be allocated later
+    for (DWORD i = 0; i < simple_indirect_quantity && first_block + i < inode->blocksFileSize; i++)
+        entry->blockMap[first_block + i] = pointers[i];
+
+    return 0;
+}
+
+void forgetBlockMap(I_NODE *inode, DWORD first_block)
+{
+    INODE_ENTRY *entry = (INODE_ENTRY *)inode;
+    for (DWORD i = first_block; i < entry->mapSize; i++)
+        entry->blockMap[i] = BLOCK_UNMAPPED;
+}
+
+inline BOOL isExtentInode(I_NODE *inode)
+{
+    return inode->reservado == INODE_EXTENTS;
+}
+
+// How many extents fit in an extent block, after the pointer to the next one
+static DWORD getExtentsPerBlock()
+{
+    return (getBlocksize() - PTR_SIZE) / sizeof(EXTENT);
+}
+
+// Makes room in the extents of `entry` for `size` extents
+static int growExtents(INODE_ENTRY *entry, DWORD size)
+{
+    if (size <= entry->extentSize && entry->extents != NULL)
+        return 0;
+
+    DWORD newSize = entry->extentSize > 0 ? entry->extentSize : 4;
+    while (newSize < size)
+        newSize *= 2;
+
+    EXTENT *extents = (EXTENT *)realloc(entry->extents, sizeof(EXTENT) * newSize);
+    if (extents == NULL)
+        return -1;
+
+    entry->extents = extents;
+    entry->extentSize = newSize;
+
+    return 0;
+}
+
+// Remembers `block` as the next block of the chain of extent blocks of `entry`
+static int addExtentBlock(INODE_ENTRY *entry, DWORD block)
+{
+    DWORD *blocks = (DWORD *)realloc(entry->extentBlocks, sizeof(DWORD) * (entry->extentBlockCount + 1));
+    if (blocks == NULL)
+        return -1;
+
+    blocks[entry->extentBlockCount++] = block;
+    entry->extentBlocks = blocks;
+
+    return 0;
+}
+
+// Forgets the in-core extents of `entry`, so they are read again on the next use
+static void dropExtents(INODE_ENTRY *entry)
+{
+    free(entry->extents);
+    free(entry->extentBlocks);
+    entry->extents = NULL;
+    entry->extentCount = 0;
+    entry->extentSize = 0;
+    entry->extentsDirty = 0;
+    entry->extentBlocks = NULL;
+    entry->extentBlockCount = 0;
+}
+
+// Reads every extent of `entry`, from the inode and then its chain of extent blocks
+static int loadExtents(INODE_ENTRY *entry)
+{
+    I_NODE *inode = &entry->inode;
+    DWORD count = inode->doubleIndPtr;
+    DWORD perBlock = getExtentsPerBlock();
+
+    dropExtents(entry);
+    if (growExtents(entry, count) != 0)
+        return -1;
+
+    if (count > 0)
+        entry->extents[entry->extentCount++] = (EXTENT){0, inode->dataPtr[0], inode->dataPtr[1]};
+
+    DWORD pointers[getBlocksize() / PTR_SIZE];
+    DWORD block = inode->singleIndPtr;
+    while (entry->extentCount < count)
+    {
+        if (block == INVALID_PTR || getPointers(block, pointers) != 0 || addExtentBlock(entry, block) != 0)
         {
-            printf("ERROR: Couldn't read double indirection first data block.\n");
+            dropExtents(entry);
             return -1;
         }
 
-        simple_ind_sector = *((DWORD *)(buffer + double_ind_sector_offset)) * getSuperblock()->blockSize;
-        block_number = (shifted_block_number % simple_indirect_quantity) + direct_quantity; // We add direct_quantity to make sense to discount it in the next indirection
+        DWORD quantity = count - entry->extentCount < perBlock ? count - entry->extentCount : perBlock;
+        memcpy(&entry->extents[entry->extentCount], pointers + 1, sizeof(EXTENT) * quantity);
+        entry->extentCount += quantity;
+        block = pointers[0];
     }
+    entry->extentsDirty = entry->extentCount;
 
-    if (block_number >= (int)direct_quantity)
+    return 0;
+}
+
+// Saves the extents of `entry` changed since they were loaded: the first one, and
+// how many there are, in the inode, and the others in their extent blocks, adding
+// blocks to the end of the chain when it is full
+static int saveExtents(INODE_ENTRY *entry)
+{
+    I_NODE *inode = &entry->inode;
+    DWORD perBlock = getExtentsPerBlock();
+
+    inode->dataPtr[0] = entry->extentCount > 0 ? entry->extents[0].physical : INVALID_PTR;
+    inode->dataPtr[1] = entry->extentCount > 0 ? entry->extents[0].length : 0;
+    inode->doubleIndPtr = entry->extentCount;
+
+    // First extent block holding a changed extent
+    DWORD blocksNeeded = entry->extentCount > 1 ? (entry->extentCount - 2) / perBlock + 1 : 0;
+    DWORD first = (entry->extentsDirty > 1 ? entry->extentsDirty - 1 : 0) / perBlock;
+
+    while (entry->extentBlockCount < blocksNeeded)
     {
-        // printf("------Single Indirection\n");
-        // Read with simple indirection
-        DWORD shifted_block_number = block_number - direct_quantity; // To find out which block inside the indirection we should read
+        int block = searchBitmap2(BITMAP_DADOS, 0);
+        if (block < 0 || setBitmap2(BITMAP_DADOS, block, 1) != 0 || addExtentBlock(entry, block) != 0)
+        {
+            printf("ERROR: There is no space left to save the extents.\n");
+            return -1;
+        }
+
+        // The previous block must point to the new one
+        if (entry->extentBlockCount == 1)
+            inode->singleIndPtr = block;
+        else if (first > entry->extentBlockCount - 2)
+            first = entry->extentBlockCount - 2;
+    }
+
+    DWORD pointers[getBlocksize() / PTR_SIZE];
+    for (DWORD b = first; b < blocksNeeded; b++)
+    {
+        DWORD firstExtent = 1 + b * perBlock;
+        DWORD quantity = entry->extentCount - firstExtent < perBlock ? entry->extentCount - firstExtent : perBlock;
+
+        memset(pointers, 0, getBlocksize());
+        pointers[0] = b + 1 < blocksNeeded ? entry->extentBlocks[b + 1] : INVALID_PTR;
+        memcpy(pointers + 1, &entry->extents[firstExtent], sizeof(EXTENT) * quantity);
 
-        // We need to find where is the direct block
-        DWORD indirect_sector = (shifted_block_number * sizeof(DWORD)) / SECTOR_SIZE;
-        DWORD indirect_sector_position = (shifted_block_number * sizeof(DWORD)) % SECTOR_SIZE;
-        if ((read_sector(getDataBlocksFirstSector(getPartition(), getSuperblock()) + simple_ind_sector + indirect_sector, buffer)) != 0)
+        DWORD sector = getDataBlocksFirstSector(getPartition(), getSuperblock()) + entry->extentBlocks[b] * getSuperblock()->blockSize;
+        if (cacheWriteSectors(sector, getSuperblock()->blockSize, (BYTE *)pointers) != 0)
         {
-            printf("ERROR: Couldn't read simple indirection data block.\n");
+            printf("ERROR: Couldn't write extent block %u.\n", entry->extentBlocks[b]);
             return -1;
         }
+    }
+    entry->extentsDirty = entry->extentCount;
+
+    return 0;
+}
+
+// Finds the extent of `entry` holding the logical block `block_number`, or NULL
+static EXTENT *findExtent(INODE_ENTRY *entry, DWORD block_number)
+{
+    DWORD low = 0, high = entry->extentCount;
+    while (low < high)
+    {
+        DWORD middle = (low + high) / 2;
+        if (entry->extents[middle].logical + entry->extents[middle].length <= block_number)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+
+    if (low < entry->extentCount && entry->extents[low].logical <= block_number)
+        return &entry->extents[low];
+
+    return NULL;
+}
+
+// Makes room for a new extent at the position `index` of the extents of `entry`
+static EXTENT *insertExtent(INODE_ENTRY *entry, DWORD index)
+{
+    if (growExtents(entry, entry->extentCount + 1) != 0)
+        return NULL;
+
+    memmove(&entry->extents[index + 1], &entry->extents[index], sizeof(EXTENT) * (entry->extentCount - index));
+    entry->extentCount++;
+
+    return &entry->extents[index];
+}
+
+int mapExtentBlock(I_NODE *inode, DWORD logical, DWORD physical)
+{
+    INODE_ENTRY *entry = (INODE_ENTRY *)inode;
+    if (entry->extents == NULL && loadExtents(entry) != 0)
+        return -1;
+
+    // The first extent after the block
+    DWORD low = 0, high = entry->extentCount;
+    while (low < high)
+    {
+        DWORD middle = (low + high) / 2;
+        if (entry->extents[middle].logical <= logical)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    DWORD next = low;
+    DWORD changed = next > 0 ? next - 1 : 0;
+
+    // A block of the hole the file starts with cuts it short. Whatever is left
+    // of the hole after the block is just a gap between extents.
+    EXTENT *before = next > 0 ? &entry->extents[next - 1] : NULL;
+    if (before != NULL && before->physical == INVALID_PTR && logical < before->logical + before->length)
+    {
+        before->length = logical - before->logical;
+        if (before->length == 0)
+        {
+            memmove(before, before + 1, sizeof(EXTENT) * (entry->extentCount - next));
+            entry->extentCount--;
+            next--;
+        }
+    }
+
+    before = next > 0 && entry->extents[next - 1].physical != INVALID_PTR ? &entry->extents[next - 1] : NULL;
+    EXTENT *after = next < entry->extentCount ? &entry->extents[next] : NULL;
+    if (before != NULL && before->logical + before->length == logical && before->physical + before->length == physical)
+    {
+        before->length++;
 
-        // Update this value to know where is the block to read
-        no_ind_sector = *((DWORD *)(buffer + indirect_sector_position)) * getSuperblock()->blockSize;
+        // The block may fill the gap up to the next extent
+        if (after != NULL && after->logical == logical + 1 && after->physical == physical + 1)
+        {
+            before->length += after->length;
+            memmove(after, after + 1, sizeof(EXTENT) * (entry->extentCount - next - 1));
+            entry->extentCount--;
+        }
+    }
+    else if (after != NULL && after->logical == logical + 1 && after->physical == physical + 1)
+    {
+        after->logical--;
+        after->physical--;
+        after->length++;
+        changed = next;
+    }
+    else
+    {
+        EXTENT *extent = insertExtent(entry, next);
+        if (extent == NULL)
+            return -1;
+        *extent = (EXTENT){logical, physical, 1};
+        changed = next < changed ? next : changed;
+    }
+
+    // The first extent starts at the logical block 0, even if it is a hole
+    if (entry->extents[0].logical > 0)
+    {
+        EXTENT *hole = insertExtent(entry, 0);
+        if (hole == NULL)
+            return -1;
+        *hole = (EXTENT){0, INVALID_PTR, entry->extents[1].logical};
+        changed = 0;
+    }
+
+    if (entry->extentsDirty > changed)
+        entry->extentsDirty = changed;
+    entry->dirty = TRUE;
+
+    return 0;
+}
+
+int getDataBlockSectorAddress(int block_number, int sector_number, I_NODE *inode, DWORD *address)
+{
+    // Doesn't try to access not existent blocks
+    if (block_number >= (int)inode->blocksFileSize)
+    {
+        printf("ERROR: Trying to acess not existent block");
+        return -1;
     }
 
-    // Read without indirection
-    DWORD block_to_write = no_ind_sector;
-    DWORD sector_to_write = block_to_write + sector_number;
+    INODE_ENTRY *entry = (INODE_ENTRY *)inode;
+    DWORD data_block;
+    if (isExtentInode(inode))
+    {
+        // A single lookup covers every block of a contiguous file
+        if (entry->extents == NULL && loadExtents(entry) != 0)
+        {
+            printf("ERROR: Couldn't read the extents of block %d.\n", block_number);
+            return -1;
+        }
 
-    if ((write_sector(getDataBlocksFirstSector(getPartition(), getSuperblock()) + sector_to_write, write_buffer)) != 0)
+        // Blocks no extent maps are holes
+        EXTENT *extent = findExtent(entry, block_number);
+        if (extent == NULL || extent->physical == INVALID_PTR)
+        {
+            *address = HOLE_SECTOR;
+            return 0;
+        }
+        data_block = extent->physical + block_number - extent->logical;
+    }
+    else
+    {
+        // Translations are remembered, so the index blocks are only read once
+        if ((DWORD)block_number >= entry->mapSize || entry->blockMap[block_number] == BLOCK_UNMAPPED)
+        {
+            if (loadBlockMap(entry, block_number) != 0)
+            {
+                printf("ERROR: Couldn't read the indirection blocks of block %d.\n", block_number);
+                return -1;
+            }
+        }
+        data_block = entry->blockMap[block_number];
+
+        // The root directory starts at the data block 0, so in any other file
+        // an invalid pointer is a hole
+        if (data_block == INVALID_PTR && entry->number != 0)
+        {
+            *address = HOLE_SECTOR;
+            return 0;
+        }
+    }
+
+    *address = getDataBlocksFirstSector(getPartition(), getSuperblock()) + data_block * getSuperblock()->blockSize + sector_number;
+
+    return 0;
+}
+
+int readDataBlockSectors(int block_number, int first_sector, int count, I_NODE *inode, BYTE *buffer)
+{
+    DWORD sector;
+    if (first_sector + count > getSuperblock()->blockSize)
+    {
+        printf("ERROR: Trying to read past the end of block %d.\n", block_number);
+        return -1;
+    }
+
+    if (getDataBlockSectorAddress(block_number, first_sector, inode, &sector) != 0)
+        return -1;
+
+    if (sector == HOLE_SECTOR)
+    {
+        memset(buffer, 0, count * SECTOR_SIZE);
+        return 0;
+    }
+
+    // The sectors of a block are contiguous on disk, so a single call is enough
+    if (cacheReadSectors(sector, count, buffer) != 0)
     {
         printf("ERROR: Failed to read folder data sector.\n");
         return -1;
@@ -978,6 +1835,43 @@ int writeDataBlockSector(int block_number, int sector_number, I_NODE *inode, BYT
     return 0;
 }
 
+int writeDataBlockSectors(int block_number, int first_sector, int count, I_NODE *inode, BYTE *write_buffer)
+{
+    DWORD sector;
+    if (first_sector + count > getSuperblock()->blockSize)
+    {
+        printf("ERROR: Trying to write past the end of block %d.\n", block_number);
+        return -1;
+    }
+
+    if (getDataBlockSectorAddress(block_number, first_sector, inode, &sector) != 0)
+        return -1;
+
+    if (sector == HOLE_SECTOR)
+    {
+        printf("ERROR: Block %d is a hole.\n", block_number);
+        return -1;
+    }
+
+    if (cacheWriteSectors(sector, count, write_buffer) != 0)
+    {
+        printf("ERROR: Failed to write folder data sector.\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+int readDataBlockSector(int block_number, int sector_number, I_NODE *inode, BYTE *buffer)
+{
+    return readDataBlockSectors(block_number, sector_number, 1, inode, buffer);
+}
+
+int writeDataBlockSector(int block_number, int sector_number, I_NODE *inode, BYTE *write_buffer)
+{
+    return writeDataBlockSectors(block_number, sector_number, 1, inode, write_buffer);
+}
+
 inline BYTE *getBuffer(size_t size)
 {
     return (BYTE *)malloc(size);
@@ -991,10 +1885,62 @@ inline BYTE *getZeroedBuffer(size_t size)
     return buffer;
 }
 
+static INODE_ENTRY *findInode(DWORD inodeNumber)
+{
+    INODE_ENTRY *entry = inode_table[inodeNumber % INODE_HASH_SIZE];
+    while (entry != NULL && entry->number != inodeNumber)
+        entry = entry->next;
+
+    return entry;
+}
+
+// Unlinks and frees the entry, writing it back first if it is dirty
+static void freeInodeEntry(INODE_ENTRY *entry)
+{
+    INODE_ENTRY **link = &inode_table[entry->number % INODE_HASH_SIZE];
+    while (*link != entry)
+        link = &(*link)->next;
+    *link = entry->next;
+
+    if (entry->dirty)
+        writeInode(&entry->inode);
+
+    free(entry->blockMap);
+    dropExtents(entry);
+    free(entry);
+    cached_inodes--;
+}
+
+// Frees the inodes nobody is using, once there are too many of them
+static void trimInodes()
+{
+    for (int i = 0; i < INODE_HASH_SIZE && cached_inodes > INODE_CACHE_LIMIT; i++)
+    {
+        INODE_ENTRY *entry = inode_table[i];
+        while (entry != NULL && cached_inodes > INODE_CACHE_LIMIT)
+        {
+            INODE_ENTRY *next = entry->next;
+            if (entry->references == 0)
+                freeInodeEntry(entry);
+            entry = next;
+        }
+    }
+}
+
 I_NODE *getInode(DWORD inodeNumber)
 {
-    I_NODE *inode = (I_NODE *)malloc(sizeof(I_NODE));
-    BYTE *buffer = getBuffer(sizeof(BYTE) * SECTOR_SIZE);
+    INODE_ENTRY *entry = findInode(inodeNumber);
+    if (entry != NULL)
+    {
+        entry->references++;
+        return &entry->inode;
+    }
+
+    trimInodes();
+
+    entry = (INODE_ENTRY *)malloc(sizeof(INODE_ENTRY));
+    I_NODE *inode = &entry->inode;
+    BYTE buffer[SECTOR_SIZE];
 
     // We need to compute what is the position of the Inode
     // We can take in consideration that all inode sectors are consecutive,
@@ -1002,19 +1948,115 @@ I_NODE *getInode(DWORD inodeNumber)
     DWORD inodeSector = (inodeNumber * sizeof(I_NODE)) / SECTOR_SIZE;
     DWORD inodeSectorOffset = (inodeNumber * sizeof(I_NODE)) % SECTOR_SIZE;
 
-    if ((read_sector(getInodesFirstSector(getPartition(), getSuperblock()) + inodeSector, buffer)) != 0)
+    BYTE *data = readSectorInPlace(getInodesFirstSector(getPartition(), getSuperblock()) + inodeSector, buffer);
+    if (data == NULL)
     {
         printf("ERROR: Couldn't read inode.\n");
+        free(entry);
         return NULL;
     }
-    memcpy((BYTE *)inode, (BYTE *)(buffer + inodeSectorOffset), sizeof(I_NODE));
-
-    // Remember to free dynamically allocated memory
-    free(buffer);
+    memcpy((BYTE *)inode, (BYTE *)(data + inodeSectorOffset), sizeof(I_NODE));
+
+    entry->number = inodeNumber;
+    entry->references = 1;
+    entry->dirty = FALSE;
+    entry->blockMap = NULL;
+    entry->mapSize = 0;
+    entry->extents = NULL;
+    entry->extentBlocks = NULL;
+    dropExtents(entry);
+    entry->next = inode_table[inodeNumber % INODE_HASH_SIZE];
+    inode_table[inodeNumber % INODE_HASH_SIZE] = entry;
+    cached_inodes++;
 
     return inode;
 }
 
+void releaseInode(I_NODE *inode)
+{
+    if (inode == NULL)
+        return;
+
+    // Nobody else is using it, so it is a good time to save the changes
+    INODE_ENTRY *entry = (INODE_ENTRY *)inode;
+    if (--entry->references == 0 && entry->dirty)
+        writeInode(inode);
+}
+
+inline void markInodeDirty(I_NODE *inode)
+{
+    ((INODE_ENTRY *)inode)->dirty = TRUE;
+}
+
+int writeInode(I_NODE *inode)
+{
+    INODE_ENTRY *entry = (INODE_ENTRY *)inode;
+    BYTE buffer[SECTOR_SIZE];
+
+    DWORD inodeSector = getInodesFirstSector(getPartition(), getSuperblock()) + (entry->number * sizeof(I_NODE)) / SECTOR_SIZE;
+    DWORD inodeSectorOffset = (entry->number * sizeof(I_NODE)) % SECTOR_SIZE;
+
+    // The first extent, and how many there are, live in the inode itself
+    if (entry->extents != NULL && entry->extentsDirty < entry->extentCount && saveExtents(entry) != 0)
+        return -1;
+
+    if (cacheReadSector(inodeSector, buffer) != 0)
+    {
+        printf("ERROR: Couldn't read inode %u.\n", entry->number);
+        return -1;
+    }
+    memcpy(buffer + inodeSectorOffset, inode, sizeof(I_NODE));
+    if (cacheWriteSector(inodeSector, buffer) != 0)
+    {
+        printf("ERROR: Couldn't write inode %u.\n", entry->number);
+        return -1;
+    }
+
+    entry->dirty = FALSE;
+
+    return 0;
+}
+
+int syncInodes()
+{
+    int result = 0;
+
+    for (int i = 0; i < INODE_HASH_SIZE; i++)
+        for (INODE_ENTRY *entry = inode_table[i]; entry != NULL; entry = entry->next)
+            if (entry->dirty && writeInode(&entry->inode) != 0)
+                result = -1;
+
+    return result;
+}
+
+void dropInodes()
+{
+    for (int i = 0; i < INODE_HASH_SIZE; i++)
+        while (inode_table[i] != NULL)
+            freeInodeEntry(inode_table[i]);
+}
+
+void discardInodes()
+{
+    for (int i = 0; i < INODE_HASH_SIZE; i++)
+        while (inode_table[i] != NULL)
+        {
+            inode_table[i]->dirty = FALSE;
+            freeInodeEntry(inode_table[i]);
+        }
+}
+
+int countInodeReferences()
+{
+    int references = 0;
+
+    for (int i = 0; i < INODE_HASH_SIZE; i++)
+        for (INODE_ENTRY *entry = inode_table[i]; entry != NULL; entry = entry->next)
+            references += entry->references;
+
+    return references;
+}
+
 inline int getCurrentDirectoryEntryIndex()
 {
     return rootFolderFileIndex;
@@ -1037,99 +2079,685 @@ int getRecordByNumber(int number, RECORD *record)
     DWORD sector_position = block_position % SECTOR_SIZE;
 
     I_NODE *rootFolderInode = getInode(0);
-    BYTE *buffer = getBuffer(sizeof(BYTE) * SECTOR_SIZE);
-    if (readDataBlockSector(block, sector, rootFolderInode, buffer) != 0)
+    BYTE buffer[SECTOR_SIZE];
+    DWORD address;
+    BYTE *data = NULL;
+    if (getDataBlockSectorAddress(block, sector, rootFolderInode, &address) == 0)
+        data = readSectorInPlace(address, buffer);
+
+    // Releasing the inode may write it back through the cache, and reuse the
+    // entry `data` points to, so the record is copied first
+    if (data != NULL)
+        memcpy(record, data + sector_position, sizeof(RECORD));
+    releaseInode(rootFolderInode);
+    if (data == NULL)
     {
         printf("ERROR: Couldn't read directory entry");
         return -1;
     }
-    memcpy(record, buffer + sector_position, sizeof(RECORD));
 
     return 0;
 }
 
 int getPointers(DWORD blockNumber, DWORD *pointers)
 {
-    unsigned char buffer[SECTOR_SIZE];
+    // Pointers are stored in the data area, and the whole block is read at once
+    DWORD sectorNumber = getDataBlocksFirstSector(getPartition(), getSuperblock()) + blockNumber * getSuperblock()->blockSize;
+    if (cacheReadSectors(sectorNumber, getSuperblock()->blockSize, (BYTE *)pointers) != 0)
+    {
+        printf("ERROR: Couldn't read pointers block %d.\n", blockNumber);
+        return -1;
+    }
 
-    for (int i = 0; i < getSuperblock()->blockSize; i++) // For all sector of block
+    return 0;
+}
+
+// Adds the `count` blocks from `first` on to the run of blocks being freed in
+// `range`, freeing that run first if they don't follow it. A count of 0 just
+// frees what is in `range`.
+static void freeBlockRange(DWORD range[2], DWORD first, DWORD count)
+{
+    if (range[1] > 0 && count > 0 && range[0] + range[1] == first)
+    {
+        range[1] += count;
+        return;
+    }
+
+    if (range[1] > 0)
+        setRangeBitmap2(BITMAP_DADOS, range[0], range[1], 0);
+    range[0] = first;
+    range[1] = count;
+}
+
+// Frees the first `quantity` blocks pointed by `pointers`, merging the contiguous
+// ones. Invalid pointers are holes, with no block to free.
+static void freePointers(DWORD range[2], DWORD *pointers, DWORD quantity)
+{
+    for (DWORD i = 0; i < quantity; i++)
+        if (pointers[i] != INVALID_PTR)
+            freeBlockRange(range, pointers[i], 1);
+}
+
+// The index blocks of the double indirection used by a file with `blocks` blocks
+static DWORD getDoubleIndirectGroups(DWORD blocks)
+{
+    DWORD first_block = getInodeDirectQuantity() + getInodeSimpleIndirectQuantity();
+    if (blocks <= first_block)
+        return 0;
+
+    return (blocks - first_block + getInodeSimpleIndirectQuantity() - 1) / getInodeSimpleIndirectQuantity();
+}
+
+// Frees the blocks of the double indirection of `inode` from its block `from` on,
+// along with the index blocks left with nothing to point to. Every index block
+// involved is read in a single batch.
+static int freeDoubleIndirection(I_NODE *inode, DWORD range[2], DWORD from)
+{
+    DWORD pointers_quantity = getInodeSimpleIndirectQuantity();
+    DWORD first_block = getInodeDirectQuantity() + pointers_quantity;
+    if (from < first_block)
+        from = first_block;
+
+    if (from >= inode->blocksFileSize || inode->doubleIndPtr == INVALID_PTR)
+        return 0;
+
+    DWORD doublePointers[pointers_quantity];
+    if (getPointers(inode->doubleIndPtr, doublePointers) != 0)
+        return -1;
+
+    DWORD firstGroup = (from - first_block) / pointers_quantity;
+    DWORD groups = getDoubleIndirectGroups(inode->blocksFileSize) - firstGroup;
+
+    DWORD *indexes = (DWORD *)malloc(sizeof(DWORD) * pointers_quantity * groups);
+    SECTOR_REQUEST *requests = (SECTOR_REQUEST *)malloc(sizeof(SECTOR_REQUEST) * groups);
+    int requestsQuantity = 0;
+    for (DWORD j = 0; j < groups; j++)
     {
-        int sectorNumber = blockNumber * getSuperblock()->blockSize + i;
-        read_sector(sectorNumber, buffer);
+        if (doublePointers[firstGroup + j] == INVALID_PTR)
+            continue;
+
+        DWORD sector = getDataBlocksFirstSector(getPartition(), getSuperblock()) + doublePointers[firstGroup + j] * getSuperblock()->blockSize;
+        BYTE *buffer = (BYTE *)(indexes + j * pointers_quantity);
+        if (requestsQuantity > 0 && requests[requestsQuantity - 1].first + requests[requestsQuantity - 1].count == sector && requests[requestsQuantity - 1].buffer + requests[requestsQuantity - 1].count * SECTOR_SIZE == buffer)
+            requests[requestsQuantity - 1].count += getSuperblock()->blockSize;
+        else
+            requests[requestsQuantity++] = (SECTOR_REQUEST){sector, getSuperblock()->blockSize, buffer};
+    }
 
-        for (int j = 0; j < PTR_PER_SECTOR; j++) // For all record of sector
-            pointers[j + i * PTR_PER_SECTOR] = *((DWORD *)(buffer + j * PTR_SIZE));
+    int result = cacheReadBatch(requests, requestsQuantity);
+    if (result == 0)
+    {
+        // The first group may keep its first blocks, and its index block with them
+        for (DWORD j = 0; j < groups; j++)
+        {
+            DWORD index_block = doublePointers[firstGroup + j];
+            if (index_block == INVALID_PTR)
+                continue;
+
+            DWORD group_first = first_block + (firstGroup + j) * pointers_quantity;
+            DWORD start = from > group_first ? from - group_first : 0;
+            DWORD end = inode->blocksFileSize - group_first < pointers_quantity ? inode->blocksFileSize - group_first : pointers_quantity;
+            freePointers(range, indexes + j * pointers_quantity + start, end - start);
+            if (start == 0)
+                freeBlockRange(range, index_block, 1);
+        }
+
+        if (from == first_block)
+            freeBlockRange(range, inode->doubleIndPtr, 1);
     }
-    return 0;
+    else
+        printf("ERROR: Couldn't read the indirection blocks of the file.\n");
+
+    free(indexes);
+    free(requests);
+
+    return result;
 }
 
 void clearPointers(I_NODE *inode)
 {
-    int i, j;
-    DWORD pointers[PTR_PER_SECTOR * getBlocksize()];
-    DWORD doublePointers[PTR_PER_SECTOR * getBlocksize()];
+    DWORD pointers_quantity = getInodeSimpleIndirectQuantity();
+    DWORD direct_quantity = getInodeDirectQuantity();
+    DWORD range[2] = {0, 0};
+
+    DWORD numOfBlocks = inode->blocksFileSize;
+    forgetBlockMap(inode, 0);
 
-    int numOfBlocks = inode->blocksFileSize;
+    // Blocks are freed in runs, whole bitmap words at a time, so the cost
+    // follows the number of runs instead of the number of blocks
+    if (isExtentInode(inode))
+    {
+        INODE_ENTRY *entry = (INODE_ENTRY *)inode;
+        if (entry->extents == NULL && loadExtents(entry) != 0)
+            return;
+
+        for (DWORD i = 0; i < entry->extentCount; i++)
+            if (entry->extents[i].physical != INVALID_PTR)
+                freeBlockRange(range, entry->extents[i].physical, entry->extents[i].length);
+        for (DWORD i = 0; i < entry->extentBlockCount; i++)
+            freeBlockRange(range, entry->extentBlocks[i], 1);
+        freeBlockRange(range, 0, 0);
+
+        dropExtents(entry);
+        return;
+    }
 
     //Direct
+    freePointers(range, inode->dataPtr, numOfBlocks < direct_quantity ? numOfBlocks : direct_quantity);
+    numOfBlocks = numOfBlocks > direct_quantity ? numOfBlocks - direct_quantity : 0;
+
+    // Simple Indirection, and then its index block
+    DWORD pointers[pointers_quantity];
     if (numOfBlocks > 0)
-        setBitmap2(BITMAP_DADOS, inode->dataPtr[0], 0);
+    {
+        DWORD quantity = numOfBlocks < pointers_quantity ? numOfBlocks : pointers_quantity;
+        if (inode->singleIndPtr != INVALID_PTR && getPointers(inode->singleIndPtr, pointers) == 0)
+        {
+            freePointers(range, pointers, quantity);
+            freeBlockRange(range, inode->singleIndPtr, 1);
+        }
+    }
 
-    numOfBlocks--;
+    // Double Indirection
+    freeDoubleIndirection(inode, range, 0);
 
-    if (numOfBlocks > 0)
-        setBitmap2(BITMAP_DADOS, inode->dataPtr[1], 0);
+    freeBlockRange(range, 0, 0);
+}
 
-    numOfBlocks--;
+int truncateBlocks(I_NODE *inode, DWORD blocks)
+{
+    DWORD direct_quantity = getInodeDirectQuantity();
+    DWORD double_first = direct_quantity + getInodeSimpleIndirectQuantity();
+    DWORD range[2] = {0, 0};
+    int result = 0;
 
-    // Simple Indirection
-    if (numOfBlocks > 0)
+    if (blocks >= inode->blocksFileSize)
+        return 0;
+
+    if (isExtentInode(inode))
     {
-        getPointers(inode->singleIndPtr, pointers);
-        for (i = 0; i < PTR_PER_SECTOR * getBlocksize(); i++)
-            if (numOfBlocks > 0)
-            {
-                numOfBlocks--;
-                setBitmap2(BITMAP_DADOS, pointers[i], 0);
-            }
+        INODE_ENTRY *entry = (INODE_ENTRY *)inode;
+        if (entry->extents == NULL && loadExtents(entry) != 0)
+            return -1;
+
+        // The extents past the new end go whole, the one holding it is cut short
+        while (entry->extentCount > 0)
+        {
+            EXTENT *last = &entry->extents[entry->extentCount - 1];
+            if (last->logical + last->length <= blocks)
+                break;
+
+            DWORD keep = last->logical < blocks ? blocks - last->logical : 0;
+            if (last->physical != INVALID_PTR)
+                freeBlockRange(range, last->physical + keep, last->length - keep);
+            last->length = keep;
+            if (keep > 0)
+                break;
+            entry->extentCount--;
+        }
+
+        // So do the extent blocks no longer needed, and the new last one is saved
+        DWORD blocksNeeded = entry->extentCount > 1 ? (entry->extentCount - 2) / getExtentsPerBlock() + 1 : 0;
+        while (entry->extentBlockCount > blocksNeeded)
+            freeBlockRange(range, entry->extentBlocks[--entry->extentBlockCount], 1);
+        if (entry->extentBlockCount == 0)
+            inode->singleIndPtr = INVALID_PTR;
+
+        entry->extentsDirty = entry->extentCount > 0 ? entry->extentCount - 1 : 0;
+        result = saveExtents(entry);
     }
+    else
+    {
+        // The freed blocks before the double indirection are found in the block
+        // map, and merged into runs
+        DWORD dataFirstSector = getDataBlocksFirstSector(getPartition(), getSuperblock());
+        for (DWORD i = blocks; i < inode->blocksFileSize && i < double_first && result == 0; i++)
+        {
+            DWORD address;
+            if ((result = getDataBlockSectorAddress(i, 0, inode, &address)) == 0 && address != HOLE_SECTOR)
+                freeBlockRange(range, (address - dataFirstSector) / getSuperblock()->blockSize, 1);
+        }
+        for (DWORD i = blocks; i < direct_quantity; i++)
+            inode->dataPtr[i] = INVALID_PTR;
 
-    // Double Indirection
-    if (numOfBlocks > 0)
+        // Then the index blocks left with nothing to point to. Those covering
+        // nothing but holes may have never been allocated.
+        if (inode->blocksFileSize > direct_quantity && blocks <= direct_quantity)
+        {
+            if (inode->singleIndPtr != INVALID_PTR)
+                freeBlockRange(range, inode->singleIndPtr, 1);
+            inode->singleIndPtr = INVALID_PTR;
+        }
+
+        // The double indirection frees its own index blocks as it goes
+        if (result == 0)
+            result = freeDoubleIndirection(inode, range, blocks);
+        if (inode->blocksFileSize > double_first && blocks <= double_first && result == 0)
+            inode->doubleIndPtr = INVALID_PTR;
+    }
+    freeBlockRange(range, 0, 0);
+
+    if (result != 0)
+    {
+        printf("ERROR: Couldn't free the blocks past block %u.\n", blocks);
+        return -1;
+    }
+
+    inode->blocksFileSize = blocks;
+    forgetBlockMap(inode, blocks);
+    markInodeDirty(inode);
+
+    return 0;
+}
+
+// Saves the in-core superblock of the mounted partition
+static int writeSuperblock()
+{
+    BYTE buffer[SECTOR_SIZE];
+
+    if (cacheReadSector(getPartition()->firstSector, buffer) != 0)
+    {
+        printf("ERROR: Couldn't read the superblock.\n");
+        return -1;
+    }
+    memcpy(buffer, superblock, sizeof(SUPERBLOCK));
+    if (cacheWriteSector(getPartition()->firstSector, buffer) != 0)
+    {
+        printf("ERROR: Couldn't write the superblock.\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+// Frees up to RECLAIM_STEP_BLOCKS blocks of the first orphan, from its end, or
+// its inode once it has no blocks left. Returns 1 if there may be more to free,
+// 0 if there are no orphans or -1 on failure.
+static int reclaimStep()
+{
+    // Formatting another partition leaves its bitmaps open instead of the mounted one's
+    if (openBitmap2(getPartition()->firstSector) != 0)
+        return -1;
+
+    DWORD number = superblock->firstOrphan;
+    if (number == 0)
+        return 0;
+
+    I_NODE *inode = getInode(number);
+    if (inode == NULL)
+        return -1;
+
+    int result = 0;
+    if (inode->blocksFileSize > RECLAIM_STEP_BLOCKS)
+        result = truncateBlocks(inode, inode->blocksFileSize - RECLAIM_STEP_BLOCKS);
+    else if (inode->blocksFileSize > 0)
+    {
+        // The last blocks, and every index block, go at once
+        clearPointers(inode);
+        inode->blocksFileSize = 0;
+        markInodeDirty(inode);
+    }
+    else
+    {
+        // Only the inode is left: it leaves the list, and can be used again
+        superblock->firstOrphan = inode->bytesFileSize;
+        inode->bytesFileSize = 0;
+        markInodeDirty(inode);
+        if (writeSuperblock() != 0 || setBitmap2(BITMAP_INODE, number, 0) != 0)
+            result = -1;
+    }
+    releaseInode(inode);
+
+    if (cacheGetMode() == CACHE_WRITE_THROUGH && closeBitmap2() != 0)
+        result = -1;
+
+    return result == 0 ? 1 : -1;
+}
+
+// Waits on `reclaimer_cond` for a millisecond at most. Must be called holding `reclaimer_mutex`.
+static void napReclaimer()
+{
+    struct timespec until;
+    clock_gettime(CLOCK_REALTIME, &until);
+    until.tv_nsec += 1000000;
+    if (until.tv_nsec >= 1000000000)
+    {
+        until.tv_sec++;
+        until.tv_nsec -= 1000000000;
+    }
+    pthread_cond_timedwait(&reclaimer_cond, &reclaimer_mutex, &until);
+}
+
+static void *runReclaimer(void *arg)
+{
+    (void)arg;
+
+    pthread_mutex_lock(&reclaimer_mutex);
+    while (!reclaimer_stop)
     {
-        getPointers(inode->doubleIndPtr, doublePointers);
-        for (j = 0; j < PTR_PER_SECTOR * getBlocksize(); j++)
+        // Sleeps once there is nothing left (or it failed) until another file is deleted
+        if (!reclaimer_wake)
         {
-            if (doublePointers[j] != INVALID_PTR)
-            {
-                getPointers(doublePointers[j], pointers);
-                for (i = 0; i < PTR_PER_SECTOR * getBlocksize(); i++)
-                    if (numOfBlocks > 0)
-                    {
-                        numOfBlocks--;
-                        setBitmap2(BITMAP_DADOS, pointers[i], 0);
-                    }
-            }
+            pthread_cond_wait(&reclaimer_cond, &reclaimer_mutex);
+            continue;
+        }
+
+        // The library lock is only ever tried, never waited for, so whoever stops the
+        // reclaimer can join it while holding that lock, however many times
+        if (pthread_mutex_trylock(&library_lock) != 0)
+        {
+            napReclaimer();
+            continue;
         }
+
+        // A file deleted during the step wakes it up again
+        reclaimer_wake = FALSE;
+        pthread_mutex_unlock(&reclaimer_mutex);
+        int result = reclaimStep();
+        pthread_mutex_unlock(&library_lock);
+
+        pthread_mutex_lock(&reclaimer_mutex);
+        if (result > 0)
+            reclaimer_wake = TRUE;
+
+        // The library calls get their turn between the steps
+        pthread_mutex_unlock(&reclaimer_mutex);
+        sched_yield();
+        pthread_mutex_lock(&reclaimer_mutex);
     }
+    pthread_mutex_unlock(&reclaimer_mutex);
+
+    return NULL;
 }
 
-int getRecordByName(char *filename, RECORD *record)
+// Makes the reclaimer look for orphans to free
+static void wakeReclaimer()
+{
+    pthread_mutex_lock(&reclaimer_mutex);
+    reclaimer_wake = TRUE;
+    pthread_cond_broadcast(&reclaimer_cond);
+    pthread_mutex_unlock(&reclaimer_mutex);
+}
+
+static void startReclaimer()
+{
+    // Files deleted before the mount may have left orphans
+    reclaimer_stop = FALSE;
+    reclaimer_wake = TRUE;
+    if (pthread_create(&reclaimer, NULL, runReclaimer, NULL) != 0)
+    {
+        printf("ERROR: Couldn't start the orphan reclaimer, deleted files will be freed right away.\n");
+        reclaimOrphans();
+        return;
+    }
+
+    reclaimer_running = TRUE;
+}
+
+// Must be called holding the library lock
+static void stopReclaimer()
+{
+    if (!reclaimer_running)
+        return;
+
+    pthread_mutex_lock(&reclaimer_mutex);
+    reclaimer_stop = TRUE;
+    pthread_cond_broadcast(&reclaimer_cond);
+    pthread_mutex_unlock(&reclaimer_mutex);
+
+    pthread_join(reclaimer, NULL);
+    reclaimer_running = FALSE;
+}
+
+int addOrphan(I_NODE *inode)
+{
+    // The list goes through the inodes, and starts at the superblock. On failure
+    // both are left as they were, so the caller can undo the rest.
+    DWORD size = inode->bytesFileSize;
+    inode->bytesFileSize = superblock->firstOrphan;
+    if (writeInode(inode) != 0)
+    {
+        inode->bytesFileSize = size;
+        return -1;
+    }
+
+    superblock->firstOrphan = ((INODE_ENTRY *)inode)->number;
+    if (writeSuperblock() != 0)
+    {
+        superblock->firstOrphan = inode->bytesFileSize;
+        inode->bytesFileSize = size;
+        markInodeDirty(inode);
+        return -1;
+    }
+
+    // Once in the list the orphan is freed sooner or later, even if this fails
+    if (!reclaimer_running)
+    {
+        reclaimOrphans();
+        return 0;
+    }
+
+    wakeReclaimer();
+
+    return 0;
+}
+
+int reclaimOrphans()
+{
+    int result = 0;
+
+    // The reclaimer only works holding the lock, so it is never halfway through a step
+    pthread_mutex_lock(&library_lock);
+    if (superblock != NULL)
+        while ((result = reclaimStep()) > 0)
+            ;
+    pthread_mutex_unlock(&library_lock);
+
+    return result;
+}
+
+int lockLibrary()
+{
+    pthread_mutex_lock(&library_lock);
+
+    return 0;
+}
+
+void unlockLibrary(int *lock)
+{
+    (void)lock;
+    pthread_mutex_unlock(&library_lock);
+}
+
+// FNV-1a hash of a file name
+static DWORD hashName(char *name)
+{
+    DWORD hash = 2166136261u;
+    for (; *name != '\0'; name++)
+        hash = (hash ^ (BYTE)*name) * 16777619u;
+
+    return hash;
+}
+
+static DIRENT_ENTRY *findDirectoryEntry(char *filename)
+{
+    DIRENT_ENTRY *entry = dirent_table[hashName(filename) & (dirent_buckets - 1)];
+    while (entry != NULL && strcmp(entry->record.name, filename) != 0)
+        entry = entry->next;
+
+    return entry;
+}
+
+// Doubles the number of buckets, keeping about one entry per bucket
+static void growDirectoryEntries()
 {
+    DWORD buckets = dirent_buckets * 2;
+    DIRENT_ENTRY **table = (DIRENT_ENTRY **)calloc(buckets, sizeof(DIRENT_ENTRY *));
+
+    for (DWORD i = 0; i < dirent_buckets; i++)
+        while (dirent_table[i] != NULL)
+        {
+            DIRENT_ENTRY *entry = dirent_table[i];
+            dirent_table[i] = entry->next;
+
+            DWORD bucket = hashName(entry->record.name) & (buckets - 1);
+            entry->next = table[bucket];
+            table[bucket] = entry;
+        }
+
+    free(dirent_table);
+    dirent_table = table;
+    dirent_buckets = buckets;
+}
+
+// Scans the whole root directory once, indexing every valid record
+static int loadDirectoryEntries()
+{
+    RECORD record;
+
+    dirent_buckets = DIRENT_INITIAL_BUCKETS;
+    dirent_quantity = 0;
+    dirent_table = (DIRENT_ENTRY **)calloc(dirent_buckets, sizeof(DIRENT_ENTRY *));
+
     I_NODE *rootFolderInode = getInode(0);
-    int i;
     int filesQuantity = rootFolderInode->bytesFileSize / RECORD_SIZE;
+    releaseInode(rootFolderInode);
 
-    for (i = 0; i < filesQuantity; i++)
+    for (int i = 0; i < filesQuantity; i++)
     {
-        getRecordByNumber(i, record);
-        if (record->TypeVal != TYPEVAL_INVALIDO && strcmp(record->name, filename) == 0)
-            break;
+        if (getRecordByNumber(i, &record) != 0)
+        {
+            dropDirectoryEntries();
+            return -1;
+        }
+
+        // The first valid record with a name is the one a linear search would find
+        if (record.TypeVal != TYPEVAL_INVALIDO && findDirectoryEntry(record.name) == NULL)
+            addDirectoryEntry(i, &record);
+    }
+
+    return 0;
+}
+
+int getRecordIndexByName(char *filename, RECORD *record)
+{
+    if (dirent_table == NULL && loadDirectoryEntries() != 0)
+        return -1;
+
+    DIRENT_ENTRY *entry = findDirectoryEntry(filename);
+    if (entry == NULL)
+        return -1;
+
+    memcpy(record, &entry->record, sizeof(RECORD));
+
+    return entry->index;
+}
+
+int getRecordByName(char *filename, RECORD *record)
+{
+    return getRecordIndexByName(filename, record) >= 0 ? 0 : -1;
+}
+
+void addDirectoryEntry(int index, RECORD *record)
+{
+    // Nothing to keep up to date until someone looks a name up
+    if (dirent_table == NULL)
+        return;
+
+    if (dirent_quantity >= dirent_buckets)
+        growDirectoryEntries();
+
+    DIRENT_ENTRY *entry = (DIRENT_ENTRY *)malloc(sizeof(DIRENT_ENTRY));
+    memcpy(&entry->record, record, sizeof(RECORD));
+    entry->index = index;
+
+    DWORD bucket = hashName(record->name) & (dirent_buckets - 1);
+    entry->next = dirent_table[bucket];
+    dirent_table[bucket] = entry;
+    dirent_quantity++;
+}
+
+void removeDirectoryEntry(char *filename)
+{
+    if (dirent_table == NULL)
+        return;
+
+    DIRENT_ENTRY **link = &dirent_table[hashName(filename) & (dirent_buckets - 1)];
+    while (*link != NULL && strcmp((*link)->record.name, filename) != 0)
+        link = &(*link)->next;
+
+    if (*link == NULL)
+        return;
+
+    DIRENT_ENTRY *entry = *link;
+    *link = entry->next;
+    free(entry);
+    dirent_quantity--;
+}
+
+void dropDirectoryEntries()
+{
+    if (dirent_table == NULL)
+        return;
+
+    for (DWORD i = 0; i < dirent_buckets; i++)
+        while (dirent_table[i] != NULL)
+        {
+            DIRENT_ENTRY *entry = dirent_table[i];
+            dirent_table[i] = entry->next;
+            free(entry);
+        }
+
+    free(dirent_table);
+    dirent_table = NULL;
+    dirent_buckets = dirent_quantity = 0;
+}
+
+int appendRecord(I_NODE *dirInode, RECORD *record)
+{
+    DWORD position = dirInode->bytesFileSize;
+    DWORD block = position / getBlocksize();
+
+    // The directory gets a new block once a record doesn't fit in the ones it has
+    if (block >= dirInode->blocksFileSize)
+    {
+        int newBlock = searchBitmap2(BITMAP_DADOS, 0);
+        if (newBlock == -1 || setBitmap2(BITMAP_DADOS, newBlock, 1) != 0)
+        {
+            printf("ERROR: There is no space left to create a new directory entry.\n");
+            return -1;
+        }
+
+        if (growBlocks(dirInode, block) != 0 || mapBlock(dirInode, block, newBlock) != 0)
+        {
+            printf("ERROR: There was an error while trying to allocate space for a new directory entry.\n");
+            dirInode->blocksFileSize = block;
+            setBitmap2(BITMAP_DADOS, newBlock, 0);
+            return -1;
+        }
     }
 
-    // Didn't found
-    if (i == filesQuantity)
+    BYTE buffer[SECTOR_SIZE];
+    DWORD sector = position % getBlocksize() / SECTOR_SIZE;
+    if (readDataBlockSector(block, sector, dirInode, buffer) != 0)
+    {
+        printf("ERROR: Failed reading record\n");
         return -1;
+    }
+    memcpy(buffer + position % SECTOR_SIZE, record, sizeof(RECORD));
+    if (writeDataBlockSector(block, sector, dirInode, buffer) != 0)
+    {
+        printf("ERROR: Failed writing record\n");
+        return -1;
+    }
+    addDirectoryEntry(position / RECORD_SIZE, record);
+
+    dirInode->bytesFileSize += sizeof(RECORD);
+    if (writeInode(dirInode) != 0)
+    {
+        printf("ERROR: There was an error while trying to create a new directory entry.\n");
+        return -1;
+    }
 
     return 0;
 }
@@ -0,0 +1,399 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "t2fs.h"
+#include "t2space.h"
+
+#define BY_START 0
+#define BY_LENGTH 1
+
+// A run of free blocks, linked in both trees
+typedef struct free_run
+{
+    DWORD start;
+    DWORD length;
+    struct free_run *left[2], *right[2];
+    int height[2];
+    DWORD maxLength; // Longest run in its subtree of the BY_START tree
+} FREE_RUN;
+
+static struct
+{
+    FREE_RUN *roots[2];
+    DWORD runs;
+    DWORD blocks;
+} space = {{NULL, NULL}, 0, 0};
+
+// Orders the runs by start, or by length and then start
+static int compareRuns(int tree, FREE_RUN *a, FREE_RUN *b)
+{
+    if (tree == BY_LENGTH && a->length != b->length)
+        return a->length < b->length ? -1 : 1;
+
+    return a->start < b->start ? -1 : a->start > b->start;
+}
+
+static int height(int tree, FREE_RUN *node)
+{
+    return node != NULL ? node->height[tree] : 0;
+}
+
+static DWORD maxLength(FREE_RUN *node)
+{
+    return node != NULL ? node->maxLength : 0;
+}
+
+// Brings the height (and the longest run below) of `node` up to date with its children
+static void update(int tree, FREE_RUN *node)
+{
+    int left = height(tree, node->left[tree]);
+    int right = height(tree, node->right[tree]);
+    node->height[tree] = 1 + (left > right ? left : right);
+
+    if (tree == BY_START)
+    {
+        node->maxLength = node->length;
+        if (maxLength(node->left[tree]) > node->maxLength)
+            node->maxLength = maxLength(node->left[tree]);
+        if (maxLength(node->right[tree]) > node->maxLength)
+            node->maxLength = maxLength(node->right[tree]);
+    }
+}
+
+static FREE_RUN *rotateRight(int tree, FREE_RUN *node)
+{
+    FREE_RUN *left = node->left[tree];
+    node->left[tree] = left->right[tree];
+    left->right[tree] = node;
+    update(tree, node);
+    update(tree, left);
+
+    return left;
+}
+
+static FREE_RUN *rotateLeft(int tree, FREE_RUN *node)
+{
+    FREE_RUN *right = node->right[tree];
+    node->right[tree] = right->left[tree];
+    right->left[tree] = node;
+    update(tree, node);
+    update(tree, right);
+
+    return right;
+}
+
+// Rotates `node` until the heights of its subtrees differ by one at most
+static FREE_RUN *balance(int tree, FREE_RUN *node)
+{
+    update(tree, node);
+    int difference = height(tree, node->left[tree]) - height(tree, node->right[tree]);
+
+    if (difference > 1)
+    {
+        if (height(tree, node->left[tree]->left[tree]) < height(tree, node->left[tree]->right[tree]))
+            node->left[tree] = rotateLeft(tree, node->left[tree]);
+        return rotateRight(tree, node);
+    }
+    if (difference < -1)
+    {
+        if (height(tree, node->right[tree]->right[tree]) < height(tree, node->right[tree]->left[tree]))
+            node->right[tree] = rotateRight(tree, node->right[tree]);
+        return rotateLeft(tree, node);
+    }
+
+    return node;
+}
+
+static FREE_RUN *insertRun(int tree, FREE_RUN *node, FREE_RUN *run)
+{
+    if (node == NULL)
+    {
+        run->left[tree] = run->right[tree] = NULL;
+        update(tree, run);
+        return run;
+    }
+
+    if (compareRuns(tree, run, node) < 0)
+        node->left[tree] = insertRun(tree, node->left[tree], run);
+    else
+        node->right[tree] = insertRun(tree, node->right[tree], run);
+
+    return balance(tree, node);
+}
+
+// Unlinks the leftmost run below `node`, saving it in `min`
+static FREE_RUN *removeMin(int tree, FREE_RUN *node, FREE_RUN **min)
+{
+    if (node->left[tree] == NULL)
+    {
+        *min = node;
+        return node->right[tree];
+    }
+
+    node->left[tree] = removeMin(tree, node->left[tree], min);
+
+    return balance(tree, node);
+}
+
+static FREE_RUN *removeRun(int tree, FREE_RUN *node, FREE_RUN *run)
+{
+    if (node == NULL)
+        return NULL;
+
+    int order = compareRuns(tree, run, node);
+    if (order < 0)
+        node->left[tree] = removeRun(tree, node->left[tree], run);
+    else if (order > 0)
+        node->right[tree] = removeRun(tree, node->right[tree], run);
+    else
+    {
+        if (node->right[tree] == NULL)
+            return node->left[tree];
+
+        FREE_RUN *successor;
+        FREE_RUN *right = removeMin(tree, node->right[tree], &successor);
+        successor->left[tree] = node->left[tree];
+        successor->right[tree] = right;
+        node = successor;
+    }
+
+    return balance(tree, node);
+}
+
+static void linkRun(FREE_RUN *run)
+{
+    space.roots[BY_START] = insertRun(BY_START, space.roots[BY_START], run);
+    space.roots[BY_LENGTH] = insertRun(BY_LENGTH, space.roots[BY_LENGTH], run);
+}
+
+static void unlinkRun(FREE_RUN *run)
+{
+    space.roots[BY_START] = removeRun(BY_START, space.roots[BY_START], run);
+    space.roots[BY_LENGTH] = removeRun(BY_LENGTH, space.roots[BY_LENGTH], run);
+}
+
+// Returns the last run starting at or before the block `block`, or NULL
+static FREE_RUN *findFloor(DWORD block)
+{
+    FREE_RUN *found = NULL;
+    for (FREE_RUN *node = space.roots[BY_START]; node != NULL;)
+    {
+        if (node->start <= block)
+        {
+            found = node;
+            node = node->right[BY_START];
+        }
+        else
+            node = node->left[BY_START];
+    }
+
+    return found;
+}
+
+static void freeRuns(FREE_RUN *node)
+{
+    if (node == NULL)
+        return;
+
+    freeRuns(node->left[BY_START]);
+    freeRuns(node->right[BY_START]);
+    free(node);
+}
+
+void spaceClear()
+{
+    freeRuns(space.roots[BY_START]);
+    space.roots[BY_START] = space.roots[BY_LENGTH] = NULL;
+    space.runs = 0;
+    space.blocks = 0;
+}
+
+int spaceInsert(DWORD first, DWORD count)
+{
+    if (count == 0)
+        return 0;
+
+    FREE_RUN *before = first > 0 ? findFloor(first - 1) : NULL;
+    if (before != NULL && before->start + before->length != first)
+        before = NULL;
+
+    FREE_RUN *after = findFloor(first + count);
+    if (after != NULL && after->start != first + count)
+        after = NULL;
+
+    // Runs are taken out of the trees while their keys change
+    FREE_RUN *run = before != NULL ? before : after;
+    if (run == NULL)
+    {
+        run = (FREE_RUN *)malloc(sizeof(FREE_RUN));
+        if (run == NULL)
+        {
+            printf("ERROR: Couldn't allocate memory for the free space index.\n");
+            return -1;
+        }
+        run->start = first;
+        run->length = 0;
+        space.runs++;
+    }
+    else
+        unlinkRun(run);
+
+    if (run == after)
+        run->start = first;
+    run->length += count;
+
+    // Blocks joining two runs
+    if (run == before && after != NULL)
+    {
+        unlinkRun(after);
+        run->length += after->length;
+        free(after);
+        space.runs--;
+    }
+
+    linkRun(run);
+    space.blocks += count;
+
+    return 0;
+}
+
+int spaceRemove(DWORD first, DWORD count)
+{
+    if (count == 0)
+        return 0;
+
+    FREE_RUN *run = findFloor(first);
+    if (run == NULL || first + count > run->start + run->length)
+    {
+        printf("ERROR: Blocks %u to %u aren't free.\n", first, first + count - 1);
+        return -1;
+    }
+
+    // What is left after the blocks, if they are in the middle of the run
+    DWORD end = run->start + run->length;
+    FREE_RUN *tail = NULL;
+    if (first > run->start && first + count < end)
+    {
+        tail = (FREE_RUN *)malloc(sizeof(FREE_RUN));
+        if (tail == NULL)
+        {
+            printf("ERROR: Couldn't allocate memory for the free space index.\n");
+            return -1;
+        }
+        tail->start = first + count;
+        tail->length = end - tail->start;
+    }
+
+    unlinkRun(run);
+    if (first == run->start)
+    {
+        run->start += count;
+        run->length -= count;
+    }
+    else
+        run->length = first - run->start;
+
+    if (run->length > 0)
+        linkRun(run);
+    else
+    {
+        free(run);
+        space.runs--;
+    }
+
+    if (tail != NULL)
+    {
+        linkRun(tail);
+        space.runs++;
+    }
+    space.blocks -= count;
+
+    return 0;
+}
+
+int spaceFindRun(DWORD block, DWORD *first, DWORD *length)
+{
+    FREE_RUN *run = findFloor(block);
+    if (run == NULL || block >= run->start + run->length)
+        return -1;
+
+    *first = run->start;
+    *length = run->length;
+
+    return 0;
+}
+
+// First run of the subtree of `node` at or after `block` with `count` blocks or more
+static FREE_RUN *nextFit(FREE_RUN *node, DWORD block, DWORD count)
+{
+    if (node == NULL || node->maxLength < count)
+        return NULL;
+
+    if (node->start >= block)
+    {
+        FREE_RUN *found = nextFit(node->left[BY_START], block, count);
+        if (found != NULL)
+            return found;
+        if (node->length >= count)
+            return node;
+    }
+
+    return nextFit(node->right[BY_START], block, count);
+}
+
+int spaceNextFit(DWORD block, DWORD count, DWORD *first, DWORD *length)
+{
+    FREE_RUN *run = nextFit(space.roots[BY_START], block, count);
+    if (run == NULL)
+        return -1;
+
+    *first = run->start;
+    *length = run->length;
+
+    return 0;
+}
+
+int spaceBestFit(DWORD count, DWORD *first, DWORD *length)
+{
+    FREE_RUN *found = NULL;
+    for (FREE_RUN *node = space.roots[BY_LENGTH]; node != NULL;)
+    {
+        if (node->length >= count)
+        {
+            found = node;
+            node = node->left[BY_LENGTH];
+        }
+        else
+            node = node->right[BY_LENGTH];
+    }
+
+    if (found == NULL)
+        return -1;
+
+    *first = found->start;
+    *length = found->length;
+
+    return 0;
+}
+
+int spaceLargest(DWORD *first, DWORD *length)
+{
+    FREE_RUN *node = space.roots[BY_LENGTH];
+    if (node == NULL)
+        return -1;
+
+    while (node->right[BY_LENGTH] != NULL)
+        node = node->right[BY_LENGTH];
+
+    *first = node->start;
+    *length = node->length;
+
+    return 0;
+}
+
+void spaceGetStats(DWORD *runs, DWORD *blocks)
+{
+    *runs = space.runs;
+    *blocks = space.blocks;
+}
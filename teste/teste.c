@@ -0,0 +1,1294 @@
+/**
+
+    Testes de comportamento do T2FS
+
+    Cada teste escreve arquivos, remonta a partição, lê de volta e compara,
+    conferindo também quantos blocos livres sobram. Roda em um disco em memória,
+    para os dois formatos de inode e mais de um tamanho de bloco.
+    Uso: ./teste
+
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "t2fs.h"
+#include "apidisk.h"
+#include "bitmap2.h"
+#include "t2disk.h"
+#include "t2fslib.h"
+#include "t2space.h"
+#include "t2cache.h"
+
+#define DISK_SECTORS 16384
+
+// Fails the running test, telling which check didn't hold
+#define CHECK(condition)                                                    \
+    do                                                                      \
+    {                                                                       \
+        if (!(condition))                                                   \
+        {                                                                   \
+            printf("    %s:%d: %s\n", __FILE__, __LINE__, #condition);      \
+            return -1;                                                      \
+        }                                                                   \
+    } while (0)
+
+int testHoles();
+int testCache();
+int testWriteBack();
+int testInodes();
+int testNames();
+int testBlockMap();
+int testBitmaps();
+int testFull();
+int testExtents();
+int testSpace();
+int testFreeRuns();
+int testOrphans();
+int testOrphanFormat();
+int testPositional();
+int testTruncate();
+int testVector();
+int testAsync();
+
+struct
+{
+    char name[20];
+    int (*f)();
+} testList[] = {
+    {"holes", testHoles},
+    {"cache", testCache},
+    {"writeback", testWriteBack},
+    {"inodes", testInodes},
+    {"names", testNames},
+    {"blockmap", testBlockMap},
+    {"bitmaps", testBitmaps},
+    {"full", testFull},
+    {"extents", testExtents},
+    {"space", testSpace},
+    {"freeruns", testFreeRuns},
+    {"orphans", testOrphans},
+    {"orphanformat", testOrphanFormat},
+    {"positional", testPositional},
+    {"truncate", testTruncate},
+    {"vector", testVector},
+    {"async", testAsync},
+    {"fim", NULL}};
+
+// Bytes in a block of the mounted partition
+static int blockBytes()
+{
+    return getSuperblock()->blockSize * SECTOR_SIZE;
+}
+
+// Free blocks of the mounted partition, once every deleted file was freed
+static DWORD freeBlocks()
+{
+    DWORD runs, blocks;
+
+    reclaimOrphans();
+    lockLibrary();
+    spaceGetStats(&runs, &blocks);
+    unlockLibrary(NULL);
+
+    return blocks;
+}
+
+static int remount()
+{
+    return umount() == 0 && mount(0) == 0 ? 0 : -1;
+}
+
+// Fills `buffer` with bytes that depend on where they are in the file, and never zero
+static void fill(char *buffer, int size, int offset)
+{
+    for (int i = 0; i < size; i++)
+        buffer[i] = (char)((offset + i) % 251 + 1);
+}
+
+// Reads the whole of `filename` and compares it to `model`
+static int compareFile(char *filename, char *model, int size)
+{
+    char *buffer = (char *)malloc(size + 1);
+    FILE2 handle = open2(filename);
+    int result = handle >= 0 && read2(handle, buffer, size + 1) == size && memcmp(buffer, model, size) == 0 ? 0 : -1;
+
+    close2(handle);
+    free(buffer);
+
+    return result;
+}
+
+// Writes past the end with seek2 and pwrite2: the holes read back as zeros and take no blocks
+int testHoles()
+{
+    int block = blockBytes();
+    int size = 40 * block + 100;
+    char *model = (char *)calloc(size, 1);
+    char data[300], buffer[100];
+    DWORD freeBefore = freeBlocks();
+
+    FILE2 handle = create2("holes");
+    CHECK(handle >= 0);
+    fill(data, sizeof(data), 0);
+    CHECK(write2(handle, data, 10) == 10);
+    memcpy(model, data, 10);
+
+    // Whole blocks are skipped, and the write starts in the middle of one
+    CHECK(seek2(handle, 5 * block + 7) == 0);
+    CHECK(write2(handle, data, 100) == 100);
+    memcpy(model + 5 * block + 7, data, 100);
+
+    CHECK(pwrite2(handle, data, 100, size - 100) == 100);
+    memcpy(model + size - 100, data, 100);
+    CHECK(close2(handle) == 0);
+
+    // Three blocks of data, and at most one index block to reach the last one
+    CHECK(freeBefore - freeBlocks() <= 4);
+
+    CHECK(remount() == 0);
+    CHECK(compareFile("holes", model, size) == 0);
+
+    // Writing across the end of a hole fills only the blocks it touches
+    handle = open2("holes");
+    CHECK(handle >= 0);
+    fill(data, sizeof(data), 1);
+    CHECK(pwrite2(handle, data, sizeof(data), 20 * block - 150) == sizeof(data));
+    memcpy(model + 20 * block - 150, data, sizeof(data));
+    CHECK(close2(handle) == 0);
+    CHECK(freeBefore - freeBlocks() <= 6);
+
+    CHECK(remount() == 0);
+    CHECK(compareFile("holes", model, size) == 0);
+
+    CHECK(delete2("holes") == 0);
+    CHECK(freeBlocks() == freeBefore);
+
+    // Past the last block an inode of pointers can address, nothing is written
+    if (getInodeFormat() == INODE_FORMAT_INDIRECT)
+    {
+        DWORD pointers = block / sizeof(DWORD);
+        DWORD maxBytes = (2 + pointers + pointers * pointers) * block;
+
+        handle = create2("edge");
+        CHECK(handle >= 0);
+        CHECK(pwrite2(handle, data, 100, maxBytes - 40) == 40);
+        CHECK(pwrite2(handle, data, 100, maxBytes) == 0);
+        CHECK(pwrite2(handle, data, 100, maxBytes + 5 * block) == 0);
+        CHECK(close2(handle) == 0);
+
+        CHECK(remount() == 0);
+        handle = open2("edge");
+        CHECK(handle >= 0);
+        CHECK(pread2(handle, buffer, 100, maxBytes - 40) == 40);
+        CHECK(memcmp(buffer, data, 40) == 0);
+        CHECK(close2(handle) == 0);
+        CHECK(delete2("edge") == 0);
+        CHECK(freeBlocks() == freeBefore);
+    }
+
+    free(model);
+
+    return 0;
+}
+
+// The cache never holds more sectors than it was given, evicts the least recently
+// used ones, and serves what it holds again without reading the disk
+int testCache()
+{
+    CACHESTATS2 before, after;
+    char name[16];
+    char data[700], buffer[701];
+
+    CHECK(cachesize2(8) == 0);
+    CHECK(remount() == 0);
+    CHECK(cachestats2(&before) == 0);
+    CHECK(before.capacity == 8);
+
+    fill(data, sizeof(data), 0);
+    for (int i = 0; i < 40; i++)
+    {
+        sprintf(name, "cache%d", i);
+        FILE2 handle = create2(name);
+        CHECK(handle >= 0);
+        CHECK(write2(handle, data, sizeof(data) - i) == (int)sizeof(data) - i);
+        CHECK(close2(handle) == 0);
+    }
+    CHECK(cachestats2(&after) == 0);
+    CHECK(after.used <= after.capacity);
+    CHECK(after.evictions > 0);
+
+    // Everything still reads back right through a cache of a single sector
+    CHECK(cachesize2(1) == 0);
+    CHECK(remount() == 0);
+    for (int i = 0; i < 40; i++)
+    {
+        sprintf(name, "cache%d", i);
+        CHECK(compareFile(name, data, sizeof(data) - i) == 0);
+    }
+    CHECK(cachestats2(&after) == 0);
+    CHECK(after.capacity == 1 && after.used <= 1);
+
+    // Opening and reading the same small file again only hits
+    CHECK(cachesize2(CACHE_DEFAULT_SECTORS) == 0);
+    CHECK(remount() == 0);
+    CHECK(compareFile("cache0", data, sizeof(data)) == 0);
+    CHECK(cachestats2(&before) == 0);
+    CHECK(before.misses > 0);
+    FILE2 handle = open2("cache0");
+    CHECK(handle >= 0);
+    CHECK(read2(handle, buffer, sizeof(buffer)) == (int)sizeof(data));
+    CHECK(close2(handle) == 0);
+    CHECK(cachestats2(&after) == 0);
+    CHECK(after.misses == before.misses);
+    CHECK(after.hits > before.hits);
+
+    return 0;
+}
+
+// Write-back keeps changed sectors in the cache until sync2, umount or the dirty
+// ratio; write-through never leaves a sector changed only in the cache
+int testWriteBack()
+{
+    CACHESTATS2 before, after;
+    char data[2000];
+    char name[16];
+
+    fill(data, sizeof(data), 0);
+    CHECK(cachemode2(CACHE_WRITE_BACK, 100) == 0);
+    FILE2 handle = create2("writeback");
+    CHECK(handle >= 0);
+    CHECK(write2(handle, data, sizeof(data)) == (int)sizeof(data));
+    CHECK(close2(handle) == 0);
+    CHECK(cachestats2(&before) == 0);
+    CHECK(before.dirty > 0);
+
+    CHECK(sync2() == 0);
+    CHECK(cachestats2(&after) == 0);
+    CHECK(after.dirty == 0);
+    CHECK(after.writebacks >= before.writebacks + before.dirty);
+
+    // What umount writes back is there after the next mount
+    handle = open2("writeback");
+    CHECK(handle >= 0);
+    CHECK(pwrite2(handle, data + 1, 500, 1000) == 500);
+    CHECK(close2(handle) == 0);
+    memcpy(data + 1000, data + 1, 500);
+    CHECK(remount() == 0);
+    CHECK(compareFile("writeback", data, sizeof(data)) == 0);
+
+    // The dirty ratio bounds how much of the cache is changed at any time
+    CHECK(cachesize2(64) == 0);
+    CHECK(cachemode2(CACHE_WRITE_BACK, 10) == 0);
+    CHECK(remount() == 0);
+    for (int i = 0; i < 20; i++)
+    {
+        sprintf(name, "dirty%d", i);
+        handle = create2(name);
+        CHECK(handle >= 0);
+        CHECK(write2(handle, data, 300 + i) == 300 + i);
+        CHECK(close2(handle) == 0);
+        CHECK(cachestats2(&after) == 0);
+        CHECK(after.dirty * 100 <= after.capacity * 10);
+    }
+
+    CHECK(cachemode2(CACHE_WRITE_THROUGH, 0) == 0);
+    CHECK(cachestats2(&after) == 0);
+    CHECK(after.dirty == 0);
+    for (int i = 0; i < 20; i++)
+    {
+        sprintf(name, "dirty%d", i);
+        handle = open2(name);
+        CHECK(handle >= 0);
+        CHECK(pwrite2(handle, data, 100, 50) == 100);
+        CHECK(close2(handle) == 0);
+        CHECK(cachestats2(&after) == 0);
+        CHECK(after.dirty == 0);
+    }
+
+    CHECK(remount() == 0);
+    memcpy(data + 50, data, 100);
+    for (int i = 0; i < 20; i++)
+    {
+        sprintf(name, "dirty%d", i);
+        CHECK(compareFile(name, data, 300 + i) == 0);
+    }
+
+    return 0;
+}
+
+// Every name of a file shares one in-core inode, and every way out of create2,
+// sln2 and hln2, failed or not, gives back the inodes it took
+int testInodes()
+{
+    char data[1000], buffer[1000];
+    char name[16];
+    fill(data, sizeof(data), 0);
+    FILE2 handle = create2("inodes");
+    CHECK(handle >= 0);
+    CHECK(close2(handle) == 0);
+    CHECK(hln2("hard", "inodes") == 0);
+    CHECK(sln2("soft", "inodes") == 0);
+    CHECK(countInodeReferences() == 0);
+
+    // What is written through one name is read right away through the other
+    FILE2 first = open2("inodes");
+    FILE2 second = open2("hard");
+    CHECK(first >= 0 && second >= 0);
+    CHECK(write2(first, data, sizeof(data)) == sizeof(data));
+    CHECK(read2(second, buffer, sizeof(buffer)) == sizeof(data));
+    CHECK(memcmp(buffer, data, sizeof(data)) == 0);
+    CHECK(close2(first) == 0 && close2(second) == 0);
+    CHECK(countInodeReferences() == 0);
+
+    CHECK(hln2("hard", "inodes") != 0);
+    CHECK(hln2("none", "missing") != 0);
+    CHECK(sln2("soft", "inodes") != 0);
+    CHECK(countInodeReferences() == 0);
+
+    // A directory that grows past its direct and single indirect blocks
+    for (int i = 0; i < 300; i++)
+    {
+        sprintf(name, "inode%d", i);
+        handle = create2(name);
+        CHECK(handle >= 0);
+        CHECK(close2(handle) == 0);
+    }
+    CHECK(countInodeReferences() == 0);
+
+    CHECK(remount() == 0);
+    for (int i = 0; i < 300; i++)
+    {
+        sprintf(name, "inode%d", i);
+        handle = open2(name);
+        CHECK(handle >= 0);
+        CHECK(close2(handle) == 0);
+    }
+    CHECK(compareFile("hard", data, sizeof(data)) == 0);
+    CHECK(compareFile("soft", data, sizeof(data)) == 0);
+
+    // With the directory on the last record of its last block and no block left,
+    // a hard link can't get its record and leaves the file as it was. A file of
+    // pointers may not reach the end of the disk, so a few more files fill it.
+    for (int i = 0; i < 16; i++)
+    {
+        sprintf(name, "pad%d", i);
+        handle = create2(name);
+        CHECK(handle >= 0);
+        CHECK(close2(handle) == 0);
+    }
+    I_NODE *directory = getInode(0);
+    for (int i = 300; directory->bytesFileSize % blockBytes() != 0; i++)
+    {
+        sprintf(name, "inode%d", i);
+        handle = create2(name);
+        CHECK(handle >= 0);
+        CHECK(close2(handle) == 0);
+    }
+    releaseInode(directory);
+
+    for (int i = -1; i < 16 && freeBlocks() > 0; i++)
+    {
+        sprintf(name, "pad%d", i);
+        handle = open2(i < 0 ? "inodes" : name);
+        CHECK(handle >= 0);
+        CHECK(seek2(handle, -1) == 0);
+        while (write2(handle, data, sizeof(data)) == sizeof(data))
+            ;
+        CHECK(close2(handle) == 0);
+    }
+    CHECK(freeBlocks() == 0);
+
+    CHECK(hln2("full", "inodes") != 0);
+    CHECK(create2("full") < 0);
+    CHECK(countInodeReferences() == 0);
+
+    // Both names gone, the file gives its blocks back
+    CHECK(remount() == 0);
+    CHECK(delete2("hard") == 0);
+    CHECK(freeBlocks() == 0);
+    CHECK(delete2("inodes") == 0);
+    CHECK(freeBlocks() > 0);
+    CHECK(delete2("soft") == 0);
+    CHECK(countInodeReferences() == 0);
+
+    return 0;
+}
+
+// Names are found through the hash table as they are created, deleted and created
+// again, and after a remount, when the table is built again from the directory
+int testNames()
+{
+    char data[300];
+    char name[64];
+    DIRENT2 entry;
+    int count = 400;
+
+    fill(data, sizeof(data), 0);
+    for (int i = 0; i < count; i++)
+    {
+        sprintf(name, "name%d", i);
+        FILE2 handle = create2(name);
+        CHECK(handle >= 0);
+        CHECK(write2(handle, data, i % 200) == i % 200);
+        CHECK(close2(handle) == 0);
+    }
+    for (int i = 0; i < count; i++)
+    {
+        sprintf(name, "name%d", i);
+        CHECK(compareFile(name, data, i % 200) == 0);
+    }
+
+    // Deleted names are gone, the others still there
+    for (int i = 0; i < count; i += 3)
+    {
+        sprintf(name, "name%d", i);
+        CHECK(delete2(name) == 0);
+        CHECK(open2(name) < 0);
+        CHECK(delete2(name) != 0);
+    }
+    for (int i = 1; i < count; i += 3)
+    {
+        sprintf(name, "name%d", i);
+        CHECK(compareFile(name, data, i % 200) == 0);
+    }
+
+    // and can be used again, for other files
+    for (int i = 0; i < count; i += 3)
+    {
+        sprintf(name, "name%d", i);
+        FILE2 handle = create2(name);
+        CHECK(handle >= 0);
+        CHECK(write2(handle, data, 250 - i % 200) == 250 - i % 200);
+        CHECK(close2(handle) == 0);
+    }
+
+    // Creating a name that exists replaces the file, instead of adding a name
+    FILE2 handle = create2("name1");
+    CHECK(handle >= 0);
+    CHECK(close2(handle) == 0);
+
+    // Names as long as they can be, differing only in their last character
+    memset(name, 'x', 50);
+    name[50] = '\0';
+    for (char c = 'a'; c <= 'z'; c++)
+    {
+        name[49] = c;
+        handle = create2(name);
+        CHECK(handle >= 0);
+        CHECK(write2(handle, data, c - 'a') == c - 'a');
+        CHECK(close2(handle) == 0);
+    }
+
+    CHECK(remount() == 0);
+    for (int i = 0; i < count; i++)
+    {
+        int size = i == 1 ? 0 : i % 3 == 0 ? 250 - i % 200 : i % 200;
+        sprintf(name, "name%d", i);
+        CHECK(compareFile(name, data, size) == 0);
+    }
+    memset(name, 'x', 50);
+    name[50] = '\0';
+    for (char c = 'a'; c <= 'z'; c++)
+    {
+        name[49] = c;
+        CHECK(compareFile(name, data, c - 'a') == 0);
+    }
+    CHECK(open2("name400") < 0);
+    CHECK(open2("nam") < 0);
+
+    // The directory lists every name once
+    int listed = 0;
+    CHECK(opendir2() == 0);
+    while (readdir2(&entry) == 0)
+        listed++;
+    CHECK(closedir2() == 0);
+    CHECK(listed == count + 26);
+
+    return 0;
+}
+
+// Reads through the block map of an open file follow every change to the blocks
+// of the file: holes filled, the end cut and written again, and another handle
+int testBlockMap()
+{
+    int block = blockBytes();
+    int size = 300 * block;
+    char *model = (char *)malloc(size);
+    char *buffer = (char *)malloc(size);
+
+    fill(model, size, 0);
+    FILE2 handle = create2("blockmap");
+    CHECK(handle >= 0);
+    CHECK(write2(handle, model, size) == size);
+    for (int offset = 0; offset < size; offset += 7 * block + 13)
+    {
+        CHECK(pread2(handle, buffer, 100, offset) == 100);
+        CHECK(memcmp(buffer, model + offset, 100) == 0);
+    }
+
+    // A hole, read once as zeros, then written
+    int end = size + 20 * block;
+    CHECK(pwrite2(handle, model, block, end) == block);
+    CHECK(pread2(handle, buffer, block, size + 10 * block) == block);
+    for (int i = 0; i < block; i++)
+        CHECK(buffer[i] == 0);
+    CHECK(pwrite2(handle, model, block, size + 10 * block) == block);
+    CHECK(pread2(handle, buffer, block, size + 10 * block) == block);
+    CHECK(memcmp(buffer, model, block) == 0);
+
+    // The end of the file cut, and the blocks it gave back used again for new data
+    CHECK(seek2(handle, size / 2) == 0);
+    CHECK(truncate2(handle) == 0);
+    fill(model + size / 2, size / 2, 7);
+    CHECK(write2(handle, model + size / 2, size / 2) == size / 2);
+    CHECK(pread2(handle, buffer, size + 1, 0) == size);
+    CHECK(memcmp(buffer, model, size) == 0);
+
+    // A second handle on the same file sees the same blocks
+    FILE2 other = open2("blockmap");
+    CHECK(other >= 0);
+    CHECK(pwrite2(other, model, 3 * block, size - 3 * block) == 3 * block);
+    memcpy(model + size - 3 * block, model, 3 * block);
+    CHECK(pread2(handle, buffer, size, 0) == size);
+    CHECK(memcmp(buffer, model, size) == 0);
+    CHECK(close2(other) == 0);
+    CHECK(close2(handle) == 0);
+
+    CHECK(remount() == 0);
+    CHECK(compareFile("blockmap", model, size) == 0);
+
+    free(model);
+    free(buffer);
+
+    return 0;
+}
+
+// Takes every free bit of the bitmap `handle`, keeping them in `taken`, then gives
+// back a few far apart and then a range across words: the searches find exactly
+// those again, and nothing once they are taken. Every bit taken is given back.
+static int checkFullBitmap(int handle, int *taken, int limit)
+{
+    int count = 0, last = 0, bit;
+
+    while ((bit = searchBitmap2(handle, 0)) >= 0)
+    {
+        CHECK(count < limit && getBitmap2(handle, bit) == 0);
+        CHECK(setBitmap2(handle, bit, 1) == 0);
+        taken[count++] = bit;
+        last = bit > last ? bit : last;
+    }
+    CHECK(count > 200);
+
+    int freed[] = {taken[0], taken[count / 2], taken[count - 1]};
+    for (int i = 0; i < 3; i++)
+        CHECK(setBitmap2(handle, freed[i], 0) == 0);
+    for (int i = 0; i < 3; i++)
+    {
+        bit = searchBitmap2(handle, 0);
+        CHECK(bit == freed[0] || bit == freed[1] || bit == freed[2]);
+        CHECK(setBitmap2(handle, bit, 1) == 0);
+    }
+    CHECK(searchBitmap2(handle, 0) == -1);
+
+    CHECK(setRangeBitmap2(handle, last - 199, 200, 0) == 0);
+    for (int i = 0; i < 200; i++)
+    {
+        bit = searchBitmap2(handle, 0);
+        CHECK(bit >= last - 199 && bit <= last);
+        CHECK(setBitmap2(handle, bit, 1) == 0);
+    }
+    CHECK(searchBitmap2(handle, 0) == -1);
+
+    for (int i = 0; i < count; i++)
+        CHECK(setBitmap2(handle, taken[i], 0) == 0);
+    CHECK(searchBitmap2(handle, 0) >= 0);
+
+    return 0;
+}
+
+// The summary levels over the bitmaps lead the searches to the bits freed in a full bitmap
+int testBitmaps()
+{
+    SUPERBLOCK *superblock = getSuperblock();
+    int sizes = superblock->freeBlocksBitmapSize > superblock->freeInodeBitmapSize ? superblock->freeBlocksBitmapSize : superblock->freeInodeBitmapSize;
+    int limit = sizes * superblock->blockSize * SECTOR_SIZE * 8;
+    int *taken = (int *)malloc(sizeof(int) * limit);
+
+    lockLibrary();
+    int result = checkFullBitmap(BITMAP_INODE, taken, limit) == 0 && checkFullBitmap(BITMAP_DADOS, taken, limit) == 0 ? 0 : -1;
+    unlockLibrary(NULL);
+    free(taken);
+    CHECK(result == 0);
+
+    // Everything given back is there to use
+    FILE2 handle = create2("bitmaps");
+    CHECK(handle >= 0);
+    CHECK(close2(handle) == 0);
+    CHECK(remount() == 0);
+    CHECK(compareFile("bitmaps", "", 0) == 0);
+
+    return 0;
+}
+
+// A write that runs out of space, with its blocks allocated up front, keeps only
+// the blocks it wrote: the others, and those of the file, all come back
+int testFull()
+{
+    int block = blockBytes();
+    char name[16];
+
+    // Only a few blocks are left free
+    char *data = (char *)calloc(1000, block);
+    for (int i = 0; freeBlocks() > 100; i++)
+    {
+        int blocks = freeBlocks() - 100 < 1000 ? freeBlocks() - 100 : 1000;
+        sprintf(name, "pad%d", i);
+        FILE2 handle = create2(name);
+        CHECK(handle >= 0);
+        CHECK(write2(handle, data, blocks * block) == blocks * block);
+        CHECK(close2(handle) == 0);
+    }
+    DWORD freeBefore = freeBlocks();
+
+    FILE2 handle = create2("full");
+    CHECK(handle >= 0);
+    CHECK(write2(handle, data, 2 * block) == 2 * block);
+    DWORD left = freeBlocks();
+
+    // Every free block goes to data, which leaves none for an index block
+    int written = write2(handle, data, left * block);
+    if (written < 0)
+        CHECK(freeBlocks() == left);
+    else
+        CHECK(freeBlocks() + written / block <= left);
+    CHECK(close2(handle) == 0);
+
+    CHECK(remount() == 0);
+    CHECK(delete2("full") == 0);
+    CHECK(freeBlocks() == freeBefore);
+
+    free(data);
+
+    return 0;
+}
+
+// Number of extents of `filename`, or -1 if it isn't mapped by extents
+static int countExtents(char *filename)
+{
+    RECORD record;
+    if (getRecordByName(filename, &record) != 0)
+        return -1;
+
+    I_NODE *inode = getInode(record.inodeNumber);
+    int count = isExtentInode(inode) ? (int)inode->doubleIndPtr : -1;
+    releaseInode(inode);
+
+    return count;
+}
+
+// A file written in one go is a single extent. Two files written a block at a
+// time, in turns, need more extents than the inode holds, in a chain of extent
+// blocks that is read back after a remount and freed with the file.
+int testExtents()
+{
+    int block = blockBytes();
+    int blocks = 100;
+    char *first = (char *)malloc(blocks * block);
+    char *second = (char *)malloc(blocks * block);
+    BOOL extents = getInodeFormat() == INODE_FORMAT_EXTENTS;
+    DWORD freeBefore = freeBlocks();
+
+    fill(first, blocks * block, 0);
+    fill(second, blocks * block, 3);
+    FILE2 handle = create2("contiguous");
+    CHECK(handle >= 0);
+    CHECK(write2(handle, first, blocks * block) == blocks * block);
+    CHECK(close2(handle) == 0);
+    CHECK(!extents || countExtents("contiguous") == 1);
+
+    FILE2 handles[2] = {create2("first"), create2("second")};
+    CHECK(handles[0] >= 0 && handles[1] >= 0);
+    for (int i = 0; i < blocks; i++)
+    {
+        CHECK(write2(handles[0], first + i * block, block) == block);
+        CHECK(write2(handles[1], second + i * block, block) == block);
+    }
+    CHECK(close2(handles[0]) == 0 && close2(handles[1]) == 0);
+    CHECK(!extents || countExtents("first") > blocks / 2);
+
+    CHECK(remount() == 0);
+    CHECK(compareFile("contiguous", first, blocks * block) == 0);
+    CHECK(compareFile("first", first, blocks * block) == 0);
+    CHECK(compareFile("second", second, blocks * block) == 0);
+
+    // Cut in the middle of the chain, and written again
+    handle = open2("first");
+    CHECK(handle >= 0);
+    CHECK(seek2(handle, blocks / 2 * block + 10) == 0);
+    CHECK(truncate2(handle) == 0);
+    CHECK(write2(handle, second, 10 * block) == 10 * block);
+    CHECK(close2(handle) == 0);
+    memcpy(first + blocks / 2 * block + 10, second, 10 * block);
+    int size = blocks / 2 * block + 10 + 10 * block;
+
+    CHECK(remount() == 0);
+    CHECK(compareFile("first", first, size) == 0);
+    CHECK(compareFile("second", second, blocks * block) == 0);
+
+    CHECK(delete2("contiguous") == 0);
+    CHECK(delete2("first") == 0);
+    CHECK(delete2("second") == 0);
+    CHECK(freeBlocks() == freeBefore);
+
+    free(first);
+    free(second);
+
+    return 0;
+}
+
+// Compares the free space index with the runs of free bits of the data bitmap:
+// every run, the totals, the largest run and the best fit for a few blocks
+static int checkSpaceIndex()
+{
+    DWORD bits = getSuperblock()->diskSize;
+    DWORD runs = 0, blocks = 0, largest = 0, best = 0, bestFirst = 0;
+    DWORD first, length;
+
+    for (DWORD bit = 0; bit < bits;)
+    {
+        if (getBitmap2(BITMAP_DADOS, bit) != 0)
+        {
+            CHECK(spaceFindRun(bit, &first, &length) != 0);
+            bit++;
+            continue;
+        }
+
+        DWORD runLength = 0;
+        while (bit + runLength < bits && getBitmap2(BITMAP_DADOS, bit + runLength) == 0)
+            runLength++;
+        CHECK(spaceFindRun(bit + runLength / 2, &first, &length) == 0);
+        CHECK(first == bit && length == runLength);
+
+        runs++;
+        blocks += runLength;
+        largest = runLength > largest ? runLength : largest;
+        if (runLength >= 3 && (best == 0 || runLength < best))
+        {
+            best = runLength;
+            bestFirst = bit;
+        }
+        bit += runLength;
+    }
+
+    DWORD indexRuns, indexBlocks;
+    spaceGetStats(&indexRuns, &indexBlocks);
+    CHECK(indexRuns == runs && indexBlocks == blocks);
+    CHECK(spaceLargest(&first, &length) == 0 && length == largest);
+    CHECK(best == 0 || (spaceBestFit(3, &first, &length) == 0 && first == bestFirst && length == best));
+
+    return 0;
+}
+
+// The free space index follows the data bitmap as files of a few blocks are
+// created, deleted and cut, and is built again from it when mounting
+int testSpace()
+{
+    int block = blockBytes();
+    char data[10 * 1024];
+    char name[16];
+
+    fill(data, sizeof(data), 0);
+    for (int i = 0; i < 60; i++)
+    {
+        sprintf(name, "space%d", i);
+        FILE2 handle = create2(name);
+        CHECK(handle >= 0);
+        CHECK(write2(handle, data, (i % 5 + 1) * block) == (i % 5 + 1) * block);
+        CHECK(close2(handle) == 0);
+    }
+    for (int i = 0; i < 60; i += 2 + i % 3)
+    {
+        sprintf(name, "space%d", i);
+        CHECK(delete2(name) == 0);
+    }
+    for (int i = 1; i < 60; i += 4)
+    {
+        sprintf(name, "space%d", i);
+        FILE2 handle = open2(name);
+        CHECK(handle >= 0);
+        CHECK(seek2(handle, block / 2) == 0);
+        CHECK(truncate2(handle) == 0);
+        CHECK(close2(handle) == 0);
+    }
+    reclaimOrphans();
+
+    lockLibrary();
+    int result = checkSpaceIndex();
+    unlockLibrary(NULL);
+    CHECK(result == 0);
+
+    // Filled again, partly, from the runs just freed
+    FILE2 handle = create2("refill");
+    CHECK(handle >= 0);
+    CHECK(write2(handle, data, 7 * block) == 7 * block);
+    CHECK(close2(handle) == 0);
+
+    CHECK(remount() == 0);
+    lockLibrary();
+    result = checkSpaceIndex();
+    unlockLibrary(NULL);
+    CHECK(result == 0);
+
+    return 0;
+}
+
+// Free runs of the mounted partition, once every deleted file was freed
+static DWORD freeRuns()
+{
+    DWORD runs, blocks;
+
+    reclaimOrphans();
+    lockLibrary();
+    spaceGetStats(&runs, &blocks);
+    unlockLibrary(NULL);
+
+    return runs;
+}
+
+// Deleting files whose blocks are scattered, with holes and past their double
+// indirect block, gives back every block, index blocks included, and the disk
+// ends up in as few free runs as before
+int testFreeRuns()
+{
+    int block = blockBytes();
+    int blocks = 200;
+    char *data = (char *)malloc(block + 1);
+    DWORD freeBefore = freeBlocks();
+    DWORD runsBefore = freeRuns();
+
+    fill(data, block, 0);
+    FILE2 handles[3] = {create2("scattered"), create2("other"), create2("holes")};
+    CHECK(handles[0] >= 0 && handles[1] >= 0 && handles[2] >= 0);
+    for (int i = 0; i < blocks; i++)
+    {
+        CHECK(write2(handles[0], data, block) == block);
+        CHECK(write2(handles[1], data, i % 3 == 0 ? block : 10) == (i % 3 == 0 ? block : 10));
+        CHECK(pwrite2(handles[2], data, 10, i * 3 * block) == 10);
+    }
+    for (int i = 0; i < 3; i++)
+        CHECK(close2(handles[i]) == 0);
+    CHECK(hln2("link", "scattered") == 0);
+    CHECK(freeBlocks() < freeBefore - blocks);
+
+    CHECK(remount() == 0);
+    CHECK(delete2("scattered") == 0);
+    CHECK(delete2("other") == 0);
+    CHECK(delete2("holes") == 0);
+
+    // The other name keeps the file, and its blocks, until it goes too
+    FILE2 handle = open2("link");
+    CHECK(handle >= 0);
+    CHECK(pread2(handle, data, block + 1, (blocks - 1) * block) == block);
+    CHECK(close2(handle) == 0);
+    CHECK(delete2("link") == 0);
+
+    CHECK(freeBlocks() == freeBefore);
+    CHECK(freeRuns() == runsBefore);
+
+    free(data);
+
+    return 0;
+}
+
+// Writes `size` bytes of `model` to the start of the files `prefix0`, `prefix1`...
+// up to `count` of them, creating those which don't exist yet
+static int writeFiles(char *prefix, int count, char *model, int size)
+{
+    char name[16];
+
+    for (int i = 0; i < count; i++)
+    {
+        sprintf(name, "%s%d", prefix, i);
+        FILE2 handle = open2(name);
+        if (handle < 0)
+            handle = create2(name);
+        CHECK(handle >= 0);
+        CHECK(write2(handle, model, size) == size);
+        CHECK(close2(handle) == 0);
+    }
+
+    return 0;
+}
+
+// Deletes the files written by `writeFiles`. Called holding the lock, it leaves
+// their blocks to the reclaimer, which can't run until the lock is given back.
+static int deleteFiles(char *prefix, int count)
+{
+    char name[16];
+
+    for (int i = 0; i < count; i++)
+    {
+        sprintf(name, "%s%d", prefix, i);
+        CHECK(delete2(name) == 0);
+    }
+    CHECK(getSuperblock()->firstOrphan != 0);
+
+    return 0;
+}
+
+// Files deleted right before an unmount are freed after the next mount
+int testOrphans()
+{
+    int size = 100 * blockBytes();
+    char *model = (char *)malloc(size);
+
+    // The directory may need blocks for the names, so the free blocks are counted
+    // once they are in it. Each empty file has a block already.
+    CHECK(writeFiles("orphan", 4, model, 0) == 0);
+    DWORD freeBefore = freeBlocks() + 4;
+
+    fill(model, size, 0);
+    CHECK(writeFiles("orphan", 4, model, size) == 0);
+    CHECK(remount() == 0);
+
+    lockLibrary();
+    int result = deleteFiles("orphan", 4) == 0 && umount() == 0 && mount(0) == 0 && getSuperblock()->firstOrphan != 0 ? 0 : -1;
+    unlockLibrary(NULL);
+    CHECK(result == 0);
+
+    CHECK(freeBlocks() == freeBefore);
+    CHECK(getSuperblock()->firstOrphan == 0);
+    CHECK(open2("orphan0") < 0);
+
+    // The inodes freed can be used again
+    FILE2 handle = create2("orphan0");
+    CHECK(handle >= 0);
+    freeBefore = freeBlocks() + 1;
+    CHECK(write2(handle, model, size) == size);
+    CHECK(close2(handle) == 0);
+    CHECK(remount() == 0);
+    CHECK(compareFile("orphan0", model, size) == 0);
+
+    CHECK(delete2("orphan0") == 0);
+    CHECK(freeBlocks() == freeBefore);
+
+    free(model);
+
+    return 0;
+}
+
+// With the disk split in two partitions, formats the second one while the files
+// deleted from the first one still wait for the reclaimer, which must go on
+// freeing their blocks in the first one
+static int checkOrphanFormat(int blockSize)
+{
+    int size = 100 * blockBytes();
+    char *model = (char *)malloc(size);
+
+    CHECK(umount() == 0);
+    CHECK(format2(0, blockSize) == 0 && format2(1, blockSize) == 0);
+    CHECK(mount(1) == 0);
+    DWORD otherFree = freeBlocks();
+    CHECK(umount() == 0 && mount(0) == 0);
+
+    CHECK(writeFiles("orphan", 4, model, 0) == 0);
+    DWORD freeBefore = freeBlocks() + 4;
+    fill(model, size, 0);
+    CHECK(writeFiles("orphan", 4, model, size) == 0);
+
+    lockLibrary();
+    int result = deleteFiles("orphan", 4) == 0 && format2(1, blockSize) == 0 ? 0 : -1;
+    unlockLibrary(NULL);
+    CHECK(result == 0);
+
+    CHECK(freeBlocks() == freeBefore);
+    CHECK(getSuperblock()->firstOrphan == 0);
+    CHECK(remount() == 0);
+    CHECK(freeBlocks() == freeBefore);
+
+    CHECK(umount() == 0 && mount(1) == 0);
+    CHECK(freeBlocks() == otherFree);
+
+    free(model);
+
+    return 0;
+}
+
+int testOrphanFormat()
+{
+    MBR *mbr = getMBR();
+    PARTITION whole = mbr->partitions[0];
+    int blockSize = getSuperblock()->blockSize;
+
+    mbr->partitionQuantity = 2;
+    mbr->partitions[1] = whole;
+    mbr->partitions[0].lastSector = whole.lastSector / 2;
+    mbr->partitions[1].firstSector = whole.lastSector / 2 + 1;
+
+    int result = checkOrphanFormat(blockSize);
+
+    umount();
+    mbr->partitionQuantity = 1;
+    mbr->partitions[0] = whole;
+    CHECK(result == 0);
+    CHECK(mount(0) == 0);
+
+    return 0;
+}
+
+// pread2 and pwrite2 work at the offset they are given and leave the position of
+// the file, used by read2 and write2, where it was
+int testPositional()
+{
+    int size = 2000 + 3 * blockBytes();
+    char *model = (char *)malloc(size + 500);
+    char *buffer = (char *)malloc(size + 500);
+
+    fill(model, size + 500, 0);
+    FILE2 handle = create2("positional");
+    CHECK(handle >= 0);
+    CHECK(write2(handle, model, 1000) == 1000);
+
+    CHECK(pread2(handle, buffer, 100, 10) == 100);
+    CHECK(memcmp(buffer, model + 10, 100) == 0);
+    CHECK(pwrite2(handle, model + 1000, size - 1000, 1000) == size - 1000);
+    CHECK(write2(handle, model + 1000, 300) == 300);
+    CHECK(pwrite2(handle, model + 20, 50, 20) == 50);
+    CHECK(read2(handle, buffer, 100) == 100);
+    CHECK(memcmp(buffer, model + 1300, 100) == 0);
+
+    // Past the end, and across it
+    CHECK(pread2(handle, buffer, 100, size + 10) == 0);
+    CHECK(pread2(handle, buffer, 100, size - 30) == 30);
+    CHECK(memcmp(buffer, model + size - 30, 30) == 0);
+    CHECK(pwrite2(handle, model + size, 500, size) == 500);
+
+    // Refused with a bad size, or without an open file
+    CHECK(pread2(handle, buffer, -1, 0) == -1);
+    CHECK(pwrite2(handle, buffer, -1, 0) == -1);
+    CHECK(close2(handle) == 0);
+    CHECK(pread2(handle, buffer, 10, 0) == -1);
+    CHECK(pwrite2(handle, buffer, 10, 0) == -1);
+
+    CHECK(remount() == 0);
+    CHECK(compareFile("positional", model, size + 500) == 0);
+
+    free(model);
+    free(buffer);
+
+    return 0;
+}
+
+// truncate2 frees the blocks past the current pointer, and the index blocks left empty
+int testTruncate()
+{
+    int block = blockBytes();
+    int size = 200 * block + 30;
+    int kept = block + 10;
+    char *model = (char *)malloc(size);
+    DWORD freeBefore = freeBlocks();
+
+    fill(model, size, 0);
+    FILE2 handle = create2("truncate");
+    CHECK(handle >= 0);
+    CHECK(write2(handle, model, size) == size);
+    CHECK(close2(handle) == 0);
+    CHECK(freeBefore - freeBlocks() >= 201);
+
+    CHECK(remount() == 0);
+    handle = open2("truncate");
+    CHECK(handle >= 0);
+    CHECK(seek2(handle, kept) == 0);
+    CHECK(truncate2(handle) == 0);
+    CHECK(close2(handle) == 0);
+
+    // The two blocks left fit in the inode, so no index block is needed anymore
+    CHECK(freeBefore - freeBlocks() == 2);
+
+    CHECK(remount() == 0);
+    CHECK(compareFile("truncate", model, kept) == 0);
+
+    // Growing it again reads zeros where the old bytes were
+    handle = open2("truncate");
+    CHECK(handle >= 0);
+    CHECK(pwrite2(handle, model + 3 * block, 20, 3 * block) == 20);
+    CHECK(close2(handle) == 0);
+    memset(model + kept, 0, 3 * block - kept);
+    CHECK(compareFile("truncate", model, 3 * block + 20) == 0);
+
+    handle = open2("truncate");
+    CHECK(handle >= 0);
+    CHECK(truncate2(handle) == 0);
+    CHECK(close2(handle) == 0);
+    CHECK(freeBlocks() == freeBefore);
+
+    CHECK(delete2("truncate") == 0);
+    CHECK(freeBlocks() == freeBefore);
+
+    free(model);
+
+    return 0;
+}
+
+// writev2 and readv2 with buffers that start and end anywhere in a block
+int testVector()
+{
+    int block = blockBytes();
+    int sizes[] = {1, block - 1, block + 3, 2 * block + 5, 7, 3 * block, 0, block / 2};
+    int count = sizeof(sizes) / sizeof(sizes[0]);
+    int size = 0;
+    IOVEC2 vector[8];
+
+    for (int i = 0; i < count; i++)
+        size += sizes[i];
+
+    char *model = (char *)malloc(size + 3);
+    char *buffer = (char *)malloc(size);
+    fill(model, 3, 0);
+    fill(model + 3, size, 3);
+
+    FILE2 handle = create2("vector");
+    CHECK(handle >= 0);
+    CHECK(write2(handle, model, 3) == 3);
+    for (int i = 0, offset = 3; i < count; offset += sizes[i], i++)
+        vector[i] = (IOVEC2){model + offset, sizes[i]};
+    CHECK(writev2(handle, vector, count) == size);
+    CHECK(close2(handle) == 0);
+
+    CHECK(remount() == 0);
+    CHECK(compareFile("vector", model, size + 3) == 0);
+
+    // Read back split another way, reaching the end of the file in the last buffer
+    handle = open2("vector");
+    CHECK(handle >= 0);
+    CHECK(seek2(handle, 3) == 0);
+    memset(buffer, 0, size);
+    int half = size / 2;
+    IOVEC2 parts[] = {{buffer, 5}, {buffer + 5, half - 5}, {buffer + half, block}, {buffer + half + block, size}};
+    CHECK(readv2(handle, parts, 4) == size);
+    CHECK(memcmp(buffer, model + 3, size) == 0);
+    CHECK(readv2(handle, parts, 4) == 0);
+
+    // A vector with a bad size is refused before anything is written
+    IOVEC2 bad[] = {{buffer, 10}, {buffer, -1}};
+    CHECK(seek2(handle, 0) == 0);
+    CHECK(writev2(handle, bad, 2) == -1);
+    CHECK(readv2(handle, bad, 2) == -1);
+    CHECK(close2(handle) == 0);
+    CHECK(compareFile("vector", model, size + 3) == 0);
+
+    CHECK(delete2("vector") == 0);
+
+    free(buffer);
+    free(model);
+
+    return 0;
+}
+
+// Reaps results until `count` requests have come back, checking each one got
+// `size` bytes and came back once
+static int reapAll(int count, int size)
+{
+    AIOEVENT2 events[4];
+    int seen[16] = {0};
+
+    for (int reaped = 0; reaped < count;)
+    {
+        int n = reap2(events, 1, 4);
+        CHECK(n >= 1 && n <= 4);
+        for (int i = 0; i < n; i++)
+        {
+            long index = (long)events[i].data;
+            CHECK(index >= 0 && index < count && !seen[index]);
+            CHECK(events[i].result == size);
+            seen[index] = 1;
+        }
+        reaped += n;
+    }
+
+    return 0;
+}
+
+// Requests sent with submit2 are done as pwrite2 and pread2 would do them, and
+// each comes back once through reap2
+int testAsync()
+{
+    int chunk = blockBytes() + 13;
+    int count = 16;
+    char *model = (char *)malloc(count * chunk);
+    char *buffer = (char *)calloc(count, chunk);
+    AIOREQ2 requests[16];
+    AIOEVENT2 events[4];
+
+    fill(model, count * chunk, 0);
+    FILE2 handle = create2("async");
+    CHECK(handle >= 0);
+    CHECK(aiofd2() >= 0);
+
+    for (int i = 0; i < count; i++)
+        requests[i] = (AIOREQ2){AIO_WRITE, handle, i * chunk, model + i * chunk, chunk, (void *)(long)i};
+    CHECK(submit2(requests, count) == count);
+    CHECK(reapAll(count, chunk) == 0);
+
+    for (int i = 0; i < count; i++)
+        requests[i] = (AIOREQ2){AIO_READ, handle, i * chunk, buffer + i * chunk, chunk, (void *)(long)i};
+    CHECK(submit2(requests, count) == count);
+    CHECK(reapAll(count, chunk) == 0);
+    CHECK(memcmp(buffer, model, count * chunk) == 0);
+
+    // Nothing is waited for when nothing was sent
+    CHECK(reap2(events, 0, 4) == 0);
+    CHECK(reap2(events, 2, 4) == 0);
+
+    // Sending stops at the first bad request, while a file that isn't open is
+    // only found out when the request is done, as pread2 would
+    requests[2].opcode = -1;
+    CHECK(submit2(requests, 4) == 2);
+    CHECK(reapAll(2, chunk) == 0);
+    requests[0].handle = -1;
+    CHECK(submit2(requests, 1) == 1);
+    CHECK(reap2(events, 1, 4) == 1);
+    CHECK(events[0].result == -1);
+    CHECK(close2(handle) == 0);
+
+    // and nothing is taken without a mounted partition
+    CHECK(umount() == 0);
+    CHECK(submit2(requests, 1) < 0);
+    CHECK(mount(0) == 0);
+    CHECK(compareFile("async", model, count * chunk) == 0);
+
+    free(model);
+    free(buffer);
+
+    return 0;
+}
+
+int main()
+{
+    int formats[] = {INODE_FORMAT_INDIRECT, INODE_FORMAT_EXTENTS};
+    char *formatNames[] = {"indirect", "extents"};
+    int blockSizes[] = {1, 4};
+    int failed = 0;
+
+    if (set_ram_disk_size(DISK_SECTORS) != 0 || set_disk_mode(DISK_MODE_RAM) != 0)
+        return 1;
+
+    for (int f = 0; f < 2; f++)
+        for (int b = 0; b < 2; b++)
+            for (int i = 0; testList[i].f != NULL; i++)
+            {
+                int result = inodeformat2(formats[f]) == 0 && cachesize2(CACHE_DEFAULT_SECTORS) == 0 && cachemode2(CACHE_WRITE_BACK, CACHE_DEFAULT_DIRTY_RATIO) == 0 && format2(0, blockSizes[b]) == 0 && mount(0) == 0 ? 0 : -1;
+                if (result == 0)
+                    result = testList[i].f();
+                umount();
+
+                printf("%s %s, %s, %d sector(s) per block\n", result == 0 ? "PASS" : "FAIL", testList[i].name, formatNames[f], blockSizes[b]);
+                failed += result != 0;
+            }
+
+    printf("%d test(s) failed\n", failed);
+
+    return failed > 0 ? 1 : 0;
+}